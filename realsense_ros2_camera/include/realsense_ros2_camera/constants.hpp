@@ -30,11 +30,138 @@
 
 namespace realsense_ros2_camera
 {
+// Run as a managed lifecycle node (RealSenseCameraLifecycle) instead of streaming at startup.
+const bool LIFECYCLE = false;
+
 const bool POINTCLOUD = false;
 const bool ALIGN_POINTCLOUD = true;
 const bool SYNC_FRAMES = true;
 
 const bool ALIGN_DEPTH = true;
+const bool COLOR_ALIGNED_TO_DEPTH = false;
+const bool UPSAMPLE_DEPTH = false;
+const int UPSAMPLE_RADIUS = 3;
+const double UPSAMPLE_SIGMA_SPATIAL = 2.0;           // pixels
+const double UPSAMPLE_SIGMA_COLOR = 12.0;            // luma levels
+const double UPSAMPLE_BUDGET_MS = 15.0;
+const int PROCESSING_THREADS = 0;                    // 0: hardware concurrency
+const char REGISTRATION_ENGINE[] = "rs2";            // "rs2" (rs2::align) or "zbuffer"
+const bool REGISTRATION_HOLE_FILL = true;
+const bool REGISTRATION_BENCHMARK = false;
+
+// Empty: depth+color whenever a point cloud or aligned depth is enabled
+const char SYNC_GROUPS[] = "";
+const bool FRAME_MATCHER = false;
+const double FRAME_MATCHER_TOLERANCE_MS = 0.0;      // 0: half of the depth frame period
+const double FRAME_MATCHER_MAX_WAIT_MS = 40.0;
+
+const bool POINTCLOUD_BANDS = false;
+const int POINTCLOUD_BAND_ROWS = 60;
+const bool POINTCLOUD_BANDS_BOTTOM_UP = true;
+
+const bool CHANGE_GATE = false;
+const int CHANGE_GATE_GRID_STEP = 8;
+const double CHANGE_GATE_DEPTH_DELTA = 0.03;        // meters
+const double CHANGE_GATE_CHANGED_RATIO = 0.01;
+const double CHANGE_GATE_KEYFRAME_PERIOD = 1.0;     // seconds
+const double CHANGE_GATE_GYRO_THRESHOLD = 0.0;      // rad/s, 0 disables the IMU check
+
+const bool ACCUMULATE_CLOUD = false;
+const double ACCUMULATE_VOXEL_SIZE = 0.02;          // meters
+const double ACCUMULATE_DECAY = 0.8;                // weight kept per frame
+const double ACCUMULATE_MIN_WEIGHT = 0.1;
+const int ACCUMULATE_MAX_VOXELS = 200000;
+const int ACCUMULATE_PIXEL_STEP = 2;
+const double ACCUMULATE_PUBLISH_RATE = 5.0;         // Hz
+const double ACCUMULATE_MAX_DEPTH = 5.0;            // meters
+
+const bool TSDF = false;
+const double TSDF_VOXEL_SIZE = 0.01;                 // meters
+const double TSDF_TRUNCATION = 0.04;                 // meters
+const int TSDF_MAX_BLOCKS = 4096;                    // 8x8x8 voxels each
+const double TSDF_MAX_DEPTH = 2.0;                   // meters
+const int TSDF_PIXEL_STEP = 2;
+const char TSDF_WORLD_FRAME[] = "";                  // empty: base_frame_id
+const double TSDF_PUBLISH_RATE = 1.0;                // Hz
+const float TSDF_MAX_WEIGHT = 64.f;
+const float TSDF_MIN_WEIGHT = 2.f;
+
+const bool CLUSTERING = false;
+const double CLUSTER_DISTANCE = 0.05;                // meters
+const int CLUSTER_MIN_POINTS = 50;
+const int CLUSTER_PIXEL_STEP = 2;
+const double CLUSTER_MAX_DEPTH = 4.0;                // meters
+
+const bool PIXELS_TO_3D = false;
+const int PIXELS_TO_3D_MAX_MEDIAN_WINDOW = 31;       // pixels, larger windows are clamped
+
+const int IMU_DECIMATED_FPS = 0;                     // 0 disables the decimated IMU topics
+
+const bool TRIGGERED_CAPTURE = false;
+const bool TRIGGER_STOP_SENSORS = false;             // stop image sensors between triggers
+const int TRIGGER_WARMUP_FRAMES = 0;                 // skipped after a trigger, for auto exposure
+const int TRIGGER_TIMEOUT_MS = 2000;                 // on top of the frame time of a trigger
+
+const bool SNAPSHOT = false;
+const int SNAPSHOT_WARMUP_FRAMES = 5;                // skipped after restart for auto exposure
+const int SNAPSHOT_TIMEOUT_MS = 3000;
+
+const bool QUANTIZED_DEPTH = false;
+const char QUANTIZED_DEPTH_MODE[] = "disparity";     // "disparity" or "log"
+const double QUANTIZED_DEPTH_MIN = 0.2;              // meters
+const double QUANTIZED_DEPTH_MAX = 10.0;             // meters
+
+const bool VALIDITY_MASK = false;
+const double VALIDITY_MIN_DEPTH = 0.1;               // meters
+const double VALIDITY_MAX_DEPTH = 5.0;               // meters
+
+const bool HOLE_FILLING = false;
+const int HOLE_FILLING_MAX_LEVELS = 6;               // fills holes up to 2^levels pixels wide
+const double HOLE_FILLING_BUDGET_MS = 5.0;
+
+const bool PSEUDO_LIDAR = false;
+const int PSEUDO_LIDAR_RINGS = 16;
+const int PSEUDO_LIDAR_COLUMNS = 512;
+const double PSEUDO_LIDAR_MIN_ELEVATION = -15.0;     // degrees
+const double PSEUDO_LIDAR_MAX_ELEVATION = 15.0;      // degrees
+const double PSEUDO_LIDAR_MAX_RANGE = 8.0;           // meters
+
+const bool DETECTION_FUSION = false;
+const double DETECTION_MATCH_TOLERANCE_MS = 20.0;
+const double DETECTION_ROI_SHRINK = 0.2;             // fraction of the box ignored at its border
+const int DETECTION_FRAME_BUFFER = 8;                // aligned depth frames kept for matching
+const int DETECTION_HISTOGRAM_BINS = 1024;
+const float DETECTION_HISTOGRAM_BIN_SIZE = 0.01f;    // meters
+
+const bool VIDEO_ENCODING = false;                   // requires a build with REALSENSE_X264
+const int VIDEO_BITRATE = 2000;                      // kbit/s
+const int VIDEO_GOP = 30;                            // frames between keyframes
+const char VIDEO_PRESET[] = "ultrafast";
+const char VIDEO_PROFILE[] = "baseline";
+const bool VIDEO_ZERO_LATENCY = true;
+const int VIDEO_THREADS = 1;                         // x264 threads, 0 for automatic
+
+const int MEMORY_BUDGET_MB = 0;                      // of the estimate, 0 for no budget
+const int MEMORY_MIN_FRAME_QUEUE = 2;                // frames kept by librealsense per stream
+const int MEMORY_DEFAULT_FRAME_QUEUE = 16;           // librealsense default
+
+const bool METRICS = false;
+const char METRICS_ADDRESS[] = "127.0.0.1";          // loopback only unless set explicitly
+const int METRICS_PORT = 9464;
+
+// Point clouds and camera info only: images go through image_transport, which publishes
+// typed messages.
+const bool SERIALIZED_PUBLISH = false;
+const bool SERIALIZED_PUBLISH_BENCHMARK = false;
+
+// Number of frames over which latency statistics are averaged before logging.
+const int STATS_REPORT_FRAMES = 300;
+
+// Real-time audit (REALSENSE_RT_AUDIT builds): frames of each stage skipped at startup, and
+// allowed heap allocations and mutex locks in a single frame of a stage, -1 for no budget.
+const int RT_AUDIT_WARMUP_FRAMES = 30;
+const int RT_AUDIT_ALLOCATION_BUDGET = -1;
+const int RT_AUDIT_LOCK_BUDGET = -1;
 
 const int DEPTH_WIDTH = 640;
 const int DEPTH_HEIGHT = 480;
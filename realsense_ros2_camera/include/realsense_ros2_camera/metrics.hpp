@@ -0,0 +1,169 @@
+// Copyright (c) 2018 Intel Corporation. All Rights Reserved
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#pragma once
+#ifndef REALSENSE_ROS2_CAMERA__METRICS_HPP_
+#define REALSENSE_ROS2_CAMERA__METRICS_HPP_
+
+// Performance counters served in the Prometheus text format. Metrics are registered once and
+// then updated through references with relaxed atomics only.
+namespace realsense_ros2_camera
+{
+namespace metrics
+{
+class Counter
+{
+public:
+  void add(uint64_t value = 1)
+  {
+    _value.fetch_add(value, std::memory_order_relaxed);
+  }
+
+  uint64_t value() const
+  {
+    return _value.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<uint64_t> _value{0};
+};
+
+class Gauge
+{
+public:
+  void set(double value)
+  {
+    _value.store(value, std::memory_order_relaxed);
+  }
+
+  double value() const
+  {
+    return _value.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<double> _value{0.0};
+};
+
+// Histogram over fixed, increasing upper bounds.
+class Histogram
+{
+public:
+  explicit Histogram(const std::vector<double> & bounds);
+
+  void observe(double value);
+
+  const std::vector<double> & bounds() const {return _bounds;}
+  // Observations per bucket, the last one above every bound; not cumulative.
+  std::vector<uint64_t> buckets() const;
+  double sum() const {return _sum.load(std::memory_order_relaxed);}
+
+private:
+  std::vector<double> _bounds;
+  std::unique_ptr<std::atomic<uint64_t>[]> _buckets;
+  std::atomic<double> _sum{0.0};
+};
+
+// Observes the lifetime of a scope, in seconds.
+class ScopedTimer
+{
+public:
+  explicit ScopedTimer(Histogram & histogram)
+  : _histogram(histogram),
+    _start(std::chrono::steady_clock::now())
+  {}
+
+  ~ScopedTimer()
+  {
+    _histogram.observe(std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - _start).count());
+  }
+
+private:
+  Histogram & _histogram;
+  std::chrono::steady_clock::time_point _start;
+};
+
+// Metric families by name. labels is the Prometheus label list of one series, for example
+// stream="depth", and is empty for a series without labels.
+class Registry
+{
+public:
+  Counter & counter(
+    const std::string & name, const std::string & help,
+    const std::string & labels = "");
+  Gauge & gauge(
+    const std::string & name, const std::string & help,
+    const std::string & labels = "");
+  Histogram & histogram(
+    const std::string & name, const std::string & help,
+    const std::vector<double> & bounds, const std::string & labels = "");
+
+  // Text exposition format, version 0.0.4
+  std::string render() const;
+
+private:
+  struct Family
+  {
+    std::string help;
+    std::string type;
+    std::map<std::string, std::unique_ptr<Counter>> counters;
+    std::map<std::string, std::unique_ptr<Gauge>> gauges;
+    std::map<std::string, std::unique_ptr<Histogram>> histograms;
+  };
+
+  Family & family(const std::string & name, const std::string & help, const char * type);
+
+  mutable std::mutex _mutex;
+  std::map<std::string, Family> _families;
+};
+
+// Minimal HTTP/1.0 server for GET /metrics, on its own thread.
+class Server
+{
+public:
+  ~Server();
+
+  // Port 0 picks a free port, see port(), which is 0 while stopped. Returns false when the
+  // address is not an IPv4 address or the socket cannot be bound, see error().
+  bool start(const Registry & registry, const std::string & address, int port);
+  void stop();
+  int port() const {return _port;}
+  const std::string & error() const {return _error;}
+
+private:
+  void run();
+  void serve(int client);
+
+  const Registry * _registry = nullptr;
+  int _socket = -1;
+  int _port = 0;
+  std::string _error;
+  std::atomic<bool> _running{false};
+  std::thread _thread;
+};
+}  // namespace metrics
+}  // namespace realsense_ros2_camera
+
+#endif  // REALSENSE_ROS2_CAMERA__METRICS_HPP_
@@ -0,0 +1,77 @@
+// Copyright (c) 2018 Intel Corporation. All Rights Reserved
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstdint>
+#include <vector>
+
+#pragma once
+#ifndef REALSENSE_ROS2_CAMERA__RT_AUDIT_HPP_
+#define REALSENSE_ROS2_CAMERA__RT_AUDIT_HPP_
+
+// Real-time audit of the hot paths, built with -DREALSENSE_RT_AUDIT=ON. malloc, free and
+// pthread_mutex_lock are interposed and counted per thread, and every RT_AUDIT_SCOPE charges
+// the calls made on its thread while it is open to its stage, once per frame.
+namespace realsense_ros2_camera
+{
+namespace rt_audit
+{
+struct StageReport
+{
+  const char * name;
+  uint64_t frames;
+  uint64_t allocations;
+  uint64_t frees;
+  uint64_t bytes;
+  uint64_t locks;
+  uint64_t contended;        // locks that found the mutex held and blocked
+  uint64_t max_allocations;  // worst single frame
+  uint64_t max_locks;        // worst single frame
+};
+
+// Returns the stage of the given name, a string literal, registering it on first use.
+int registerStage(const char * name);
+
+// Returns the counters of every stage since the previous call, and resets them.
+std::vector<StageReport> collect();
+
+// Whether the worst frame of report took more allocations or locks than allowed. A negative
+// budget is not checked.
+bool overBudget(const StageReport & report, int allocation_budget, int lock_budget);
+
+class Scope
+{
+public:
+  explicit Scope(int stage);
+  ~Scope();
+
+private:
+  int _stage;
+  uint64_t _allocations;
+  uint64_t _frees;
+  uint64_t _bytes;
+  uint64_t _locks;
+  uint64_t _contended;
+};
+}  // namespace rt_audit
+}  // namespace realsense_ros2_camera
+
+#ifdef REALSENSE_RT_AUDIT
+#define RT_AUDIT_SCOPE(name) \
+  static const int rt_audit_stage_ = ::realsense_ros2_camera::rt_audit::registerStage(name); \
+  ::realsense_ros2_camera::rt_audit::Scope rt_audit_scope_(rt_audit_stage_)
+#else
+#define RT_AUDIT_SCOPE(name)
+#endif
+
+#endif  // REALSENSE_ROS2_CAMERA__RT_AUDIT_HPP_
@@ -0,0 +1,270 @@
+// Copyright (c) 2018 Intel Corporation. All Rights Reserved
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// cpplint: c system headers
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+// cpplint: c++ system headers
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+// cpplint: other headers
+#include "realsense_ros2_camera/metrics.hpp"
+
+namespace realsense_ros2_camera
+{
+namespace metrics
+{
+Histogram::Histogram(const std::vector<double> & bounds)
+: _bounds(bounds),
+  _buckets(new std::atomic<uint64_t>[bounds.size() + 1])
+{
+  for (size_t i = 0; i <= _bounds.size(); ++i) {
+    _buckets[i] = 0;
+  }
+}
+
+void Histogram::observe(double value)
+{
+  auto bucket = std::lower_bound(_bounds.begin(), _bounds.end(), value) - _bounds.begin();
+  _buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+  auto sum = _sum.load(std::memory_order_relaxed);
+  while (!_sum.compare_exchange_weak(sum, sum + value, std::memory_order_relaxed)) {
+  }
+}
+
+std::vector<uint64_t> Histogram::buckets() const
+{
+  std::vector<uint64_t> buckets(_bounds.size() + 1);
+  for (size_t i = 0; i < buckets.size(); ++i) {
+    buckets[i] = _buckets[i].load(std::memory_order_relaxed);
+  }
+  return buckets;
+}
+
+Registry::Family & Registry::family(
+  const std::string & name, const std::string & help,
+  const char * type)
+{
+  auto & family = _families[name];
+  if (family.type.empty()) {
+    family.help = help;
+    family.type = type;
+  }
+  return family;
+}
+
+Counter & Registry::counter(
+  const std::string & name, const std::string & help,
+  const std::string & labels)
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  auto & series = family(name, help, "counter").counters[labels];
+  if (!series) {
+    series.reset(new Counter());
+  }
+  return *series;
+}
+
+Gauge & Registry::gauge(
+  const std::string & name, const std::string & help,
+  const std::string & labels)
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  auto & series = family(name, help, "gauge").gauges[labels];
+  if (!series) {
+    series.reset(new Gauge());
+  }
+  return *series;
+}
+
+Histogram & Registry::histogram(
+  const std::string & name, const std::string & help,
+  const std::vector<double> & bounds, const std::string & labels)
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  auto & series = family(name, help, "histogram").histograms[labels];
+  if (!series) {
+    series.reset(new Histogram(bounds));
+  }
+  return *series;
+}
+
+namespace
+{
+std::string withLabels(const std::string & labels, const std::string & extra = "")
+{
+  if (labels.empty() && extra.empty()) {
+    return "";
+  }
+  return "{" + labels + ((labels.empty() || extra.empty()) ? "" : ",") + extra + "}";
+}
+}  // namespace
+
+std::string Registry::render() const
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  std::ostringstream out;
+  out.precision(9);
+  for (auto & entry : _families) {
+    auto & name = entry.first;
+    auto & family = entry.second;
+    out << "# HELP " << name << " " << family.help << "\n";
+    out << "# TYPE " << name << " " << family.type << "\n";
+    for (auto & series : family.counters) {
+      out << name << withLabels(series.first) << " " << series.second->value() << "\n";
+    }
+    for (auto & series : family.gauges) {
+      out << name << withLabels(series.first) << " " << series.second->value() << "\n";
+    }
+    for (auto & series : family.histograms) {
+      auto & histogram = *series.second;
+      auto buckets = histogram.buckets();
+      uint64_t cumulative = 0;
+      for (size_t i = 0; i < buckets.size(); ++i) {
+        cumulative += buckets[i];
+        std::ostringstream bound;
+        bound.precision(9);
+        if (i < histogram.bounds().size()) {
+          bound << histogram.bounds()[i];
+        } else {
+          bound << "+Inf";
+        }
+        out << name << "_bucket" << withLabels(series.first, "le=\"" + bound.str() + "\"") <<
+          " " << cumulative << "\n";
+      }
+      out << name << "_sum" << withLabels(series.first) << " " << histogram.sum() << "\n";
+      out << name << "_count" << withLabels(series.first) << " " << cumulative << "\n";
+    }
+  }
+  return out.str();
+}
+
+Server::~Server()
+{
+  stop();
+}
+
+bool Server::start(const Registry & registry, const std::string & address, int port)
+{
+  stop();
+  _error.clear();
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(static_cast<uint16_t>(port));
+  if (1 != inet_pton(AF_INET, address.c_str(), &addr.sin_addr)) {
+    _error = "not an IPv4 address";
+    return false;
+  }
+  _socket = socket(AF_INET, SOCK_STREAM, 0);
+  if (_socket < 0) {
+    _error = strerror(errno);
+    return false;
+  }
+  int reuse = 1;
+  setsockopt(_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  socklen_t length = sizeof(addr);
+  if (0 != bind(_socket, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) ||
+    0 != listen(_socket, 4) ||
+    0 != getsockname(_socket, reinterpret_cast<sockaddr *>(&addr), &length))
+  {
+    _error = strerror(errno);
+    close(_socket);
+    _socket = -1;
+    return false;
+  }
+  _port = ntohs(addr.sin_port);
+  _registry = &registry;
+  _running = true;
+  _thread = std::thread(&Server::run, this);
+  return true;
+}
+
+void Server::stop()
+{
+  if (_running) {
+    _running = false;
+    _thread.join();
+    close(_socket);
+    _socket = -1;
+    _port = 0;
+  }
+}
+
+void Server::run()
+{
+  while (_running) {
+    // The timeout bounds how long stop() waits.
+    pollfd fd{_socket, POLLIN, 0};
+    if (poll(&fd, 1, 100) <= 0) {
+      continue;
+    }
+    auto client = accept(_socket, nullptr, nullptr);
+    if (client >= 0) {
+      serve(client);
+      close(client);
+    }
+  }
+}
+
+void Server::serve(int client)
+{
+  // Scrapers send small requests: read up to the end of the headers, with a bound.
+  std::string request;
+  char buffer[1024];
+  while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+    pollfd fd{client, POLLIN, 0};
+    if (poll(&fd, 1, 1000) <= 0) {
+      return;
+    }
+    auto received = recv(client, buffer, sizeof(buffer), 0);
+    if (received <= 0) {
+      return;
+    }
+    request.append(buffer, received);
+  }
+
+  std::string status = "200 OK";
+  std::string body;
+  if (0 == request.compare(0, 13, "GET /metrics ") ||
+    0 == request.compare(0, 13, "GET /metrics?"))
+  {
+    body = _registry->render();
+  } else {
+    status = "404 Not Found";
+    body = "Not Found\n";
+  }
+  std::ostringstream response;
+  response << "HTTP/1.0 " << status << "\r\n" <<
+    "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n" <<
+    "Content-Length: " << body.size() << "\r\n" <<
+    "Connection: close\r\n\r\n" << body;
+  auto data = response.str();
+  size_t sent = 0;
+  while (sent < data.size()) {
+    auto n = send(client, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return;
+    }
+    sent += n;
+  }
+}
+}  // namespace metrics
+}  // namespace realsense_ros2_camera
@@ -17,11 +17,15 @@
 #include <builtin_interfaces/msg/time.hpp>
 #include <console_bridge/console.h>
 #include <cv_bridge/cv_bridge.h>
+#include <diagnostic_msgs/msg/diagnostic_array.hpp>
 #include <image_transport/image_transport.h>
 #include <rcl/time.h>
 #include <rclcpp/clock.hpp>
 #include <rclcpp/logger.hpp>
 #include <rclcpp/rclcpp.hpp>
+#include <rclcpp/serialization.hpp>
+#include <rclcpp/serialized_message.hpp>
+#include <rclcpp_lifecycle/lifecycle_node.hpp>
 #include <sensor_msgs/image_encodings.hpp>
 #include <sensor_msgs/msg/camera_info.hpp>
 #include <sensor_msgs/msg/image.hpp>
@@ -29,25 +33,61 @@
 #include <sensor_msgs/msg/point_cloud2.hpp>
 #include <sensor_msgs/point_cloud2_iterator.hpp>
 #include <tf2/LinearMath/Quaternion.h>
+#include <tf2_ros/buffer.h>
 #include <tf2_ros/transform_broadcaster.h>
+#include <tf2_ros/transform_listener.h>
 #include <tf2_ros/static_transform_broadcaster.h>
 #include <librealsense2/rs.hpp>
 #include <librealsense2/rsutil.h>
 #include <librealsense2/hpp/rs_processing.hpp>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef HAVE_X264
+extern "C" {
+#include <stdint.h>
+#include <x264.h>
+}
+#endif
 // cpplint: c++ system headers
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
 #include <csignal>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
 #include <iostream>
 #include <limits>
 #include <map>
 #include <memory>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 // cpplint: other headers
 #include "realsense_ros2_camera/constants.hpp"
+#include "realsense_ros2_camera/metrics.hpp"
+#include "realsense_ros2_camera/rt_audit.hpp"
 #include "realsense_camera_msgs/msg/imu_info.hpp"
 #include "realsense_camera_msgs/msg/extrinsics.hpp"
+#include "realsense_camera_msgs/msg/point_cloud_band.hpp"
+#include "realsense_camera_msgs/msg/clusters.hpp"
+#include "realsense_camera_msgs/msg/depth_quantization.hpp"
+#include "realsense_camera_msgs/msg/depth_validity_mask.hpp"
+#include "realsense_camera_msgs/msg/detection2_d_array.hpp"
+#include "realsense_camera_msgs/msg/detection3_d_array.hpp"
+#include "realsense_camera_msgs/msg/encoded_video.hpp"
+#include "realsense_camera_msgs/msg/rt_audit.hpp"
+#include "realsense_camera_msgs/srv/capture_snapshot.hpp"
+#include "realsense_camera_msgs/srv/pixels_to3_d.hpp"
+#include "realsense_camera_msgs/srv/trigger_capture.hpp"
 
 
 #define REALSENSE_ROS_EMBEDDED_VERSION_STR (VAR_ARG_STRING(VERSION: REALSENSE_ROS_MAJOR_VERSION. \
@@ -55,6 +95,17 @@
 constexpr auto realsense_ros2_camera_version = REALSENSE_ROS_EMBEDDED_VERSION_STR;
 using realsense_camera_msgs::msg::Extrinsics;
 using realsense_camera_msgs::msg::IMUInfo;
+using realsense_camera_msgs::msg::PointCloudBand;
+using realsense_camera_msgs::msg::Clusters;
+using realsense_camera_msgs::msg::DepthQuantization;
+using realsense_camera_msgs::msg::DepthValidityMask;
+using realsense_camera_msgs::msg::Detection2DArray;
+using realsense_camera_msgs::msg::Detection3DArray;
+using realsense_camera_msgs::msg::EncodedVideo;
+using realsense_camera_msgs::msg::RtAudit;
+using realsense_camera_msgs::srv::CaptureSnapshot;
+using realsense_camera_msgs::srv::PixelsTo3D;
+using realsense_camera_msgs::srv::TriggerCapture;
 
 namespace realsense_ros2_camera
 {
@@ -73,14 +124,25 @@ const std::vector<std::vector<stream_index_pair>> IMAGE_STREAMS = {{{DEPTH, INFR
 
 const std::vector<std::vector<stream_index_pair>> HID_STREAMS = {{GYRO, ACCEL}};
 
+// Point layout of the XYZRGB clouds, as produced by PointCloud2Modifier for "xyz" and "rgb".
+const uint32_t XYZRGB_POINT_STEP = 32;
+const uint32_t XYZRGB_RGB_OFFSET = 16;
+
 rs2::device _dev;
 inline void signalHandler(int signum)
 {
   std::cout << strsignal(signum) << " Signal is received! Terminate RealSense Node...\n";
   auto sens = _dev.query_sensors();
   for (auto it = sens.begin(); it != sens.end(); it++) {
-    it->stop();
-    it->close();
+    // Sensors of a configured but inactive lifecycle node are open but not streaming.
+    try {
+      it->stop();
+    } catch (const rs2::error &) {
+    }
+    try {
+      it->close();
+    } catch (const rs2::error &) {
+    }
   }
   rclcpp::shutdown();
   exit(signum);
@@ -95,393 +157,2018 @@ public:
   }
 };
 
-class RealSenseCameraNode : public rclcpp::Node
+// Accumulates latency samples (in milliseconds) over a reporting window.
+class LatencyStats
 {
 public:
-  RealSenseCameraNode()
-  : Node("RealSenseCameraNode",
-      rclcpp::NodeOptions().automatically_declare_parameters_from_overrides(true)),
-    _ros_clock(RCL_ROS_TIME),
-    _serial_no(""),
-    _base_frame_id(""),
-    qos(rclcpp::QoSInitialization::from_rmw(rmw_qos_profile_default)),
-    _intialize_time_base(false)
+  LatencyStats()
   {
-    RCLCPP_INFO(logger_, "RealSense ROS v%s", REALSENSE_ROS_VERSION_STR);
-    RCLCPP_INFO(logger_, "Running with LibRealSense v%s", RS2_API_VERSION_STR);
+    reset();
+  }
 
-    signal(SIGINT, signalHandler);
-    auto severity = rs2_log_severity::RS2_LOG_SEVERITY_ERROR;
-    tryGetLogSeverity(severity);
-    if (rs2_log_severity::RS2_LOG_SEVERITY_DEBUG == severity) {
-      console_bridge::setLogLevel(console_bridge::CONSOLE_BRIDGE_LOG_DEBUG);
-    }
+  void add(double ms)
+  {
+    _sum += ms;
+    _min = std::min(_min, ms);
+    _max = std::max(_max, ms);
+    ++_count;
+  }
 
-    rs2::log_to_console(severity);
+  void reset()
+  {
+    _sum = 0.0;
+    _min = std::numeric_limits<double>::max();
+    _max = 0.0;
+    _count = 0;
+  }
 
-    // Types for depth stream
-    _format[DEPTH] = RS2_FORMAT_Z16;           // libRS type
-    _image_format[DEPTH] = CV_16UC1;            // CVBridge type
-    _encoding[DEPTH] = sensor_msgs::image_encodings::TYPE_16UC1;         // ROS message type
-    _unit_step_size[DEPTH] = sizeof(uint16_t);         // sensor_msgs::ImagePtr row step size
-    _stream_name[DEPTH] = "depth";
+  int count() const {return _count;}
+  double mean() const {return (_count > 0) ? _sum / _count : 0.0;}
+  double min() const {return (_count > 0) ? _min : 0.0;}
+  double max() const {return _max;}
 
-    // Infrared stream - Left
-    _format[INFRA1] = RS2_FORMAT_Y8;           // libRS type
-    _image_format[INFRA1] = CV_8UC1;            // CVBridge type
-    _encoding[INFRA1] = sensor_msgs::image_encodings::TYPE_8UC1;         // ROS message type
-    _unit_step_size[INFRA1] = sizeof(uint8_t);         // sensor_msgs::ImagePtr row step size
-    _stream_name[INFRA1] = "infra1";
+private:
+  double _sum;
+  double _min;
+  double _max;
+  int _count;
+};
 
-    // Infrared stream - Right
-    _format[INFRA2] = RS2_FORMAT_Y8;           // libRS type
-    _image_format[INFRA2] = CV_8UC1;            // CVBridge type
-    _encoding[INFRA2] = sensor_msgs::image_encodings::TYPE_8UC1;         // ROS message type
-    _unit_step_size[INFRA2] = sizeof(uint8_t);         // sensor_msgs::ImagePtr row step size
-    _stream_name[INFRA2] = "infra2";
+inline double elapsedMs(const std::chrono::steady_clock::time_point & start)
+{
+  return std::chrono::duration<double, std::milli>(
+    std::chrono::steady_clock::now() - start).count();
+}
 
-    // Types for color stream/
-    _format[COLOR] = RS2_FORMAT_RGB8;           // libRS type
-    _image_format[COLOR] = CV_16UC3;            // CVBridge type
-    _encoding[COLOR] = sensor_msgs::image_encodings::RGB16;         // ROS message type
-    _unit_step_size[COLOR] = 3;         / sensor_msgs::ImagePtr row step size
-    _stream_name[COLOR] = "color";
+// Single-producer/single-consumer lock-free ring buffer with a fixed capacity.
+template<typename T, size_t N>
+class SpscRing
+{
+  static_assert((N & (N - 1)) == 0, "SpscRing capacity must be a power of two");
 
-    // Types for fisheye stream
-    _format[FISHEYE] = RS2_FORMAT_RAW8;           // libRS type
-    _image_format[FISHEYE] = CV_8UC1;            // CVBridge type
-    _encoding[FISHEYE] = sensor_msgs::image_encodings::TYPE_8UC1;         // ROS message type
-    _unit_step_size[FISHEYE] = sizeof(uint8_t);         // sensor_msgs::ImagePtr row step size
-    _stream_name[FISHEYE] = "fisheye";
+public:
+  // Producer side. Returns false (dropping value) when the ring is full.
+  bool push(T value)
+  {
+    auto head = _head.load(std::memory_order_relaxed);
+    if (head - _tail.load(std::memory_order_acquire) == N) {
+      return false;
+    }
+    _items[head & (N - 1)] = std::move(value);
+    _head.store(head + 1, std::memory_order_release);
+    return true;
+  }
 
-    // Types for Motion-Module streams
-    _format[GYRO] = RS2_FORMAT_MOTION_XYZ32F;           // libRS type
-    _image_format[GYRO] = CV_8UC1;            // CVBridge type
-    _encoding[GYRO] = sensor_msgs::image_encodings::TYPE_8UC1;         // ROS message type
-    _unit_step_size[GYRO] = sizeof(uint8_t);         // sensor_msgs::ImagePtr row step size
-    _stream_name[GYRO] = "gyro";
+  // Consumer side. Returns the oldest item, or nullptr when the ring is empty.
+  T * front()
+  {
+    auto tail = _tail.load(std::memory_order_relaxed);
+    if (tail == _head.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    return &_items[tail & (N - 1)];
+  }
 
-    _format[ACCEL] = RS2_FORMAT_MOTION_XYZ32F;           // libRS type
-    _image_format[ACCEL] = CV_8UC1;            // CVBridge type
-    _encoding[ACCEL] = sensor_msgs::image_encodings::TYPE_8UC1;         // ROS message type
-    _unit_step_size[ACCEL] = sizeof(uint8_t);         // sensor_msgs::ImagePtr row step size
-    _stream_name[ACCEL] = "accel";
+  void pop()
+  {
+    auto tail = _tail.load(std::memory_order_relaxed);
+    _items[tail & (N - 1)] = T();
+    _tail.store(tail + 1, std::memory_order_release);
   }
 
-  virtual ~RealSenseCameraNode()
-  {}
+private:
+  std::array<T, N> _items;
+  std::atomic<size_t> _head{0};
+  std::atomic<size_t> _tail{0};
+};
 
-  virtual void onInit()
+struct GyroSample
+{
+  double timestamp;  // ms, camera clock
+  float x, y, z;
+};
+
+// Sliding-window voxel accumulator backed by a preallocated arena. Voxel centroids are kept in
+// the current camera frame: on every frame the previous voxels are rotated into it, decayed,
+// and re-indexed before the new points are merged in.
+class VoxelAccumulator
+{
+public:
+  struct Voxel
   {
-    getParameters();
-    setupDevice();
-    setupPublishers();
-    setupStreams();
-    rclcpp::sleep_for(std::chrono::nanoseconds(2000000000));
-    timer_ = this->create_wall_timer(std::chrono::seconds(1), std::bind(&RealSenseCameraNode::publishStaticTransforms, this));
-    RCLCPP_INFO(logger_, "RealSense Node Is Up!");
+    uint64_t key;
+    Eigen::Vector3f point;
+    float weight;
+  };
+
+  // Bytes held by an arena of the given capacity.
+  static size_t footprint(size_t capacity)
+  {
+    return capacity * sizeof(Voxel) + tableSize(capacity) * sizeof(int32_t);
   }
 
-private:
-  void getParameters()
+  void reset(size_t capacity, float voxel_size)
   {
-    RCLCPP_INFO(logger_, "getParameters...");
+    auto table_size = tableSize(capacity);
+    _voxels.assign(capacity, Voxel());
+    _table.assign(table_size, -1);
+    _voxel_size = voxel_size;
+    _size = 0;
+  }
 
-    this->get_parameter_or("enable_pointcloud", _pointcloud, POINTCLOUD);
-    this->get_parameter_or("enable_aligned_pointcloud", _align_pointcloud, ALIGN_POINTCLOUD);
-    // this->get_parameter_or("enable_sync", _sync_frames, SYNC_FRAMES);
-    this->get_parameter_or("enable_depth", _enable[DEPTH], ENABLE_DEPTH);
-    this->get_parameter_or("enable_aligned_depth", _align_depth, ALIGN_DEPTH);
-    this->get_parameter_or("enable_infra1", _enable[INFRA1], ENABLE_INFRA1);
-    this->get_parameter_or("enable_infra2", _enable[INFRA2], ENABLE_INFRA2);
-    if (!_enable[DEPTH]) {
-      _pointcloud = false;
-      _align_depth = false;
-      _enable[INFRA1] = false;
-      _enable[INFRA2] = false;
+  void advance(const Eigen::Matrix3f & rotation, float decay, float min_weight)
+  {
+    std::fill(_table.begin(), _table.end(), -1);
+    auto previous_size = _size;
+    _size = 0;
+    // Surviving voxels are compacted in place; merge() only writes below index i.
+    for (size_t i = 0; i < previous_size; ++i) {
+      auto voxel = _voxels[i];
+      voxel.weight *= decay;
+      if (voxel.weight >= min_weight) {
+        merge(rotation * voxel.point, voxel.weight);
+      }
     }
+  }
 
-    if (!_enable[DEPTH] || !_align_depth) {
-      _align_pointcloud = false;
-    }
+  void insert(const Eigen::Vector3f & point)
+  {
+    merge(point, 1.f);
+  }
 
-    if (_pointcloud || _align_depth) {
-      _sync_frames = true;
-    } else {
-      _sync_frames = false;
+  size_t size() const {return _size;}
+  size_t capacity() const {return _voxels.size();}
+  const Voxel & operator[](size_t i) const {return _voxels[i];}
+
+private:
+  // Power of two hash table size, at most half full.
+  static size_t tableSize(size_t capacity)
+  {
+    size_t table_size = 1;
+    while (table_size < 2 * capacity) {
+      table_size <<= 1;
     }
-    this->get_parameter("serial_no", _serial_no);
+    return table_size;
+  }
 
-    this->get_parameter_or("depth_width", _width[DEPTH], DEPTH_WIDTH);
-    this->get_parameter_or("depth_height", _height[DEPTH], DEPTH_HEIGHT);
-    this->get_parameter_or("depth_fps", _fps[DEPTH], DEPTH_FPS);
+  uint64_t key(const Eigen::Vector3f & point) const
+  {
+    static const int64_t offset = 1 << 20;
+    auto ix = static_cast<int64_t>(std::floor(point.x() / _voxel_size)) + offset;
+    auto iy = static_cast<int64_t>(std::floor(point.y() / _voxel_size)) + offset;
+    auto iz = static_cast<int64_t>(std::floor(point.z() / _voxel_size)) + offset;
+    return ((ix & 0x1FFFFF) << 42) | ((iy & 0x1FFFFF) << 21) | (iz & 0x1FFFFF);
+  }
 
-    this->get_parameter_or("infra1_width", _width[INFRA1], INFRA1_WIDTH);
-    this->get_parameter_or("infra1_height", _height[INFRA1], INFRA1_HEIGHT);
-    this->get_parameter_or("infra1_fps", _fps[INFRA1], INFRA1_FPS);
+  void merge(const Eigen::Vector3f & point, float weight)
+  {
+    auto k = key(point);
+    auto mask = _table.size() - 1;
+    auto slot = ((k * 0x9E3779B97F4A7C15ULL) >> 20) & mask;
+    while (true) {
+      auto index = _table[slot];
+      if (index < 0) {
+        if (_size == _voxels.size()) {
+          return;  // arena is full
+        }
+        _voxels[_size] = Voxel{k, point, weight};
+        _table[slot] = static_cast<int32_t>(_size);
+        ++_size;
+        return;
+      }
+      auto & voxel = _voxels[index];
+      if (voxel.key == k) {
+        voxel.point = (voxel.point * voxel.weight + point * weight) / (voxel.weight + weight);
+        voxel.weight += weight;
+        return;
+      }
+      slot = (slot + 1) & mask;
+    }
+  }
 
-    this->get_parameter_or("infra2_width", _width[INFRA2], INFRA2_WIDTH);
-    this->get_parameter_or("infra2_height", _height[INFRA2], INFRA2_HEIGHT);
-    this->get_parameter_or("infra2_fps", _fps[INFRA2], INFRA2_FPS);
+  std::vector<Voxel> _voxels;
+  std::vector<int32_t> _table;
+  float _voxel_size = 0.f;
+  size_t _size = 0;
+};
 
-    this->get_parameter_or("color_width", _width[COLOR], COLOR_WIDTH);
-    this->get_parameter_or("color_height", _height[COLOR], COLOR_HEIGHT);
-    this->get_parameter_or("color_fps", _fps[COLOR], COLOR_FPS);
-    this->get_parameter_or("enable_color", _enable[COLOR], ENABLE_COLOR);
+// Truncated signed distance volume stored as 8x8x8 voxel blocks in a fixed size arena, found
+// through an open addressing hash on the block coordinates.
+class TsdfVolume
+{
+public:
+  static const int BLOCK_SIDE = 8;
+  static const int BLOCK_VOXELS = BLOCK_SIDE * BLOCK_SIDE * BLOCK_SIDE;
+  // Unaligned, so it can be a member of classes allocated without aligned new (C++14).
+  using Pose = Eigen::Transform<float, 3, Eigen::Affine, Eigen::DontAlign>;
 
-    this->get_parameter_or("fisheye_width", _width[FISHEYE], FISHEYE_WIDTH);
-    this->get_parameter_or("fisheye_height", _height[FISHEYE], FISHEYE_HEIGHT);
-    this->get_parameter_or("fisheye_fps", _fps[FISHEYE], FISHEYE_FPS);
-    this->get_parameter_or("enable_fisheye", _enable[FISHEYE], ENABLE_FISHEYE);
+  struct Block
+  {
+    Eigen::Vector3i position;
+    float tsdf[BLOCK_VOXELS];
+    float weight[BLOCK_VOXELS];
+  };
 
-    this->get_parameter_or("gyro_fps", _fps[GYRO], GYRO_FPS);
-    this->get_parameter_or("accel_fps", _fps[ACCEL], ACCEL_FPS);
-    this->get_parameter_or("enable_imu", _enable[GYRO], ENABLE_IMU);
-    this->get_parameter_or("enable_imu", _enable[ACCEL], ENABLE_IMU);
+  // Bytes held by an arena of the given capacity.
+  static size_t footprint(size_t capacity)
+  {
+    return capacity * sizeof(Block) + tableSize(capacity) * (sizeof(uint64_t) + sizeof(int32_t));
+  }
 
-    this->get_parameter_or("base_frame_id", _base_frame_id,
-      std::string(DEFAULT_BASE_FRAME_ID));
-    this->get_parameter_or("depth_frame_id", _frame_id[DEPTH],
-      std::string(DEFAULT_DEPTH_FRAME_ID));
-    this->get_parameter_or("infra1_frame_id", _frame_id[INFRA1],
-      std::string(DEFAULT_INFRA1_FRAME_ID));
-    this->get_parameter_or("infra2_frame_id", _frame_id[INFRA2],
-      std::string(DEFAULT_INFRA2_FRAME_ID));
-    this->get_parameter_or("color_frame_id", _frame_id[COLOR],
-      std::string(DEFAULT_COLOR_FRAME_ID));
-    this->get_parameter_or("fisheye_frame_id", _frame_id[FISHEYE],
-      std::string(DEFAULT_FISHEYE_FRAME_ID));
-    this->get_parameter_or("imu_gyro_frame_id", _frame_id[GYRO],
-      std::string(DEFAULT_IMU_FRAME_ID));
-    this->get_parameter_or("imu_accel_frame_id", _frame_id[ACCEL],
-      std::string(DEFAULT_IMU_FRAME_ID));
+  void reset(size_t capacity, float voxel_size, float truncation)
+  {
+    auto table_size = tableSize(capacity);
+    _blocks.assign(capacity, Block());
+    _keys.assign(table_size, 0);
+    _table.assign(table_size, -1);
+    _voxel_size = voxel_size;
+    _truncation = truncation;
+    _size = 0;
+  }
 
-    this->get_parameter_or("depth_optical_frame_id", _optical_frame_id[DEPTH],
-      std::string(DEFAULT_DEPTH_OPTICAL_FRAME_ID));
-    this->get_parameter_or("infra1_optical_frame_id", _optical_frame_id[INFRA1],
-      std::string(DEFAULT_INFRA1_OPTICAL_FRAME_ID));
-    this->get_parameter_or("infra2_optical_frame_id", _optical_frame_id[INFRA2],
-      std::string(DEFAULT_INFRA2_OPTICAL_FRAME_ID));
-    this->get_parameter_or("color_optical_frame_id", _optical_frame_id[COLOR],
-      std::string(DEFAULT_COLOR_OPTICAL_FRAME_ID));
-    this->get_parameter_or("fisheye_optical_frame_id", _optical_frame_id[FISHEYE],
-      std::string(DEFAULT_FISHEYE_OPTICAL_FRAME_ID));
-    this->get_parameter_or("gyro_optical_frame_id", _optical_frame_id[GYRO],
-      std::string(DEFAULT_GYRO_OPTICAL_FRAME_ID));
-    this->get_parameter_or("accel_optical_frame_id", _optical_frame_id[ACCEL],
-      std::string(DEFAULT_ACCEL_OPTICAL_FRAME_ID));
+  uint64_t blockKey(const Eigen::Vector3f & point) const
+  {
+    auto block_size = _voxel_size * BLOCK_SIDE;
+    return positionKey(static_cast<int64_t>(std::floor(point.x() / block_size)),
+             static_cast<int64_t>(std::floor(point.y() / block_size)),
+             static_cast<int64_t>(std::floor(point.z() / block_size)));
   }
 
-  void setupDevice()
+  // Index of the block with the given key, -1 when it is not allocated.
+  int32_t find(uint64_t key) const
   {
-    RCLCPP_INFO(logger_, "setupDevice...");
-    try {
-      _ctx.reset(new rs2::context());
+    auto mask = _table.size() - 1;
+    auto slot = ((key * 0x9E3779B97F4A7C15ULL) >> 20) & mask;
+    while (_table[slot] >= 0) {
+      if (_keys[slot] == key) {
+        return _table[slot];
+      }
+      slot = (slot + 1) & mask;
+    }
+    return -1;
+  }
 
-      auto list = _ctx->query_devices();
-      if (0 == list.size()) {
-        _ctx.reset();
-        RCLCPP_ERROR(logger_, "No RealSense devices were found! Terminate RealSense Node...");
-        rclcpp::shutdown();
-        exit(1);
+  // Index of the block with the given key, allocated if needed; -1 when the arena is full.
+  int32_t allocate(uint64_t key)
+  {
+    auto mask = _table.size() - 1;
+    auto slot = ((key * 0x9E3779B97F4A7C15ULL) >> 20) & mask;
+    while (_table[slot] >= 0) {
+      if (_keys[slot] == key) {
+        return _table[slot];
       }
+      slot = (slot + 1) & mask;
+    }
+    if (_size == _blocks.size()) {
+      return -1;
+    }
+    static const int64_t offset = 1 << 20;
+    auto & block = _blocks[_size];
+    block.position = Eigen::Vector3i(
+      static_cast<int>(static_cast<int64_t>((key >> 42) & 0x1FFFFF) - offset),
+      static_cast<int>(static_cast<int64_t>((key >> 21) & 0x1FFFFF) - offset),
+      static_cast<int>(static_cast<int64_t>(key & 0x1FFFFF) - offset));
+    std::fill(block.tsdf, block.tsdf + BLOCK_VOXELS, 1.f);
+    std::fill(block.weight, block.weight + BLOCK_VOXELS, 0.f);
+    _keys[slot] = key;
+    _table[slot] = static_cast<int32_t>(_size);
+    return static_cast<int32_t>(_size++);
+  }
 
-      // Take the first device in the list.
-      // Add an ability to get the specific device to work with from outside.
-      _dev = list.front();
-      _ctx->set_devices_changed_callback([this](rs2::event_information & info)
-        {
-          if (info.was_removed(_dev)) {
-            RCLCPP_FATAL(logger_, "The device has been disconnected! Terminate RealSense Node...");
-            rclcpp::shutdown();
-            exit(1);
+  // Projective update of every voxel of a block from a depth image. world_to_camera maps
+  // world points into the depth optical frame; the depth intrinsics are used as a pinhole.
+  void integrateBlock(
+    int32_t index, const uint16_t * depth, const rs2_intrinsics & intrinsics,
+    const Pose & world_to_camera, float depth_scale, float max_depth,
+    float max_weight)
+  {
+    auto & block = _blocks[index];
+    auto origin = block.position * BLOCK_SIDE;
+    auto i = 0;
+    for (int z = 0; z < BLOCK_SIDE; ++z) {
+      for (int y = 0; y < BLOCK_SIDE; ++y) {
+        for (int x = 0; x < BLOCK_SIDE; ++x, ++i) {
+          Eigen::Vector3f center((origin.x() + x + 0.5f) * _voxel_size,
+            (origin.y() + y + 0.5f) * _voxel_size, (origin.z() + z + 0.5f) * _voxel_size);
+          auto point = world_to_camera * center;
+          if (point.z() <= 0.f) {
+            continue;
           }
-        });
-
-      auto camera_name = _dev.get_info(RS2_CAMERA_INFO_NAME);
-      RCLCPP_INFO(logger_, "Device Name: %s", camera_name);
+          auto u = static_cast<int>(intrinsics.fx * point.x() / point.z() + intrinsics.ppx + 0.5f);
+          auto v = static_cast<int>(intrinsics.fy * point.y() / point.z() + intrinsics.ppy + 0.5f);
+          if (u < 0 || v < 0 || u >= intrinsics.width || v >= intrinsics.height) {
+            continue;
+          }
+          auto measured = depth[v * intrinsics.width + u] * depth_scale;
+          if (measured <= 0.f || measured > max_depth) {
+            continue;
+          }
+          auto sdf = measured - point.z();
+          if (sdf < -_truncation) {
+            continue;
+          }
+          auto value = std::min(1.f, sdf / _truncation);
+          auto weight = block.weight[i];
+          block.tsdf[i] = (block.tsdf[i] * weight + value) / (weight + 1.f);
+          block.weight[i] = std::min(weight + 1.f, max_weight);
+        }
+      }
+    }
+  }
 
-      _serial_no = _dev.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER);
-      RCLCPP_INFO(logger_, "Device Serial No: %s", _serial_no.c_str());
+  // Zero crossings between neighbouring voxels, interpolated along the axis. The last voxel
+  // of a block along an axis is paired with the first voxel of the next block.
+  void extractSurface(std::vector<Eigen::Vector3f> & points, float min_weight) const
+  {
+    static const int strides[3] = {1, BLOCK_SIDE, BLOCK_SIDE * BLOCK_SIDE};
+    points.clear();
+    for (size_t b = 0; b < _size; ++b) {
+      auto & block = _blocks[b];
+      auto origin = block.position * BLOCK_SIDE;
+      const Block * next[3];
+      for (int axis = 0; axis < 3; ++axis) {
+        Eigen::Vector3i position = block.position;
+        ++position[axis];
+        auto index = find(positionKey(position.x(), position.y(), position.z()));
+        next[axis] = index >= 0 ? &_blocks[index] : nullptr;
+      }
+      auto i = 0;
+      for (int z = 0; z < BLOCK_SIDE; ++z) {
+        for (int y = 0; y < BLOCK_SIDE; ++y) {
+          for (int x = 0; x < BLOCK_SIDE; ++x, ++i) {
+            if (block.weight[i] < min_weight) {
+              continue;
+            }
+            int coords[3] = {x, y, z};
+            for (int axis = 0; axis < 3; ++axis) {
+              auto neighbour = &block;
+              auto j = i + strides[axis];
+              if (coords[axis] + 1 == BLOCK_SIDE) {
+                neighbour = next[axis];
+                j -= BLOCK_SIDE * strides[axis];
+                if (nullptr == neighbour) {
+                  continue;
+                }
+              }
+              auto a = block.tsdf[i];
+              auto c = neighbour->tsdf[j];
+              if (neighbour->weight[j] < min_weight || (a >= 0.f) == (c >= 0.f)) {
+                continue;
+              }
+              Eigen::Vector3f point((origin.x() + x + 0.5f) * _voxel_size,
+                (origin.y() + y + 0.5f) * _voxel_size, (origin.z() + z + 0.5f) * _voxel_size);
+              point[axis] += a / (a - c) * _voxel_size;
+              points.push_back(point);
+            }
+          }
+        }
+      }
+    }
+  }
 
-      auto fw_ver = _dev.get_info(RS2_CAMERA_INFO_FIRMWARE_VERSION);
-      RCLCPP_INFO(logger_, "Device FW version: %s", fw_ver);
+  size_t size() const {return _size;}
+  size_t capacity() const {return _blocks.size();}
 
-      auto pid = _dev.get_info(RS2_CAMERA_INFO_PRODUCT_ID);
-      RCLCPP_INFO(logger_, "Device Product ID: %s", pid);
+private:
+  static uint64_t positionKey(int64_t x, int64_t y, int64_t z)
+  {
+    static const int64_t offset = 1 << 20;
+    return (((x + offset) & 0x1FFFFF) << 42) | (((y + offset) & 0x1FFFFF) << 21) |
+           ((z + offset) & 0x1FFFFF);
+  }
 
-      RCLCPP_INFO(logger_, "Sync Mode: %s", ((_sync_frames) ? "On" : "Off"));
+  // Power of two hash table size, at most half full.
+  static size_t tableSize(size_t capacity)
+  {
+    size_t table_size = 1;
+    while (table_size < 2 * capacity) {
+      table_size <<= 1;
+    }
+    return table_size;
+  }
 
-      auto dev_sensors = _dev.query_sensors();
+  std::vector<Block> _blocks;
+  std::vector<uint64_t> _keys;
+  std::vector<int32_t> _table;
+  float _voxel_size = 0.f;
+  float _truncation = 0.f;
+  size_t _size = 0;
+};
 
-      RCLCPP_INFO(logger_, "Device Sensors: ");
-      for (auto && elem : dev_sensors) {
-        std::string module_name = elem.get_info(RS2_CAMERA_INFO_NAME);
-        if ("Stereo Module" == module_name || "Coded-Light Depth Sensor" == module_name) {
-          auto sen = new rs2::sensor(elem);
-          _sensors[DEPTH] = std::unique_ptr<rs2::sensor>(sen);
-          _sensors[INFRA1] = std::unique_ptr<rs2::sensor>(sen);
-          _sensors[INFRA2] = std::unique_ptr<rs2::sensor>(sen);
-        } else if ("RGB Camera" == module_name) {
-          _sensors[COLOR] = std::unique_ptr<rs2::sensor>(new rs2::sensor(elem));
-        } else if ("Wide FOV Camera" == module_name) {
-          _sensors[FISHEYE] = std::unique_ptr<rs2::sensor>(new rs2::sensor(elem));
-        } else if ("Motion Module" == module_name) {
-          auto hid_sensor = new rs2::sensor(elem);
-          _sensors[GYRO] = std::unique_ptr<rs2::sensor>(hid_sensor);
-          _sensors[ACCEL] = std::unique_ptr<rs2::sensor>(hid_sensor);
+// Bound to const references by Eigen, so they need a definition.
+const int TsdfVolume::BLOCK_SIDE;
+const int TsdfVolume::BLOCK_VOXELS;
+
+// Matches frames of several streams by hardware timestamp into framesets. Sensor callbacks only
+// push into per-stream lock-free rings and return; matching and dispatch run on the matcher
+// thread. A frameset is emitted as soon as every stream has a frame within tolerance of the
+// oldest pending frame. It is emitted partially when a stream can no longer match or when the
+// wait deadline of the oldest frame expires. Frames of streams that are not matched are passed
+// to the callback directly, on the sensor thread that delivered them.
+class FrameMatcher
+{
+public:
+  FrameMatcher()
+  : _composer([this](rs2::frame, const rs2::frame_source & source)
+      {
+        source.frame_ready(source.allocate_composite_frame(_emit));
+      })
+  {}
+
+  ~FrameMatcher()
+  {
+    stop();
+  }
+
+  void start(
+    const std::vector<stream_index_pair> & streams, double tolerance_ms, double max_wait_ms,
+    std::function<void(rs2::frame)> callback)
+  {
+    stop();
+    _slots.clear();
+    for (auto & stream : streams) {
+      _slots.emplace_back(new Slot());
+      _slots.back()->stream = stream;
+    }
+    _tolerance_ms = tolerance_ms;
+    _max_wait = std::chrono::duration<double, std::milli>(max_wait_ms);
+    _queued = 0;
+    _callback = callback;
+    _composer.start(_callback);
+    _running = true;
+    _thread = std::thread(&FrameMatcher::run, this);
+  }
+
+  void stop()
+  {
+    if (_running) {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _running = false;
+      }
+      _cv.notify_one();
+      _thread.join();
+    }
+  }
+
+  // Producer side, called from the sensor callbacks.
+  void operator()(rs2::frame frame)
+  {
+    auto profile = frame.get_profile();
+    for (auto & slot : _slots) {
+      if (slot->stream.first == profile.stream_type() &&
+        slot->stream.second == profile.stream_index())
+      {
+        if (!slot->ring.push(Entry{std::move(frame), std::chrono::steady_clock::now()})) {
+          ++_dropped;
         } else {
-          RCLCPP_ERROR(logger_,
-            "Module Name \"%s\" isn't supported by LibRealSense! Terminate RealSense Node...",
-            module_name);
-          rclcpp::shutdown();
-          exit(1);
+          _queued.fetch_add(1, std::memory_order_relaxed);
         }
-        RCLCPP_INFO(logger_, "%s was found.", std::string(elem.get_info(
-            RS2_CAMERA_INFO_NAME)).c_str());
+        // Not under the mutex, so sensor threads never contend with the matcher thread. A
+        // notification sent between its check and its wait is lost; it then wakes up within
+        // MAX_SLEEP anyway.
+        _has_input.store(true, std::memory_order_release);
+        _cv.notify_one();
+        return;
       }
+    }
+    // Not a matched stream: deliver it right away, on the sensor thread.
+    _callback(frame);
+  }
 
-      // Update "enable" map
-      std::vector<std::vector<stream_index_pair>> streams(IMAGE_STREAMS);
-      streams.insert(streams.end(), HID_STREAMS.begin(), HID_STREAMS.end());
-      for (auto & elem : streams) {
-        for (auto & stream_index : elem) {
-          if (true == _enable[stream_index] && _sensors.find(stream_index) == _sensors.end()) {
-            // check if device supports the enabled stream
-            RCLCPP_INFO(logger_, "%s sensor isn't supported by current device! -- Skipping...",
-              rs2_stream_to_string(stream_index.first));
-            _enable[stream_index] = false;
-          }
+  // Frames waiting for a match, in the rings and pending queues.
+  int queued() const
+  {
+    return _queued.load(std::memory_order_relaxed);
+  }
+
+private:
+  // Longest sleep of the matcher thread, bounding the delay of a lost notification.
+  static constexpr std::chrono::milliseconds MAX_SLEEP{2};
+
+  struct Entry
+  {
+    rs2::frame frame;
+    std::chrono::steady_clock::time_point arrival;
+  };
+
+  struct Slot
+  {
+    stream_index_pair stream;
+    SpscRing<Entry, 32> ring;
+    std::deque<Entry> pending;
+  };
+
+  void run()
+  {
+    while (_running) {
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto ready = [this]() {
+            return _has_input.load(std::memory_order_acquire) || !_running;
+          };
+        // Sleep until new input, or until the oldest pending frame may be emitted partially.
+        auto deadline = std::chrono::steady_clock::now() + MAX_SLEEP;
+        std::chrono::steady_clock::time_point match_deadline;
+        if (nextDeadline(match_deadline)) {
+          deadline = std::min(deadline, match_deadline);
         }
+        _cv.wait_until(lock, deadline, ready);
+      }
+      _has_input.store(false, std::memory_order_relaxed);
+      for (auto & slot : _slots) {
+        Entry * entry;
+        while ((entry = slot->ring.front()) != nullptr) {
+          slot->pending.push_back(std::move(*entry));
+          slot->ring.pop();
+        }
+      }
+      while (matchOldest(std::chrono::steady_clock::now())) {
       }
-    } catch (const std::exception & ex) {
-      RCLCPP_ERROR(logger_, "An exception has been thrown: %s", ex.what());
-      throw;
-    } catch (...) {
-      RCLCPP_ERROR(logger_, "Unknown exception has occured!");
-      throw;
     }
   }
 
-  void setupPublishers()
+  // Wait deadline of the oldest pending frame, the one matchOldest() is waiting on; false when
+  // nothing is pending.
+  bool nextDeadline(std::chrono::steady_clock::time_point & deadline) const
   {
-    RCLCPP_INFO(logger_, "setupPublishers...");
-
-    if (true == _enable[DEPTH]) {
-      _image_publishers[DEPTH] = image_transport::create_publisher(
-        this, "camera/depth/image_rect_raw");
-      _info_publisher[DEPTH] = this->create_publisher<sensor_msgs::msg::CameraInfo>(
-        "camera/depth/camera_info", 1);
+    const Slot * anchor = nullptr;
+    for (auto & slot : _slots) {
+      if (!slot->pending.empty() && (nullptr == anchor ||
+        slot->pending.front().frame.get_timestamp() <
+        anchor->pending.front().frame.get_timestamp()))
+      {
+        anchor = slot.get();
+      }
+    }
+    if (nullptr == anchor) {
+      return false;
+    }
+    deadline = anchor->pending.front().arrival +
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(_max_wait);
+    return true;
+  }
 
-      if (_pointcloud) {
-        _pointcloud_publisher = this->create_publisher<sensor_msgs::msg::PointCloud2>(
-          "camera/depth/color/points", 1);
+  bool matchOldest(const std::chrono::steady_clock::time_point & now)
+  {
+    Slot * anchor = nullptr;
+    for (auto & slot : _slots) {
+      if (!slot->pending.empty() && (nullptr == anchor ||
+        slot->pending.front().frame.get_timestamp() <
+        anchor->pending.front().frame.get_timestamp()))
+      {
+        anchor = slot.get();
       }
+    }
+    if (nullptr == anchor) {
+      return false;
+    }
 
-      if (_align_depth) {
-        _align_depth_publisher = image_transport::create_publisher(
-          this, "camera/aligned_depth_to_color/image_raw");
-        _align_depth_camera_publisher = this->create_publisher<sensor_msgs::msg::CameraInfo>(
-          "camera/aligned_depth_to_color/camera_info", 1);
+    // Every other front is newer than the anchor, so only fronts can be the closest match.
+    auto anchor_ts = anchor->pending.front().frame.get_timestamp();
+    auto complete = true;
+    auto waiting = false;
+    for (auto & slot : _slots) {
+      if (slot.get() == anchor) {
+        continue;
+      }
+      if (slot->pending.empty()) {
+        complete = false;
+        waiting = true;
+      } else if (slot->pending.front().frame.get_timestamp() - anchor_ts > _tolerance_ms) {
+        complete = false;
       }
+    }
+    auto arrival = anchor->pending.front().arrival;
+    if (!complete && waiting && now - arrival < _max_wait) {
+      return false;
+    }
 
-      if (_align_pointcloud && _align_depth) {
-        _align_pointcloud_publisher = this->create_publisher<sensor_msgs::msg::PointCloud2>(
-          "camera/aligned_depth_to_color/color/points", 1);
+    _emit.clear();
+    for (auto & slot : _slots) {
+      if (!slot->pending.empty() &&
+        slot->pending.front().frame.get_timestamp() - anchor_ts <= _tolerance_ms)
+      {
+        _emit.push_back(std::move(slot->pending.front().frame));
+        slot->pending.pop_front();
       }
     }
+    _queued.fetch_sub(static_cast<int>(_emit.size()), std::memory_order_relaxed);
+    if (1 == _emit.size()) {
+      _callback(_emit.front());
+    } else {
+      _composer.invoke(_emit.front());
+    }
+    _emit.clear();
 
-    if (true == _enable[INFRA1]) {
-      _image_publishers[INFRA1] = image_transport::create_publisher(
-        this, "camera/infra1/image_rect_raw");
-      _info_publisher[INFRA1] = this->create_publisher<sensor_msgs::msg::CameraInfo>(
-        "camera/infra1/camera_info", 1);
+    record(std::chrono::duration<double, std::milli>(now - arrival).count(), !complete);
+    return true;
+  }
+
+  void record(double latency_ms, bool partial)
+  {
+    static const double bucket_bounds[] = {1, 2, 4, 8, 16, 32, 64};
+    size_t bucket = 0;
+    while (bucket < _histogram.size() - 1 && latency_ms >= bucket_bounds[bucket]) {
+      ++bucket;
+    }
+    ++_histogram[bucket];
+    _latency.add(latency_ms);
+    if (partial) {
+      ++_partial;
     }
 
-    if (true == _enable[INFRA2]) {
-      _image_publishers[INFRA2] = image_transport::create_publisher(
-        this, "camera/infra2/image_rect_raw");
-      _info_publisher[INFRA2] = this->create_publisher<sensor_msgs::msg::CameraInfo>(
-        "camera/infra2/camera_info", 1);
+    if (_latency.count() >= STATS_REPORT_FRAMES) {
+      RCLCPP_INFO(_logger,
+        "Frame matcher: %d framesets (%d partial, %d dropped), match latency mean %.2f ms, "
+        "max %.2f ms, histogram [<1:%d <2:%d <4:%d <8:%d <16:%d <32:%d <64:%d >=64:%d] ms",
+        _latency.count(), _partial, _dropped.exchange(0), _latency.mean(), _latency.max(),
+        _histogram[0], _histogram[1], _histogram[2], _histogram[3], _histogram[4],
+        _histogram[5], _histogram[6], _histogram[7]);
+      _latency.reset();
+      _histogram.fill(0);
+      _partial = 0;
     }
+  }
 
-    if (true == _enable[COLOR]) {
-      _image_publishers[COLOR] = image_transport::create_publisher(
-        this, "camera/color/image_raw");
-      _info_publisher[COLOR] = this->create_publisher<sensor_msgs::msg::CameraInfo>(
-        "camera/color/camera_info", 1);
+  std::vector<std::unique_ptr<Slot>> _slots;
+  double _tolerance_ms = 0.0;
+  std::chrono::duration<double, std::milli> _max_wait;
+  std::function<void(rs2::frame)> _callback;
+  std::vector<rs2::frame> _emit;
+  rs2::processing_block _composer;
+
+  std::thread _thread;
+  std::atomic<bool> _running{false};
+  std::atomic<bool> _has_input{false};
+  std::mutex _mutex;
+  std::condition_variable _cv;
+
+  LatencyStats _latency;
+  std::array<int, 8> _histogram{};
+  int _partial = 0;
+  std::atomic<int> _dropped{0};
+  std::atomic<int> _queued{0};
+  rclcpp::Logger _logger = rclcpp::get_logger("RealSenseCameraNode");
+};
+
+constexpr std::chrono::milliseconds FrameMatcher::MAX_SLEEP;
+
+// Fixed set of worker threads that run the tasks of one parallel job at a time. The calling
+// thread takes part in the job and run() returns once every task is done.
+class WorkerPool
+{
+public:
+  ~WorkerPool()
+  {
+    resize(1);
+  }
+
+  // Use the given number of threads in total, including the calling thread.
+  void resize(int threads)
+  {
+    if (!_threads.empty()) {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+      }
+      _start_cv.notify_all();
+      for (auto & thread : _threads) {
+        thread.join();
+      }
+      _threads.clear();
+      _stop = false;
     }
+    for (int i = 1; i < threads; ++i) {
+      _threads.emplace_back(&WorkerPool::work, this);
+    }
+  }
 
-    if (true == _enable[FISHEYE] &&
-      true == _enable[DEPTH])
+  int size() const
+  {
+    return static_cast<int>(_threads.size()) + 1;
+  }
+
+  void run(int tasks, const std::function<void(int)> & task)
+  {
+    if (_threads.empty() || tasks <= 1) {
+      for (int i = 0; i < tasks; ++i) {
+        task(i);
+      }
+      return;
+    }
     {
-      _image_publishers[FISHEYE] = image_transport::create_publisher(
-        this, "camera/fisheye/image_raw");
-      _info_publisher[FISHEYE] = this->create_publisher<sensor_msgs::msg::CameraInfo>(
-        "camera/fisheye/camera_info", 1);
-      _fe_to_depth_publisher = this->create_publisher<realsense_camera_msgs::msg::Extrinsics>(
-        "camera/extrinsics/fisheye2depth", qos);
+      std::lock_guard<std::mutex> lock(_mutex);
+      _task = &task;
+      _tasks = tasks;
+      _next = 0;
+      _active = static_cast<int>(_threads.size());
+      ++_generation;
     }
+    _start_cv.notify_all();
+    drain();
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done_cv.wait(lock, [this]() {return 0 == _active;});
+    _task = nullptr;
+  }
 
-    if (true == _enable[GYRO]) {
-      _imu_publishers[GYRO] = this->create_publisher<sensor_msgs::msg::Imu>("camera/gyro/sample",
-          100);
-      _imu_info_publisher[GYRO] = this->create_publisher<realsense_camera_msgs::msg::IMUInfo>(
-        "camera/gyro/imu_info", qos);
+private:
+  void work()
+  {
+    uint64_t generation = 0;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _start_cv.wait(lock, [&]() {return _stop || _generation != generation;});
+        if (_stop) {
+          return;
+        }
+        generation = _generation;
+      }
+      drain();
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (0 == --_active) {
+        _done_cv.notify_one();
+      }
     }
+  }
 
-    if (true == _enable[ACCEL]) {
-      _imu_publishers[ACCEL] = this->create_publisher<sensor_msgs::msg::Imu>("camera/accel/sample",
-          100);
-      _imu_info_publisher[ACCEL] = this->create_publisher<realsense_camera_msgs::msg::IMUInfo>(
-        "camera/accel/imu_info", qos);
+  void drain()
+  {
+    for (int i = _next++; i < _tasks; i = _next++) {
+      (*_task)(i);
     }
+  }
 
-    if (true == _enable[FISHEYE] &&
-      (true == _enable[GYRO] ||
-      true == _enable[ACCEL]))
+  std::vector<std::thread> _threads;
+  std::mutex _mutex;
+  std::condition_variable _start_cv;
+  std::condition_variable _done_cv;
+  const std::function<void(int)> * _task = nullptr;
+  int _tasks = 0;
+  std::atomic<int> _next{0};
+  int _active = 0;
+  uint64_t _generation = 0;
+  bool _stop = false;
+};
+
+// Encodes the color stream to H.264 on a dedicated thread. The frame callback only hands the
+// newest frame over: a frame that is still waiting when the next one arrives is replaced and
+// counted as dropped, so a slow encoder never holds up the sensor callbacks.
+class ColorEncoder
+{
+public:
+  struct Settings
+  {
+    int width;
+    int height;
+    int fps;
+    int bitrate_kbps;
+    int gop;
+    int threads;
+    std::string preset;
+    std::string profile;
+    bool zero_latency;
+    std::string frame_id;
+  };
+
+  ~ColorEncoder()
+  {
+    stop();
+  }
+
+  // Returns false when the encoder cannot be opened, or when the node is built without x264.
+  bool start(const Settings & settings, std::function<void(EncodedVideo::UniquePtr)> publish)
+  {
+    stop();
+#ifdef HAVE_X264
+    x264_param_t param;
+    if (x264_param_default_preset(&param, settings.preset.c_str(),
+      settings.zero_latency ? "zerolatency" : nullptr) < 0)
     {
-      _fe_to_imu_publisher = this->create_publisher<realsense_camera_msgs::msg::Extrinsics>(
-        "camera/extrinsics/fisheye2imu", qos);
+      RCLCPP_ERROR(_logger, "Unknown x264 preset \"%s\"", settings.preset.c_str());
+      return false;
     }
-    _static_tf_broadcaster_ =
-      std::make_shared<tf2_ros::StaticTransformBroadcaster>(shared_from_this());
+    param.i_width = settings.width;
+    param.i_height = settings.height;
+    param.i_csp = X264_CSP_I420;
+    param.i_fps_num = settings.fps;
+    param.i_fps_den = 1;
+    param.i_threads = settings.threads;
+    param.i_keyint_max = settings.gop;
+    param.i_log_level = X264_LOG_WARNING;
+    // Constrain the rate over one second so the stream fits a link of the given bitrate.
+    param.rc.i_rc_method = X264_RC_ABR;
+    param.rc.i_bitrate = settings.bitrate_kbps;
+    param.rc.i_vbv_max_bitrate = settings.bitrate_kbps;
+    param.rc.i_vbv_buffer_size = settings.bitrate_kbps;
+    param.b_repeat_headers = 1;
+    param.b_annexb = 1;
+    if (x264_param_apply_profile(&param, settings.profile.c_str()) < 0) {
+      RCLCPP_ERROR(_logger, "Unknown x264 profile \"%s\"", settings.profile.c_str());
+      return false;
+    }
+    _encoder = x264_encoder_open(&param);
+    if (nullptr == _encoder) {
+      RCLCPP_ERROR(_logger, "Failed to open the x264 encoder");
+      return false;
+    }
+
+    _settings = settings;
+    _publish = publish;
+    _i420.resize(settings.width * settings.height * 3 / 2);
+    _pts = 0;
+    _dropped = 0;
+    _keyframes = 0;
+    _bytes = 0;
+    _latency.reset();
+    _window_start = std::chrono::steady_clock::now();
+    _stop = false;
+    _thread = std::thread(&ColorEncoder::run, this);
+    return true;
+#else
+    (void)settings;
+    (void)publish;
+    return false;
+#endif
   }
 
-  void setupStreams()
+  void stop()
   {
-    RCLCPP_INFO(logger_, "setupStreams...");
-    try {
-      for (auto & streams : IMAGE_STREAMS) {
-        for (auto & elem : streams) {
-          if (true == _enable[elem]) {
-            auto & sens = _sensors[elem];
-            auto profiles = sens->get_stream_profiles();
-            for (auto & profile : profiles) {
-              auto video_profile = profile.as<rs2::video_stream_profile>();
-              if (video_profile.format() == _format[elem] &&
-                video_profile.width() == _width[elem] &&
-                video_profile.height() == _height[elem] &&
-                video_profile.fps() == _fps[elem] &&
-                video_profile.stream_index() == elem.second)
-              {
-                _enabled_profiles[elem].push_back(profile);
+    if (!_thread.joinable()) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+    }
+    _cv.notify_one();
+    _thread.join();
+    _pending = rs2::frame();
+#ifdef HAVE_X264
+    flush();
+    x264_encoder_close(_encoder);
+    _encoder = nullptr;
+#endif
+  }
 
-                _image[elem] =
-                  cv::Mat(_width[elem], _height[elem], _image_format[elem], cv::Scalar(0, 0, 0));
-                RCLCPP_INFO(logger_, "%s stream is enabled - width: %d, height: %d, fps: %d",
-                  _stream_name[elem].c_str(), _width[elem], _height[elem], _fps[elem]);
-                break;
-              }
-            }
-            if (_enabled_profiles.find(elem) == _enabled_profiles.end()) {
-              RCLCPP_WARN(logger_, "Given stream configuration is not supported by the device!");
-              RCLCPP_WARN(logger_, "Stream: %s, Format: %d, Width: %d, Height: %d, FPS: %d",
-                rs2_stream_to_string(elem.first), _format[elem], _width[elem], _height[elem],
-                _fps[elem]);
-              _enable[elem] = false;
-            }
-          }
+  // Called from the frame callback. keyframe asks for the next encoded picture to be an IDR.
+  void submit(rs2::frame frame, const rclcpp::Time & t, bool keyframe)
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (_pending) {
+        ++_dropped;
+      }
+      _pending = std::move(frame);
+      _pending_stamp = t;
+      _pending_arrival = std::chrono::steady_clock::now();
+      _force_keyframe = _force_keyframe || keyframe;
+    }
+    _cv.notify_one();
+  }
+
+private:
+  // Picture data kept until the encoder returns the picture, which can be later with lookahead.
+  struct InFlight
+  {
+    rclcpp::Time stamp;
+    unsigned long long frame_number;
+    std::chrono::steady_clock::time_point arrival;
+  };
+
+  void run()
+  {
+    while (true) {
+      rs2::frame frame;
+      InFlight picture;
+      bool keyframe;
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cv.wait(lock, [this]() {return _stop || _pending;});
+        if (_stop) {
+          return;
+        }
+        frame = std::move(_pending);
+        _pending = rs2::frame();
+        picture.stamp = _pending_stamp;
+        picture.arrival = _pending_arrival;
+        keyframe = _force_keyframe;
+        _force_keyframe = false;
+      }
+      picture.frame_number = frame.get_frame_number();
+      encode(frame, picture, keyframe);
+    }
+  }
+
+  void encode(const rs2::frame & frame, const InFlight & picture, bool keyframe)
+  {
+#ifdef HAVE_X264
+    auto width = _settings.width;
+    auto height = _settings.height;
+    rgbToI420(reinterpret_cast<const uint8_t *>(frame.get_data()), width, height, _i420.data());
+
+    x264_picture_t in;
+    x264_picture_init(&in);
+    in.i_type = keyframe ? X264_TYPE_IDR : X264_TYPE_AUTO;
+    in.i_pts = _pts;
+    in.img.i_csp = X264_CSP_I420;
+    in.img.i_plane = 3;
+    in.img.plane[0] = _i420.data();
+    in.img.plane[1] = in.img.plane[0] + width * height;
+    in.img.plane[2] = in.img.plane[1] + width * height / 4;
+    in.img.i_stride[0] = width;
+    in.img.i_stride[1] = width / 2;
+    in.img.i_stride[2] = width / 2;
+    _in_flight[_pts % _in_flight.size()] = picture;
+    ++_pts;
+
+    x264_picture_t out;
+    x264_nal_t * nals;
+    int nal_count;
+    auto size = x264_encoder_encode(_encoder, &nals, &nal_count, &in, &out);
+    if (size < 0) {
+      RCLCPP_WARN(_logger, "x264 failed to encode frame %llu", picture.frame_number);
+      return;
+    }
+    if (0 == size) {
+      // Buffered for lookahead
+      return;
+    }
+    publishPicture(nals, size, out);
+#else
+    (void)frame;
+    (void)picture;
+    (void)keyframe;
+#endif
+  }
+
+#ifdef HAVE_X264
+  // Without zero latency the encoder holds pictures back for lookahead: encode them before
+  // the encoder is closed.
+  void flush()
+  {
+    x264_picture_t out;
+    x264_nal_t * nals;
+    int nal_count;
+    while (x264_encoder_delayed_frames(_encoder) > 0) {
+      auto size = x264_encoder_encode(_encoder, &nals, &nal_count, nullptr, &out);
+      if (size < 0) {
+        RCLCPP_WARN(_logger, "x264 failed to flush the delayed pictures");
+        return;
+      }
+      if (size > 0) {
+        publishPicture(nals, size, out);
+      }
+    }
+  }
+
+  void publishPicture(const x264_nal_t * nals, int size, const x264_picture_t & out)
+  {
+    auto width = _settings.width;
+    auto height = _settings.height;
+    // The payloads of all NAL units of a picture are contiguous.
+    auto & encoded = _in_flight[out.i_pts % _in_flight.size()];
+    auto msg = std::make_unique<EncodedVideo>();
+    msg->header.stamp = encoded.stamp;
+    msg->header.frame_id = _settings.frame_id;
+    msg->frame_number = encoded.frame_number;
+    msg->codec = "h264";
+    msg->width = width;
+    msg->height = height;
+    msg->keyframe = out.b_keyframe;
+    msg->data.assign(nals[0].p_payload, nals[0].p_payload + size);
+    _publish(std::move(msg));
+
+    _latency.add(elapsedMs(encoded.arrival));
+    _bytes += size;
+    if (out.b_keyframe) {
+      ++_keyframes;
+    }
+    if (_latency.count() >= STATS_REPORT_FRAMES) {
+      auto seconds = elapsedMs(_window_start) / 1000.0;
+      RCLCPP_INFO(_logger,
+        "Color video: %d pictures (%d keyframes, %d dropped), %.0f kbit/s, encode latency "
+        "mean %.2f ms, min %.2f ms, max %.2f ms", _latency.count(), _keyframes,
+        _dropped.exchange(0), _bytes * 8 / seconds / 1000.0, _latency.mean(), _latency.min(),
+        _latency.max());
+      _latency.reset();
+      _keyframes = 0;
+      _bytes = 0;
+      _window_start = std::chrono::steady_clock::now();
+    }
+  }
+#endif
+
+  // BT.601 limited range RGB to planar 4:2:0, chroma averaged over each 2x2 block.
+  static void rgbToI420(const uint8_t * rgb, int width, int height, uint8_t * out)
+  {
+    auto y_plane = out;
+    auto u_plane = out + width * height;
+    auto v_plane = u_plane + width * height / 4;
+    for (int y = 0; y < height; ++y) {
+      auto row = rgb + y * width * 3;
+      for (int x = 0; x < width; ++x) {
+        int r = row[x * 3], g = row[x * 3 + 1], b = row[x * 3 + 2];
+        y_plane[y * width + x] =
+          static_cast<uint8_t>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+      }
+    }
+    for (int y = 0; y < height / 2; ++y) {
+      auto row0 = rgb + 2 * y * width * 3;
+      auto row1 = row0 + width * 3;
+      for (int x = 0; x < width / 2; ++x) {
+        auto i = x * 6;
+        int r = row0[i] + row0[i + 3] + row1[i] + row1[i + 3];
+        int g = row0[i + 1] + row0[i + 4] + row1[i + 1] + row1[i + 4];
+        int b = row0[i + 2] + row0[i + 5] + row1[i + 2] + row1[i + 5];
+        u_plane[y * width / 2 + x] =
+          static_cast<uint8_t>(((-38 * r - 74 * g + 112 * b + 512) >> 10) + 128);
+        v_plane[y * width / 2 + x] =
+          static_cast<uint8_t>(((112 * r - 94 * g - 18 * b + 512) >> 10) + 128);
+      }
+    }
+  }
+
+  Settings _settings;
+  std::function<void(EncodedVideo::UniquePtr)> _publish;
+#ifdef HAVE_X264
+  x264_t * _encoder = nullptr;
+#endif
+  std::vector<uint8_t> _i420;
+  std::array<InFlight, 128> _in_flight;
+  int64_t _pts = 0;
+
+  std::thread _thread;
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  bool _stop = false;
+  rs2::frame _pending;
+  rclcpp::Time _pending_stamp;
+  std::chrono::steady_clock::time_point _pending_arrival;
+  bool _force_keyframe = false;
+
+  LatencyStats _latency;
+  std::chrono::steady_clock::time_point _window_start;
+  int _keyframes = 0;
+  int64_t _bytes = 0;
+  std::atomic<int> _dropped{0};
+  rclcpp::Logger _logger = rclcpp::get_logger("RealSenseCameraNode");
+};
+
+// Minimal little-endian CDR writer used to build messages directly in a serialized buffer.
+class CdrWriter
+{
+public:
+  CdrWriter(rclcpp::SerializedMessage & msg, size_t capacity)
+  : _msg(msg.get_rcl_serialized_message())
+  {
+    if (_msg.buffer_capacity < capacity) {
+      msg.reserve(capacity);
+    }
+    _buffer = _msg.buffer;
+    _capacity = _msg.buffer_capacity;
+    static const uint8_t encapsulation[4] = {0x00, 0x01, 0x00, 0x00};  // CDR_LE
+    memcpy(_buffer, encapsulation, sizeof(encapsulation));
+    _pos = sizeof(encapsulation);
+  }
+
+  template<typename T>
+  void write(T value)
+  {
+    align(sizeof(T));
+    memcpy(reserve(sizeof(T)), &value, sizeof(T));
+  }
+
+  void write(const std::string & value)
+  {
+    write(static_cast<uint32_t>(value.size() + 1));
+    memcpy(reserve(value.size() + 1), value.c_str(), value.size() + 1);
+  }
+
+  // Reserve size raw bytes at the current position and return them.
+  uint8_t * reserve(size_t size)
+  {
+    if (_pos + size > _capacity) {
+      throw std::length_error("CdrWriter: serialized buffer overflow");
+    }
+    auto data = _buffer + _pos;
+    _pos += size;
+    return data;
+  }
+
+  void finish()
+  {
+    _msg.buffer_length = _pos;
+  }
+
+private:
+  // CDR alignment is relative to the end of the encapsulation header.
+  void align(size_t size)
+  {
+    while ((_pos - 4) % size != 0) {
+      *reserve(1) = 0;
+    }
+  }
+
+  rcl_serialized_message_t & _msg;
+  uint8_t * _buffer;
+  size_t _capacity;
+  size_t _pos;
+};
+
+// Count the 16-bit samples of a and b whose absolute difference exceeds delta.
+inline int countChangedSamples(const uint16_t * a, const uint16_t * b, int n, uint16_t delta)
+{
+  int changed = 0;
+  int i = 0;
+#ifdef __SSE2__
+  const __m128i delta_v = _mm_set1_epi16(static_cast<int16_t>(delta));
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 8 <= n; i += 8) {
+    __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+    __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+    __m128i diff = _mm_or_si128(_mm_subs_epu16(va, vb), _mm_subs_epu16(vb, va));
+    // 0xFFFF in every lane whose difference is within delta
+    __m128i same = _mm_cmpeq_epi16(_mm_subs_epu16(diff, delta_v), zero);
+    changed += 8 - __builtin_popcount(_mm_movemask_epi8(same)) / 2;
+  }
+#endif
+  for (; i < n; ++i) {
+    if (std::abs(static_cast<int>(a[i]) - static_cast<int>(b[i])) > delta) {
+      ++changed;
+    }
+  }
+  return changed;
+}
+
+// Set bit x of out (least significant bit first) for every depth value in [lo, hi], lo > 0.
+inline void packValidityBits(
+  const uint16_t * depth, int n, uint16_t lo, uint16_t hi,
+  uint8_t * out)
+{
+  int i = 0;
+#ifdef __SSE2__
+  // SSE2 only has signed 16-bit compares: flip the sign bits to compare unsigned values.
+  const __m128i sign = _mm_set1_epi16(static_cast<int16_t>(0x8000));
+  const __m128i lo_v = _mm_xor_si128(_mm_set1_epi16(static_cast<int16_t>(lo)), sign);
+  const __m128i hi_v = _mm_xor_si128(_mm_set1_epi16(static_cast<int16_t>(hi)), sign);
+  for (; i + 16 <= n; i += 16) {
+    auto a = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(depth + i)), sign);
+    auto b = _mm_xor_si128(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(depth + i + 8)), sign);
+    auto invalid_a = _mm_or_si128(_mm_cmplt_epi16(a, lo_v), _mm_cmpgt_epi16(a, hi_v));
+    auto invalid_b = _mm_or_si128(_mm_cmplt_epi16(b, lo_v), _mm_cmpgt_epi16(b, hi_v));
+    auto bits = ~_mm_movemask_epi8(_mm_packs_epi16(invalid_a, invalid_b)) & 0xFFFF;
+    out[i / 8] = static_cast<uint8_t>(bits);
+    out[i / 8 + 1] = static_cast<uint8_t>(bits >> 8);
+  }
+#endif
+  for (; i < n; ++i) {
+    if (depth[i] >= lo && depth[i] <= hi) {
+      out[i / 8] |= static_cast<uint8_t>(1 << (i % 8));
+    } else {
+      out[i / 8] &= static_cast<uint8_t>(~(1 << (i % 8)));
+    }
+  }
+}
+
+class RealSenseCameraNode : public rclcpp::Node
+{
+public:
+  RealSenseCameraNode()
+  : Node("RealSenseCameraNode",
+      rclcpp::NodeOptions().automatically_declare_parameters_from_overrides(true)),
+    _ros_clock(RCL_ROS_TIME),
+    _serial_no(""),
+    _base_frame_id(""),
+    qos(rclcpp::QoSInitialization::from_rmw(rmw_qos_profile_default)),
+    _intialize_time_base(false)
+  {
+    RCLCPP_INFO(logger_, "RealSense ROS v%s", REALSENSE_ROS_VERSION_STR);
+    RCLCPP_INFO(logger_, "Running with LibRealSense v%s", RS2_API_VERSION_STR);
+
+    signal(SIGINT, signalHandler);
+    auto severity = rs2_log_severity::RS2_LOG_SEVERITY_ERROR;
+    tryGetLogSeverity(severity);
+    if (rs2_log_severity::RS2_LOG_SEVERITY_DEBUG == severity) {
+      console_bridge::setLogLevel(console_bridge::CONSOLE_BRIDGE_LOG_DEBUG);
+    }
+
+    rs2::log_to_console(severity);
+
+    // Types for depth stream
+    _format[DEPTH] = RS2_FORMAT_Z16;           // libRS type
+    _image_format[DEPTH] = CV_16UC1;            // CVBridge type
+    _encoding[DEPTH] = sensor_msgs::image_encodings::TYPE_16UC1;         // ROS message type
+    _unit_step_size[DEPTH] = sizeof(uint16_t);         // sensor_msgs::ImagePtr row step size
+    _stream_name[DEPTH] = "depth";
+
+    // Infrared stream - Left
+    _format[INFRA1] = RS2_FORMAT_Y8;           // libRS type
+    _image_format[INFRA1] = CV_8UC1;            // CVBridge type
+    _encoding[INFRA1] = sensor_msgs::image_encodings::TYPE_8UC1;         // ROS message type
+    _unit_step_size[INFRA1] = sizeof(uint8_t);         // sensor_msgs::ImagePtr row step size
+    _stream_name[INFRA1] = "infra1";
+
+    // Infrared stream - Right
+    _format[INFRA2] = RS2_FORMAT_Y8;           // libRS type
+    _image_format[INFRA2] = CV_8UC1;            // CVBridge type
+    _encoding[INFRA2] = sensor_msgs::image_encodings::TYPE_8UC1;         // ROS message type
+    _unit_step_size[INFRA2] = sizeof(uint8_t);         // sensor_msgs::ImagePtr row step size
+    _stream_name[INFRA2] = "infra2";
+
+    // Types for color stream/
+    _format[COLOR] = RS2_FORMAT_RGB8;           // libRS type
+    _image_format[COLOR] = CV_8UC3;            // CVBridge type
+    _encoding[COLOR] = sensor_msgs::image_encodings::RGB8;         // ROS message type
+    _unit_step_size[COLOR] = 3;         // sensor_msgs::ImagePtr row step size
+    _stream_name[COLOR] = "color";
+
+    // Types for fisheye stream
+    _format[FISHEYE] = RS2_FORMAT_RAW8;           // libRS type
+    _image_format[FISHEYE] = CV_8UC1;            // CVBridge type
+    _encoding[FISHEYE] = sensor_msgs::image_encodings::TYPE_8UC1;         // ROS message type
+    _unit_step_size[FISHEYE] = sizeof(uint8_t);         // sensor_msgs::ImagePtr row step size
+    _stream_name[FISHEYE] = "fisheye";
+
+    // Types for Motion-Module streams
+    _format[GYRO] = RS2_FORMAT_MOTION_XYZ32F;           // libRS type
+    _image_format[GYRO] = CV_8UC1;            // CVBridge type
+    _encoding[GYRO] = sensor_msgs::image_encodings::TYPE_8UC1;         // ROS message type
+    _unit_step_size[GYRO] = sizeof(uint8_t);         // sensor_msgs::ImagePtr row step size
+    _stream_name[GYRO] = "gyro";
+
+    _format[ACCEL] = RS2_FORMAT_MOTION_XYZ32F;           // libRS type
+    _image_format[ACCEL] = CV_8UC1;            // CVBridge type
+    _encoding[ACCEL] = sensor_msgs::image_encodings::TYPE_8UC1;         // ROS message type
+    _unit_step_size[ACCEL] = sizeof(uint8_t);         // sensor_msgs::ImagePtr row step size
+    _stream_name[ACCEL] = "accel";
+  }
+
+  virtual ~RealSenseCameraNode()
+  {}
+
+  // Legacy startup without lifecycle: a device that cannot be configured ends the process.
+  virtual void onInit()
+  {
+    try {
+      configure();
+    } catch (const std::exception & ex) {
+      RCLCPP_ERROR(logger_, "%s Terminate RealSense Node...", ex.what());
+      rclcpp::shutdown();
+      exit(1);
+    }
+    activate();
+    rclcpp::sleep_for(std::chrono::nanoseconds(2000000000));
+    RCLCPP_INFO(logger_, "RealSense Node Is Up!");
+  }
+
+  // Enumerate the device, cache calibration, create publishers and open the sensors without
+  // starting them.
+  void configure()
+  {
+    std::lock_guard<std::mutex> lock(_transition_mutex);
+    getParameters();
+    setupDevice();
+    enforceMemoryBudget();
+    setupPublishers();
+    setupStreams();
+    timer_ = this->create_wall_timer(std::chrono::seconds(1),
+        std::bind(&RealSenseCameraNode::publishStaticTransforms, this));
+  }
+
+  void activate()
+  {
+    auto captures = lockCaptures();
+    std::lock_guard<std::mutex> lock(_transition_mutex);
+    startStreams();
+  }
+
+  void deactivate()
+  {
+    auto captures = lockCaptures();
+    std::lock_guard<std::mutex> lock(_transition_mutex);
+    stopStreams();
+  }
+
+  // Release the sensors and everything cached at configure time.
+  void cleanup()
+  {
+    auto captures = lockCaptures();
+    std::lock_guard<std::mutex> lock(_transition_mutex);
+    if (_streaming) {
+      stopStreams();
+    }
+    closeStreams();
+    _syncers.clear();
+    _matchers.clear();
+    _processing_pool.resize(1);
+    _color_encoder.stop();
+    _metrics_server.stop();
+    timer_.reset();
+    teardownPublishers();
+    _enabled_profiles.clear();
+    _image.clear();
+    _stream_intrinsics.clear();
+    _camera_info.clear();
+    _camera_info_serialized.clear();
+    _serialization_stats.clear();
+    _intialize_time_base = false;
+  }
+
+private:
+  // Undo setupPublishers: nothing stays advertised once the node is unconfigured.
+  void teardownPublishers()
+  {
+    _image_publishers.clear();
+    _info_publisher.clear();
+    _imu_publishers.clear();
+    _imu_info_publisher.clear();
+    _imu_decimated_publishers.clear();
+    _imu_decimators.clear();
+    _fe_to_depth_publisher.reset();
+    _fe_to_imu_publisher.reset();
+    _pointcloud_publisher.reset();
+    _pointcloud_band_publisher.reset();
+    _accumulate_publisher.reset();
+    _tsdf_publisher.reset();
+    _tf_listener.reset();
+    _tf_buffer.reset();
+    _quantized_depth_publisher = image_transport::Publisher();
+    _quantization_publisher.reset();
+    _validity_mask_publisher.reset();
+    _filled_depth_publisher = image_transport::Publisher();
+    _filled_mask_publisher = image_transport::Publisher();
+    _pseudo_lidar_publisher.reset();
+    _clusters_publisher.reset();
+    _detections_3d_publisher.reset();
+    _detections_subscription.reset();
+    _aligned_pool.fill(nullptr);
+    std::atomic_store(&_depth_snapshot, std::shared_ptr<const DepthSnapshot>());
+    _pixels_to_3d_service.reset();
+    _align_depth_publisher = image_transport::Publisher();
+    _align_depth_camera_publisher.reset();
+    _upsample_depth_publisher = image_transport::Publisher();
+    _color_to_depth_publisher = image_transport::Publisher();
+    _color_to_depth_info_publisher.reset();
+    _align_pointcloud_publisher.reset();
+    _video_publisher.reset();
+#ifdef REALSENSE_RT_AUDIT
+    _rt_audit_publisher.reset();
+    _rt_audit_timer.reset();
+#endif
+    _trigger_service.reset();
+    _snapshot_service.reset();
+    _diagnostics_publisher.reset();
+    _memory_timer.reset();
+    _static_tf_broadcaster_.reset();
+  }
+
+  // Cancel a pending trigger, then wait for the capture services to leave the sensors.
+  std::unique_lock<std::mutex> lockCaptures()
+  {
+    {
+      std::lock_guard<std::mutex> lock(_trigger_mutex);
+      if (0 != _trigger_remaining.load()) {
+        _trigger_cancelled = true;
+      }
+    }
+    _trigger_cv.notify_one();
+    return std::unique_lock<std::mutex>(_capture_mutex);
+  }
+
+  void getParameters()
+  {
+    RCLCPP_INFO(logger_, "getParameters...");
+
+    this->get_parameter_or("enable_pointcloud", _pointcloud, POINTCLOUD);
+    this->get_parameter_or("enable_aligned_pointcloud", _align_pointcloud, ALIGN_POINTCLOUD);
+    // this->get_parameter_or("enable_sync", _sync_frames, SYNC_FRAMES);
+    this->get_parameter_or("enable_depth", _enable[DEPTH], ENABLE_DEPTH);
+    this->get_parameter_or("enable_aligned_depth", _align_depth, ALIGN_DEPTH);
+    this->get_parameter_or("enable_color_aligned_to_depth", _color_aligned_to_depth,
+      COLOR_ALIGNED_TO_DEPTH);
+    this->get_parameter_or("registration_engine", _registration_engine,
+      std::string(REGISTRATION_ENGINE));
+    this->get_parameter_or("processing_threads", _processing_threads, PROCESSING_THREADS);
+    this->get_parameter_or("registration_hole_fill", _registration_hole_fill,
+      REGISTRATION_HOLE_FILL);
+    this->get_parameter_or("registration_benchmark", _registration_benchmark,
+      REGISTRATION_BENCHMARK);
+    this->get_parameter_or("enable_upsampled_depth", _upsample_depth, UPSAMPLE_DEPTH);
+    this->get_parameter_or("upsample_radius", _upsample_radius, UPSAMPLE_RADIUS);
+    this->get_parameter_or("upsample_sigma_spatial", _upsample_sigma_spatial,
+      UPSAMPLE_SIGMA_SPATIAL);
+    this->get_parameter_or("upsample_sigma_color", _upsample_sigma_color, UPSAMPLE_SIGMA_COLOR);
+    this->get_parameter_or("upsample_budget_ms", _upsample_budget_ms, UPSAMPLE_BUDGET_MS);
+    this->get_parameter_or("enable_pointcloud_bands", _pointcloud_bands, POINTCLOUD_BANDS);
+    this->get_parameter_or("pointcloud_band_rows", _pointcloud_band_rows, POINTCLOUD_BAND_ROWS);
+    this->get_parameter_or("pointcloud_bands_bottom_up", _pointcloud_bands_bottom_up,
+      POINTCLOUD_BANDS_BOTTOM_UP);
+    this->get_parameter_or("enable_change_gate", _change_gate, CHANGE_GATE);
+    this->get_parameter_or("change_gate_grid_step", _change_gate_grid_step,
+      CHANGE_GATE_GRID_STEP);
+    this->get_parameter_or("change_gate_depth_delta", _change_gate_depth_delta,
+      CHANGE_GATE_DEPTH_DELTA);
+    this->get_parameter_or("change_gate_changed_ratio", _change_gate_changed_ratio,
+      CHANGE_GATE_CHANGED_RATIO);
+    this->get_parameter_or("change_gate_keyframe_period", _change_gate_keyframe_period,
+      CHANGE_GATE_KEYFRAME_PERIOD);
+    this->get_parameter_or("change_gate_gyro_threshold", _change_gate_gyro_threshold,
+      CHANGE_GATE_GYRO_THRESHOLD);
+    this->get_parameter_or("enable_accumulated_pointcloud", _accumulate, ACCUMULATE_CLOUD);
+    this->get_parameter_or("accumulate_voxel_size", _accumulate_voxel_size,
+      ACCUMULATE_VOXEL_SIZE);
+    this->get_parameter_or("accumulate_decay", _accumulate_decay, ACCUMULATE_DECAY);
+    this->get_parameter_or("accumulate_min_weight", _accumulate_min_weight,
+      ACCUMULATE_MIN_WEIGHT);
+    this->get_parameter_or("accumulate_max_voxels", _accumulate_max_voxels,
+      ACCUMULATE_MAX_VOXELS);
+    this->get_parameter_or("accumulate_pixel_step", _accumulate_pixel_step,
+      ACCUMULATE_PIXEL_STEP);
+    this->get_parameter_or("accumulate_publish_rate", _accumulate_publish_rate,
+      ACCUMULATE_PUBLISH_RATE);
+    this->get_parameter_or("accumulate_max_depth", _accumulate_max_depth, ACCUMULATE_MAX_DEPTH);
+    this->get_parameter_or("enable_tsdf", _tsdf, TSDF);
+    this->get_parameter_or("tsdf_voxel_size", _tsdf_voxel_size, TSDF_VOXEL_SIZE);
+    this->get_parameter_or("tsdf_truncation", _tsdf_truncation, TSDF_TRUNCATION);
+    this->get_parameter_or("tsdf_max_blocks", _tsdf_max_blocks, TSDF_MAX_BLOCKS);
+    this->get_parameter_or("tsdf_max_depth", _tsdf_max_depth, TSDF_MAX_DEPTH);
+    this->get_parameter_or("tsdf_pixel_step", _tsdf_pixel_step, TSDF_PIXEL_STEP);
+    this->get_parameter_or("tsdf_world_frame", _tsdf_world_frame, std::string(TSDF_WORLD_FRAME));
+    this->get_parameter_or("tsdf_publish_rate", _tsdf_publish_rate, TSDF_PUBLISH_RATE);
+    this->get_parameter_or("enable_clustering", _clustering, CLUSTERING);
+    this->get_parameter_or("cluster_distance", _cluster_distance, CLUSTER_DISTANCE);
+    this->get_parameter_or("cluster_min_points", _cluster_min_points, CLUSTER_MIN_POINTS);
+    this->get_parameter_or("cluster_pixel_step", _cluster_pixel_step, CLUSTER_PIXEL_STEP);
+    this->get_parameter_or("cluster_max_depth", _cluster_max_depth, CLUSTER_MAX_DEPTH);
+    this->get_parameter_or("enable_pixels_to_3d", _pixels_to_3d, PIXELS_TO_3D);
+    this->get_parameter_or("imu_decimated_fps", _imu_decimated_fps, IMU_DECIMATED_FPS);
+    this->get_parameter_or("enable_triggered_capture", _triggered_capture, TRIGGERED_CAPTURE);
+    this->get_parameter_or("trigger_stop_sensors", _trigger_stop_sensors, TRIGGER_STOP_SENSORS);
+    this->get_parameter_or("trigger_warmup_frames", _trigger_warmup_frames,
+      TRIGGER_WARMUP_FRAMES);
+    this->get_parameter_or("trigger_timeout_ms", _trigger_timeout_ms, TRIGGER_TIMEOUT_MS);
+    this->get_parameter_or("enable_snapshot", _snapshot, SNAPSHOT);
+    this->get_parameter_or("snapshot_warmup_frames", _snapshot_warmup_frames,
+      SNAPSHOT_WARMUP_FRAMES);
+    this->get_parameter_or("snapshot_timeout_ms", _snapshot_timeout_ms, SNAPSHOT_TIMEOUT_MS);
+    this->get_parameter_or("enable_quantized_depth", _quantized_depth, QUANTIZED_DEPTH);
+    this->get_parameter_or("quantized_depth_mode", _quantized_depth_mode,
+      std::string(QUANTIZED_DEPTH_MODE));
+    this->get_parameter_or("quantized_depth_min", _quantized_depth_min, QUANTIZED_DEPTH_MIN);
+    this->get_parameter_or("quantized_depth_max", _quantized_depth_max, QUANTIZED_DEPTH_MAX);
+    this->get_parameter_or("enable_validity_mask", _validity_mask, VALIDITY_MASK);
+    this->get_parameter_or("validity_min_depth", _validity_min_depth, VALIDITY_MIN_DEPTH);
+    this->get_parameter_or("validity_max_depth", _validity_max_depth, VALIDITY_MAX_DEPTH);
+    this->get_parameter_or("enable_hole_filling", _hole_filling, HOLE_FILLING);
+    this->get_parameter_or("hole_filling_max_levels", _hole_filling_max_levels,
+      HOLE_FILLING_MAX_LEVELS);
+    this->get_parameter_or("hole_filling_budget_ms", _hole_filling_budget_ms,
+      HOLE_FILLING_BUDGET_MS);
+    this->get_parameter_or("enable_pseudo_lidar", _pseudo_lidar, PSEUDO_LIDAR);
+    this->get_parameter_or("pseudo_lidar_rings", _pseudo_lidar_rings, PSEUDO_LIDAR_RINGS);
+    this->get_parameter_or("pseudo_lidar_columns", _pseudo_lidar_columns, PSEUDO_LIDAR_COLUMNS);
+    this->get_parameter_or("pseudo_lidar_min_elevation", _pseudo_lidar_min_elevation,
+      PSEUDO_LIDAR_MIN_ELEVATION);
+    this->get_parameter_or("pseudo_lidar_max_elevation", _pseudo_lidar_max_elevation,
+      PSEUDO_LIDAR_MAX_ELEVATION);
+    this->get_parameter_or("pseudo_lidar_max_range", _pseudo_lidar_max_range,
+      PSEUDO_LIDAR_MAX_RANGE);
+    this->get_parameter_or("enable_detection_fusion", _detection_fusion, DETECTION_FUSION);
+    this->get_parameter_or("detection_match_tolerance_ms", _detection_match_tolerance_ms,
+      DETECTION_MATCH_TOLERANCE_MS);
+    this->get_parameter_or("detection_roi_shrink", _detection_roi_shrink, DETECTION_ROI_SHRINK);
+    this->get_parameter_or("enable_video_encoding", _video_encoding, VIDEO_ENCODING);
+    this->get_parameter_or("video_bitrate_kbps", _video_bitrate, VIDEO_BITRATE);
+    this->get_parameter_or("video_gop", _video_gop, VIDEO_GOP);
+    this->get_parameter_or("video_preset", _video_preset, std::string(VIDEO_PRESET));
+    this->get_parameter_or("video_profile", _video_profile, std::string(VIDEO_PROFILE));
+    this->get_parameter_or("video_zero_latency", _video_zero_latency, VIDEO_ZERO_LATENCY);
+    this->get_parameter_or("video_threads", _video_threads, VIDEO_THREADS);
+    this->get_parameter_or("rt_audit_allocation_budget", _rt_audit_allocation_budget,
+      RT_AUDIT_ALLOCATION_BUDGET);
+    this->get_parameter_or("rt_audit_lock_budget", _rt_audit_lock_budget, RT_AUDIT_LOCK_BUDGET);
+    this->get_parameter_or("memory_budget_mb", _memory_budget_mb, MEMORY_BUDGET_MB);
+    this->get_parameter_or("enable_metrics", _metrics_enabled, METRICS);
+    this->get_parameter_or("metrics_address", _metrics_address, std::string(METRICS_ADDRESS));
+    this->get_parameter_or("metrics_port", _metrics_port, METRICS_PORT);
+    this->get_parameter_or("enable_serialized_publish", _serialized_publish,
+      SERIALIZED_PUBLISH);
+    this->get_parameter_or("serialized_publish_benchmark", _serialized_publish_benchmark,
+      SERIALIZED_PUBLISH_BENCHMARK);
+    this->get_parameter_or("enable_frame_matcher", _frame_matcher, FRAME_MATCHER);
+    this->get_parameter_or("frame_matcher_tolerance_ms", _frame_matcher_tolerance_ms,
+      FRAME_MATCHER_TOLERANCE_MS);
+    this->get_parameter_or("frame_matcher_max_wait_ms", _frame_matcher_max_wait_ms,
+      FRAME_MATCHER_MAX_WAIT_MS);
+    this->get_parameter_or("sync_groups", _sync_groups, std::string(SYNC_GROUPS));
+    this->get_parameter_or("enable_infra1", _enable[INFRA1], ENABLE_INFRA1);
+    this->get_parameter_or("enable_infra2", _enable[INFRA2], ENABLE_INFRA2);
+    if (!_enable[DEPTH]) {
+      _pointcloud = false;
+      _pointcloud_bands = false;
+      _align_depth = false;
+      _color_aligned_to_depth = false;
+      _change_gate = false;
+      _accumulate = false;
+      _tsdf = false;
+      _clustering = false;
+      _pixels_to_3d = false;
+      _pseudo_lidar = false;
+      _hole_filling = false;
+      _validity_mask = false;
+      _quantized_depth = false;
+      _enable[INFRA1] = false;
+      _enable[INFRA2] = false;
+    }
+
+    if (!_enable[DEPTH] || !_align_depth) {
+      _align_pointcloud = false;
+      _detection_fusion = false;
+      _upsample_depth = false;
+    }
+
+    if (_tsdf_voxel_size <= 0.0 || _tsdf_truncation <= 0.0 || _tsdf_max_blocks <= 0 ||
+      _tsdf_pixel_step <= 0 || _tsdf_publish_rate <= 0.0)
+    {
+      RCLCPP_WARN(logger_, "Invalid TSDF parameters, TSDF integration disabled");
+      _tsdf = false;
+    }
+
+    if (_cluster_distance <= 0.0 || _cluster_pixel_step <= 0) {
+      RCLCPP_WARN(logger_, "Invalid clustering parameters, clustering disabled");
+      _clustering = false;
+    }
+
+    if ((_quantized_depth_mode != "disparity" && _quantized_depth_mode != "log") ||
+      _quantized_depth_min <= 0.0 || _quantized_depth_max <= _quantized_depth_min)
+    {
+      RCLCPP_WARN(logger_, "Invalid quantized depth parameters, quantized depth disabled");
+      _quantized_depth = false;
+    }
+
+    if (_video_bitrate <= 0 || _video_gop <= 0 || _video_threads < 0) {
+      RCLCPP_WARN(logger_, "Invalid video encoding parameters, video encoding disabled");
+      _video_encoding = false;
+    }
+
+    if (!_triggered_capture) {
+      _trigger_stop_sensors = false;
+    }
+
+    if (_hole_filling_max_levels <= 0) {
+      RCLCPP_WARN(logger_, "hole_filling_max_levels must be positive, using %d",
+        HOLE_FILLING_MAX_LEVELS);
+      _hole_filling_max_levels = HOLE_FILLING_MAX_LEVELS;
+    }
+
+    if (_pseudo_lidar_rings <= 0 || _pseudo_lidar_columns <= 0) {
+      RCLCPP_WARN(logger_, "Invalid pseudo LiDAR parameters, pseudo LiDAR disabled");
+      _pseudo_lidar = false;
+    }
+
+    if (_registration_engine != "rs2" && _registration_engine != "zbuffer") {
+      RCLCPP_WARN(logger_, "Unknown registration_engine \"%s\", using rs2",
+        _registration_engine.c_str());
+      _registration_engine = "rs2";
+    }
+
+    if (_upsample_radius <= 0 || _upsample_sigma_spatial <= 0.0 ||
+      _upsample_sigma_color <= 0.0)
+    {
+      RCLCPP_WARN(logger_, "Invalid depth upsampling parameters, upsampling disabled");
+      _upsample_depth = false;
+    }
+
+    if (_pointcloud_band_rows <= 0) {
+      RCLCPP_WARN(logger_, "pointcloud_band_rows must be positive, using %d",
+        POINTCLOUD_BAND_ROWS);
+      _pointcloud_band_rows = POINTCLOUD_BAND_ROWS;
+    }
+
+    if (_change_gate_grid_step <= 0) {
+      RCLCPP_WARN(logger_, "change_gate_grid_step must be positive, using %d",
+        CHANGE_GATE_GRID_STEP);
+      _change_gate_grid_step = CHANGE_GATE_GRID_STEP;
+    }
+
+    if (_accumulate_pixel_step <= 0 || _accumulate_max_voxels <= 0 ||
+      _accumulate_voxel_size <= 0.0 || _accumulate_publish_rate <= 0.0 ||
+      _accumulate_max_depth <= 0.0)
+    {
+      RCLCPP_WARN(logger_, "Invalid point cloud accumulation parameters, accumulation disabled");
+      _accumulate = false;
+    }
+
+    if (_validity_mask && _validity_min_depth > _validity_max_depth) {
+      RCLCPP_WARN(logger_, "validity_min_depth %.2f is above validity_max_depth %.2f, validity "
+        "mask disabled", _validity_min_depth, _validity_max_depth);
+      _validity_mask = false;
+    }
+
+    parseSyncGroups();
+    this->get_parameter("serial_no", _serial_no);
+
+    this->get_parameter_or("depth_width", _width[DEPTH], DEPTH_WIDTH);
+    this->get_parameter_or("depth_height", _height[DEPTH], DEPTH_HEIGHT);
+    this->get_parameter_or("depth_fps", _fps[DEPTH], DEPTH_FPS);
+
+    this->get_parameter_or("infra1_width", _width[INFRA1], INFRA1_WIDTH);
+    this->get_parameter_or("infra1_height", _height[INFRA1], INFRA1_HEIGHT);
+    this->get_parameter_or("infra1_fps", _fps[INFRA1], INFRA1_FPS);
+
+    this->get_parameter_or("infra2_width", _width[INFRA2], INFRA2_WIDTH);
+    this->get_parameter_or("infra2_height", _height[INFRA2], INFRA2_HEIGHT);
+    this->get_parameter_or("infra2_fps", _fps[INFRA2], INFRA2_FPS);
+
+    this->get_parameter_or("color_width", _width[COLOR], COLOR_WIDTH);
+    this->get_parameter_or("color_height", _height[COLOR], COLOR_HEIGHT);
+    this->get_parameter_or("color_fps", _fps[COLOR], COLOR_FPS);
+    this->get_parameter_or("enable_color", _enable[COLOR], ENABLE_COLOR);
+
+    this->get_parameter_or("fisheye_width", _width[FISHEYE], FISHEYE_WIDTH);
+    this->get_parameter_or("fisheye_height", _height[FISHEYE], FISHEYE_HEIGHT);
+    this->get_parameter_or("fisheye_fps", _fps[FISHEYE], FISHEYE_FPS);
+    this->get_parameter_or("enable_fisheye", _enable[FISHEYE], ENABLE_FISHEYE);
+
+    this->get_parameter_or("gyro_fps", _fps[GYRO], GYRO_FPS);
+    this->get_parameter_or("accel_fps", _fps[ACCEL], ACCEL_FPS);
+    this->get_parameter_or("enable_imu", _enable[GYRO], ENABLE_IMU);
+    this->get_parameter_or("enable_imu", _enable[ACCEL], ENABLE_IMU);
+
+    this->get_parameter_or("base_frame_id", _base_frame_id,
+      std::string(DEFAULT_BASE_FRAME_ID));
+    this->get_parameter_or("depth_frame_id", _frame_id[DEPTH],
+      std::string(DEFAULT_DEPTH_FRAME_ID));
+    this->get_parameter_or("infra1_frame_id", _frame_id[INFRA1],
+      std::string(DEFAULT_INFRA1_FRAME_ID));
+    this->get_parameter_or("infra2_frame_id", _frame_id[INFRA2],
+      std::string(DEFAULT_INFRA2_FRAME_ID));
+    this->get_parameter_or("color_frame_id", _frame_id[COLOR],
+      std::string(DEFAULT_COLOR_FRAME_ID));
+    this->get_parameter_or("fisheye_frame_id", _frame_id[FISHEYE],
+      std::string(DEFAULT_FISHEYE_FRAME_ID));
+    this->get_parameter_or("imu_gyro_frame_id", _frame_id[GYRO],
+      std::string(DEFAULT_IMU_FRAME_ID));
+    this->get_parameter_or("imu_accel_frame_id", _frame_id[ACCEL],
+      std::string(DEFAULT_IMU_FRAME_ID));
+
+    this->get_parameter_or("depth_optical_frame_id", _optical_frame_id[DEPTH],
+      std::string(DEFAULT_DEPTH_OPTICAL_FRAME_ID));
+    this->get_parameter_or("infra1_optical_frame_id", _optical_frame_id[INFRA1],
+      std::string(DEFAULT_INFRA1_OPTICAL_FRAME_ID));
+    this->get_parameter_or("infra2_optical_frame_id", _optical_frame_id[INFRA2],
+      std::string(DEFAULT_INFRA2_OPTICAL_FRAME_ID));
+    this->get_parameter_or("color_optical_frame_id", _optical_frame_id[COLOR],
+      std::string(DEFAULT_COLOR_OPTICAL_FRAME_ID));
+    this->get_parameter_or("fisheye_optical_frame_id", _optical_frame_id[FISHEYE],
+      std::string(DEFAULT_FISHEYE_OPTICAL_FRAME_ID));
+    this->get_parameter_or("gyro_optical_frame_id", _optical_frame_id[GYRO],
+      std::string(DEFAULT_GYRO_OPTICAL_FRAME_ID));
+    this->get_parameter_or("accel_optical_frame_id", _optical_frame_id[ACCEL],
+      std::string(DEFAULT_ACCEL_OPTICAL_FRAME_ID));
+  }
+
+  void setupDevice()
+  {
+    RCLCPP_INFO(logger_, "setupDevice...");
+    try {
+      _ctx.reset(new rs2::context());
+
+      auto list = _ctx->query_devices();
+      if (0 == list.size()) {
+        _ctx.reset();
+        throw std::runtime_error("No RealSense devices were found!");
+      }
+
+      // Take the first device in the list.
+      // Add an ability to get the specific device to work with from outside.
+      _dev = list.front();
+      _ctx->set_devices_changed_callback([this](rs2::event_information & info)
+        {
+          if (info.was_removed(_dev)) {
+            RCLCPP_FATAL(logger_, "The device has been disconnected! Terminate RealSense Node...");
+            rclcpp::shutdown();
+            exit(1);
+          }
+        });
+
+      auto camera_name = _dev.get_info(RS2_CAMERA_INFO_NAME);
+      RCLCPP_INFO(logger_, "Device Name: %s", camera_name);
+
+      _serial_no = _dev.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER);
+      RCLCPP_INFO(logger_, "Device Serial No: %s", _serial_no.c_str());
+
+      auto fw_ver = _dev.get_info(RS2_CAMERA_INFO_FIRMWARE_VERSION);
+      RCLCPP_INFO(logger_, "Device FW version: %s", fw_ver);
+
+      auto pid = _dev.get_info(RS2_CAMERA_INFO_PRODUCT_ID);
+      RCLCPP_INFO(logger_, "Device Product ID: %s", pid);
+
+      RCLCPP_INFO(logger_, "Sync Mode: %s", ((_sync_frames) ? "On" : "Off"));
+
+      auto dev_sensors = _dev.query_sensors();
+
+      RCLCPP_INFO(logger_, "Device Sensors: ");
+      for (auto && elem : dev_sensors) {
+        std::string module_name = elem.get_info(RS2_CAMERA_INFO_NAME);
+        if ("Stereo Module" == module_name || "Coded-Light Depth Sensor" == module_name) {
+          auto sen = std::make_shared<rs2::sensor>(elem);
+          _sensors[DEPTH] = sen;
+          _sensors[INFRA1] = sen;
+          _sensors[INFRA2] = sen;
+        } else if ("RGB Camera" == module_name) {
+          _sensors[COLOR] = std::make_shared<rs2::sensor>(elem);
+        } else if ("Wide FOV Camera" == module_name) {
+          _sensors[FISHEYE] = std::make_shared<rs2::sensor>(elem);
+        } else if ("Motion Module" == module_name) {
+          auto hid_sensor = std::make_shared<rs2::sensor>(elem);
+          _sensors[GYRO] = hid_sensor;
+          _sensors[ACCEL] = hid_sensor;
+        } else {
+          throw std::runtime_error("Module Name \"" + module_name +
+                  "\" isn't supported by LibRealSense!");
+        }
+        RCLCPP_INFO(logger_, "%s was found.", std::string(elem.get_info(
+            RS2_CAMERA_INFO_NAME)).c_str());
+      }
+
+      // Update "enable" map
+      std::vector<std::vector<stream_index_pair>> streams(IMAGE_STREAMS);
+      streams.insert(streams.end(), HID_STREAMS.begin(), HID_STREAMS.end());
+      for (auto & elem : streams) {
+        for (auto & stream_index : elem) {
+          if (true == _enable[stream_index] && _sensors.find(stream_index) == _sensors.end()) {
+            // check if device supports the enabled stream
+            RCLCPP_INFO(logger_, "%s sensor isn't supported by current device! -- Skipping...",
+              rs2_stream_to_string(stream_index.first));
+            _enable[stream_index] = false;
+          }
+        }
+      }
+    } catch (const std::exception & ex) {
+      RCLCPP_ERROR(logger_, "An exception has been thrown: %s", ex.what());
+      throw;
+    } catch (...) {
+      RCLCPP_ERROR(logger_, "Unknown exception has occured!");
+      throw;
+    }
+  }
+
+  void setupPublishers()
+  {
+    RCLCPP_INFO(logger_, "setupPublishers...");
+
+    if (true == _enable[DEPTH]) {
+      _image_publishers[DEPTH] = image_transport::create_publisher(
+        this, "camera/depth/image_rect_raw");
+      _info_publisher[DEPTH] = this->create_publisher<sensor_msgs::msg::CameraInfo>(
+        "camera/depth/camera_info", 1);
+
+      if (_pointcloud) {
+        _pointcloud_publisher = this->create_publisher<sensor_msgs::msg::PointCloud2>(
+          "camera/depth/color/points", 1);
+      }
+
+      if (_pointcloud_bands) {
+        // Room for every band of one frame.
+        auto band_count = (_height[DEPTH] + _pointcloud_band_rows - 1) / _pointcloud_band_rows;
+        _pointcloud_band_publisher = this->create_publisher<PointCloudBand>(
+          "camera/depth/color/points_bands", band_count);
+      }
+
+      if (_accumulate) {
+        _accumulate_publisher = this->create_publisher<sensor_msgs::msg::PointCloud2>(
+          "camera/depth/accumulated/points", 1);
+      }
+
+      if (_tsdf) {
+        _tsdf_publisher = this->create_publisher<sensor_msgs::msg::PointCloud2>(
+          "camera/depth/tsdf/surface_points", 1);
+        _tf_buffer = std::make_shared<tf2_ros::Buffer>(this->get_clock());
+        _tf_listener = std::make_shared<tf2_ros::TransformListener>(*_tf_buffer);
+      }
+
+      if (_quantized_depth) {
+        _quantized_depth_publisher = image_transport::create_publisher(
+          this, "camera/depth/quantized/image_raw");
+        _quantization_publisher = this->create_publisher<DepthQuantization>(
+          "camera/depth/quantized/quantization", 1);
+      }
+
+      if (_validity_mask) {
+        _validity_mask_publisher = this->create_publisher<DepthValidityMask>(
+          "camera/depth/validity_mask", 1);
+      }
+
+      if (_hole_filling) {
+        _filled_depth_publisher = image_transport::create_publisher(
+          this, "camera/depth/filled/image_raw");
+        _filled_mask_publisher = image_transport::create_publisher(
+          this, "camera/depth/filled/mask");
+      }
+
+      if (_pseudo_lidar) {
+        _pseudo_lidar_publisher = this->create_publisher<sensor_msgs::msg::PointCloud2>(
+          "camera/depth/pseudo_lidar/points", 1);
+      }
+
+      if (_clustering) {
+        _clusters_publisher = this->create_publisher<Clusters>("camera/depth/clusters", 1);
+      }
+
+      if (_detection_fusion) {
+        for (auto & buffer : _aligned_pool) {
+          buffer = std::make_shared<DepthSnapshot>();
+          buffer->aligned_copy.reserve(_width[COLOR] * _height[COLOR]);
+        }
+        _detections_3d_publisher = this->create_publisher<Detection3DArray>(
+          "camera/color/detections_3d", 10);
+        _detections_subscription = this->create_subscription<Detection2DArray>(
+          "camera/color/detections", 10,
+          std::bind(&RealSenseCameraNode::fuseDetections, this, std::placeholders::_1));
+      }
+
+      if (_pixels_to_3d) {
+        _pixels_to_3d_service = this->create_service<PixelsTo3D>("camera/pixels_to_3d",
+            std::bind(&RealSenseCameraNode::pixelsTo3D, this, std::placeholders::_1,
+            std::placeholders::_2));
+      }
+
+      if (_align_depth) {
+        _align_depth_publisher = image_transport::create_publisher(
+          this, "camera/aligned_depth_to_color/image_raw");
+        _align_depth_camera_publisher = this->create_publisher<sensor_msgs::msg::CameraInfo>(
+          "camera/aligned_depth_to_color/camera_info", 1);
+      }
+
+      if (_upsample_depth) {
+        _upsample_depth_publisher = image_transport::create_publisher(
+          this, "camera/aligned_depth_to_color/upsampled/image_raw");
+      }
+
+      if (_color_aligned_to_depth) {
+        _color_to_depth_publisher = image_transport::create_publisher(
+          this, "camera/color/aligned_to_depth/image_raw");
+        _color_to_depth_info_publisher = this->create_publisher<sensor_msgs::msg::CameraInfo>(
+          "camera/color/aligned_to_depth/camera_info", 1);
+      }
+
+      if (_align_pointcloud && _align_depth) {
+        _align_pointcloud_publisher = this->create_publisher<sensor_msgs::msg::PointCloud2>(
+          "camera/aligned_depth_to_color/color/points", 1);
+      }
+    }
+
+    if (true == _enable[INFRA1]) {
+      _image_publishers[INFRA1] = image_transport::create_publisher(
+        this, "camera/infra1/image_rect_raw");
+      _info_publisher[INFRA1] = this->create_publisher<sensor_msgs::msg::CameraInfo>(
+        "camera/infra1/camera_info", 1);
+    }
+
+    if (true == _enable[INFRA2]) {
+      _image_publishers[INFRA2] = image_transport::create_publisher(
+        this, "camera/infra2/image_rect_raw");
+      _info_publisher[INFRA2] = this->create_publisher<sensor_msgs::msg::CameraInfo>(
+        "camera/infra2/camera_info", 1);
+    }
+
+    if (true == _enable[COLOR]) {
+      _image_publishers[COLOR] = image_transport::create_publisher(
+        this, "camera/color/image_raw");
+      _info_publisher[COLOR] = this->create_publisher<sensor_msgs::msg::CameraInfo>(
+        "camera/color/camera_info", 1);
+
+      if (_video_encoding) {
+        _video_publisher = this->create_publisher<EncodedVideo>("camera/color/video", 1);
+      }
+    }
+
+    if (true == _enable[FISHEYE] &&
+      true == _enable[DEPTH])
+    {
+      _image_publishers[FISHEYE] = image_transport::create_publisher(
+        this, "camera/fisheye/image_raw");
+      _info_publisher[FISHEYE] = this->create_publisher<sensor_msgs::msg::CameraInfo>(
+        "camera/fisheye/camera_info", 1);
+      _fe_to_depth_publisher = this->create_publisher<realsense_camera_msgs::msg::Extrinsics>(
+        "camera/extrinsics/fisheye2depth", qos);
+    }
+
+    if (true == _enable[GYRO]) {
+      _imu_publishers[GYRO] = this->create_publisher<sensor_msgs::msg::Imu>("camera/gyro/sample",
+          100);
+      _imu_info_publisher[GYRO] = this->create_publisher<realsense_camera_msgs::msg::IMUInfo>(
+        "camera/gyro/imu_info", qos);
+    }
+
+    if (true == _enable[ACCEL]) {
+      _imu_publishers[ACCEL] = this->create_publisher<sensor_msgs::msg::Imu>("camera/accel/sample",
+          100);
+      _imu_info_publisher[ACCEL] = this->create_publisher<realsense_camera_msgs::msg::IMUInfo>(
+        "camera/accel/imu_info", qos);
+    }
+
+    if (_imu_decimated_fps > 0) {
+      for (auto & stream : {GYRO, ACCEL}) {
+        if (true != _enable[stream]) {
+          continue;
+        }
+        auto factor = static_cast<int>(std::lround(static_cast<double>(_fps[stream]) /
+          _imu_decimated_fps));
+        if (factor < 2) {
+          RCLCPP_WARN(logger_, "imu_decimated_fps %d is not below %s fps %d, no decimated topic",
+            _imu_decimated_fps, _stream_name[stream].c_str(), _fps[stream]);
+          continue;
+        }
+        _imu_decimators[stream].factor = factor;
+        _imu_decimated_publishers[stream] = this->create_publisher<sensor_msgs::msg::Imu>(
+          "camera/" + _stream_name[stream] + "/sample_decimated", 100);
+        RCLCPP_INFO(logger_, "Decimated %s topic is enabled - %d fps, boxcar of %d samples",
+          _stream_name[stream].c_str(), _fps[stream] / factor, factor);
+      }
+    }
+
+    if (true == _enable[FISHEYE] &&
+      (true == _enable[GYRO] ||
+      true == _enable[ACCEL]))
+    {
+      _fe_to_imu_publisher = this->create_publisher<realsense_camera_msgs::msg::Extrinsics>(
+        "camera/extrinsics/fisheye2imu", qos);
+    }
+
+#ifdef REALSENSE_RT_AUDIT
+    _rt_audit_publisher = this->create_publisher<RtAudit>("camera/rt_audit", 10);
+    _rt_audit_timer = this->create_wall_timer(std::chrono::seconds(1),
+        std::bind(&RealSenseCameraNode::publishRtAudit, this));
+    RCLCPP_INFO(logger_, "Real-time audit is enabled - allocation budget: %d, lock budget: %d",
+      _rt_audit_allocation_budget, _rt_audit_lock_budget);
+#endif
+
+    // The capture services wait for frames: their own group keeps the executor thread of the
+    // other callbacks free.
+    if (!_capture_callback_group) {
+      _capture_callback_group =
+        this->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
+    }
+    if (_triggered_capture) {
+      _trigger_service = this->create_service<TriggerCapture>("camera/trigger",
+          std::bind(&RealSenseCameraNode::triggerCapture, this, std::placeholders::_1,
+          std::placeholders::_2), rmw_qos_profile_services_default, _capture_callback_group);
+    }
+
+    if (_snapshot && (true == _enable[DEPTH] || true == _enable[COLOR])) {
+      _snapshot_service = this->create_service<CaptureSnapshot>("camera/capture_snapshot",
+          std::bind(&RealSenseCameraNode::captureSnapshot, this, std::placeholders::_1,
+          std::placeholders::_2), rmw_qos_profile_services_default, _capture_callback_group);
+    }
+    _diagnostics_publisher = this->create_publisher<diagnostic_msgs::msg::DiagnosticArray>(
+      "/diagnostics", 1);
+    _memory_timer = this->create_wall_timer(std::chrono::seconds(1),
+        std::bind(&RealSenseCameraNode::publishMemoryDiagnostics, this));
+    setupMetrics();
+    _static_tf_broadcaster_ =
+      std::make_shared<tf2_ros::StaticTransformBroadcaster>(shared_from_this());
+  }
+
+  void setupStreams()
+  {
+    RCLCPP_INFO(logger_, "setupStreams...");
+    try {
+      for (auto & streams : IMAGE_STREAMS) {
+        for (auto & elem : streams) {
+          if (true == _enable[elem]) {
+            auto & sens = _sensors[elem];
+            auto profiles = sens->get_stream_profiles();
+            for (auto & profile : profiles) {
+              auto video_profile = profile.as<rs2::video_stream_profile>();
+              if (video_profile.format() == _format[elem] &&
+                video_profile.width() == _width[elem] &&
+                video_profile.height() == _height[elem] &&
+                video_profile.fps() == _fps[elem] &&
+                video_profile.stream_index() == elem.second)
+              {
+                _enabled_profiles[elem].push_back(profile);
+
+                // Created here: the frame callbacks of several threads only rebind it.
+                _image[elem] =
+                  cv::Mat(_height[elem], _width[elem], _image_format[elem], cv::Scalar(0, 0, 0));
+                RCLCPP_INFO(logger_, "%s stream is enabled - width: %d, height: %d, fps: %d",
+                  _stream_name[elem].c_str(), _width[elem], _height[elem], _fps[elem]);
+                break;
+              }
+            }
+            if (_enabled_profiles.find(elem) == _enabled_profiles.end()) {
+              RCLCPP_WARN(logger_, "Given stream configuration is not supported by the device!");
+              RCLCPP_WARN(logger_, "Stream: %s, Format: %d, Width: %d, Height: %d, FPS: %d",
+                rs2_stream_to_string(elem.first), _format[elem], _width[elem], _height[elem],
+                _fps[elem]);
+              _enable[elem] = false;
+            }
+          }
         }
       }
 
@@ -492,566 +2179,2890 @@ private:
           updateStreamCalibData(video_profile);
         }
       }
+      if (_serialized_publish_benchmark) {
+        // Created here: the frame callbacks only look them up.
+        for (auto & profiles : _enabled_profiles) {
+          _serialization_stats[_stream_name[profiles.first] + "/camera_info"];
+        }
+        _serialization_stats["depth/color/points"];
+        _serialization_stats["aligned_depth_to_color/color/points"];
+      }
+
+      _frame_callback = [this](rs2::frame frame)
+        {
+          RT_AUDIT_SCOPE("frame_callback");
+          auto callback_start = std::chrono::steady_clock::now();
+          metrics::ScopedTimer callback_timer(*_frame_callback_metric);
+          auto matcher_queued = 0;
+          for (auto & matcher : _matchers) {
+            matcher_queued += matcher->queued();
+          }
+          _matcher_queue_metric->set(matcher_queued);
+          // We compute a ROS timestamp which is based on an initial ROS time at point of first
+          // frame, and the incremental timestamp from the camera.
+          // In sync mode the timestamp is based on ROS time
+          if (!_intialize_time_base.load(std::memory_order_acquire)) {
+            // The threads of several sync groups and sensors race for the first frame.
+            std::lock_guard<std::mutex> lock(_time_base_mutex);
+            if (!_intialize_time_base.load(std::memory_order_relaxed)) {
+              _ros_time_base = _ros_clock.now();
+              _camera_time_base = frame.get_timestamp();
+              _intialize_time_base.store(true, std::memory_order_release);
+            }
+          }
+
+          rclcpp::Time t;
+          if (isSynced(frame)) {
+            t = _ros_clock.now();
+          } else {
+            uint64_t elapsed_camera_ns = (/*ms*/ frame.get_timestamp() - /*ms*/ _camera_time_base) *
+              1000000;
+            t = rclcpp::Time(_ros_time_base.nanoseconds() + elapsed_camera_ns, RCL_ROS_TIME);
+          }
+          auto is_color_frame_arrived = false;
+          auto is_depth_frame_arrived = false;
+          rs2::frame depth_frame;
+          rs2::frame color_frame;
+          rs2::frame infra1_frame;
+          if (frame.is<rs2::frameset>()) {
+            RCLCPP_DEBUG(logger_, "Frameset arrived");
+            auto frameset = frame.as<rs2::frameset>();
+            auto publish_depth = true;
+            if (_change_gate) {
+              auto gate_depth = frameset.get_depth_frame();
+              if (gate_depth) {
+                publish_depth = passChangeGate(gate_depth);
+              }
+            }
+            for (auto it = frameset.begin(); it != frameset.end(); ++it) {
+              auto f = (*it);
+              auto stream_type = f.get_profile().stream_type();
+              if (RS2_STREAM_COLOR == stream_type) {
+                is_color_frame_arrived = true;
+                color_frame = f;
+                bindImage(f);
+              } else if (RS2_STREAM_DEPTH == stream_type && publish_depth) {
+                depth_frame = f;
+                is_depth_frame_arrived = true;
+                bindImage(f);
+              } else if (INFRA1 == stream_index_pair{stream_type, f.get_profile().stream_index()}) {
+                infra1_frame = f;
+                if (_pseudo_lidar) {
+                  std::lock_guard<std::mutex> lock(_last_infra1_mutex);
+                  _last_infra1 = f;
+                }
+              }
+            }
+
+            // Bands go first: their latency must not include the other products of the frame.
+            if (_pointcloud_bands && is_depth_frame_arrived && is_color_frame_arrived) {
+              RCLCPP_DEBUG(logger_, "publishPCBands(...)");
+              publishPCBands(t, depth_frame.get_frame_number(), callback_start);
+            }
+
+            for (auto it = frameset.begin(); it != frameset.end(); ++it) {
+              auto f = (*it);
+              auto stream_type = f.get_profile().stream_type();
+              if (RS2_STREAM_DEPTH == stream_type && !publish_depth) {
+                // Static scene: the depth image and its derived products are gated.
+                continue;
+              }
+
+              RCLCPP_DEBUG(logger_,
+                "Frameset contain %s frame. frame_number: %llu ; frame_TS: %f ; ros_TS(NSec): %lu",
+                rs2_stream_to_string(stream_type), frame.get_frame_number(),
+                frame.get_timestamp(), t.nanoseconds());
+              publishFrame(f, t);
+            }
+
+            if (_align_depth && is_depth_frame_arrived && is_color_frame_arrived) {
+              RCLCPP_DEBUG(logger_, "publishAlignedDepthTopic(...)");
+              publishAlignedDepthImg(frame, t);
+
+              if (_upsample_depth && 0 != _upsample_depth_publisher.getNumSubscribers()) {
+                RCLCPP_DEBUG(logger_, "publishUpsampledDepth(...)");
+                publishUpsampledDepth(color_frame, t);
+              }
+            }
+
+            if (_color_aligned_to_depth && is_depth_frame_arrived && is_color_frame_arrived &&
+              (0 != _color_to_depth_publisher.getNumSubscribers() ||
+              0 != _color_to_depth_info_publisher->get_subscription_count()))
+            {
+              RCLCPP_DEBUG(logger_, "publishColorAlignedToDepth(...)");
+              publishColorAlignedToDepth(depth_frame, color_frame, t);
+            }
+
+            if (_pointcloud && is_depth_frame_arrived && is_color_frame_arrived) {
+              RCLCPP_DEBUG(logger_, "publishPCTopic(...)");
+              publishPCTopic(t);
+            }
+
+            if (_align_depth && _align_pointcloud && is_depth_frame_arrived &&
+              is_color_frame_arrived)
+            {
+              RCLCPP_DEBUG(logger_, "publishAlignedPCTopic(...)");
+              publishAlignedPCTopic(t);
+            }
+
+            if (_accumulate && is_depth_frame_arrived) {
+              accumulatePointCloud(depth_frame, t);
+            }
+
+            if (_tsdf && is_depth_frame_arrived) {
+              integrateTsdf(depth_frame, t);
+            }
+
+            if (_clustering && is_depth_frame_arrived) {
+              publishClusters(depth_frame, t);
+            }
+
+            if (_pseudo_lidar && is_depth_frame_arrived) {
+              if (!infra1_frame) {
+                // Infra1 is in another sync group or not synced: use its latest frame.
+                std::lock_guard<std::mutex> lock(_last_infra1_mutex);
+                infra1_frame = _last_infra1;
+              }
+              publishPseudoLidar(depth_frame, infra1_frame, t);
+            }
+
+            if (_quantized_depth && is_depth_frame_arrived) {
+              publishQuantizedDepth(depth_frame, t);
+            }
+
+            if (_validity_mask && is_depth_frame_arrived) {
+              publishValidityMask(depth_frame, t);
+            }
+
+            if (_hole_filling && is_depth_frame_arrived) {
+              publishFilledDepth(depth_frame, t);
+            }
+
+            if (_video_encoding && is_color_frame_arrived) {
+              encodeColorFrame(color_frame, t);
+            }
+
+            if ((_pixels_to_3d || _detection_fusion) && is_depth_frame_arrived) {
+              updateDepthSnapshot(depth_frame, t, _align_depth && is_color_frame_arrived);
+            }
+
+          } else {
+            auto stream_type = frame.get_profile().stream_type();
+            if (_change_gate && RS2_STREAM_DEPTH == stream_type && !passChangeGate(frame)) {
+              return;
+            }
+            RCLCPP_DEBUG(logger_,
+              "%s video frame arrived. frame_number: %llu ; frame_TS: %f ; ros_TS(NSec): %lu",
+              rs2_stream_to_string(stream_type), frame.get_frame_number(),
+              frame.get_timestamp(), t.nanoseconds());
+            publishFrame(frame, t);
+
+            if (_accumulate && RS2_STREAM_DEPTH == stream_type) {
+              accumulatePointCloud(frame, t);
+            }
+
+            if (_tsdf && RS2_STREAM_DEPTH == stream_type) {
+              integrateTsdf(frame, t);
+            }
+
+            if (_clustering && RS2_STREAM_DEPTH == stream_type) {
+              publishClusters(frame, t);
+            }
+
+            if (_pseudo_lidar && INFRA1.first == stream_type &&
+              INFRA1.second == frame.get_profile().stream_index())
+            {
+              std::lock_guard<std::mutex> lock(_last_infra1_mutex);
+              _last_infra1 = frame;
+            }
+
+            if (_quantized_depth && RS2_STREAM_DEPTH == stream_type) {
+              publishQuantizedDepth(frame, t);
+            }
+
+            if (_validity_mask && RS2_STREAM_DEPTH == stream_type) {
+              publishValidityMask(frame, t);
+            }
+
+            if (_hole_filling && RS2_STREAM_DEPTH == stream_type) {
+              publishFilledDepth(frame, t);
+            }
+
+            if (_pseudo_lidar && RS2_STREAM_DEPTH == stream_type) {
+              rs2::frame infra1;
+              {
+                std::lock_guard<std::mutex> lock(_last_infra1_mutex);
+                infra1 = _last_infra1;
+              }
+              publishPseudoLidar(frame, infra1, t);
+            }
+
+            if (_pixels_to_3d && RS2_STREAM_DEPTH == stream_type) {
+              updateDepthSnapshot(frame, t, false);
+            }
+
+            if (_video_encoding && RS2_STREAM_COLOR == stream_type) {
+              encodeColorFrame(frame, t);
+            }
+          }
+        };
+
+      if (_triggered_capture) {
+        for (auto & stream : {DEPTH, COLOR, INFRA1, INFRA2, FISHEYE}) {
+          if (!_enabled_profiles[stream].empty()) {
+            _trigger_stream = stream;
+            break;
+          }
+        }
+        // Between triggers frames are dropped at the route callback, and frames still leaving
+        // the syncer are dropped here. The first frames of a trigger can be skipped as warm up.
+        auto publish = _frame_callback;
+        _frame_callback = [this, publish](rs2::frame frame)
+          {
+            if (0 == _trigger_remaining.load(std::memory_order_acquire)) {
+              return;
+            }
+            auto trigger_frame = isTriggerFrame(frame);
+            {
+              std::lock_guard<std::mutex> lock(_trigger_mutex);
+              if (_trigger_warmup > 0) {
+                if (trigger_frame) {
+                  --_trigger_warmup;
+                }
+                return;
+              }
+            }
+            publish(frame);
+            if (trigger_frame) {
+              completeTriggeredFrame();
+            }
+          };
+      }
+
+      // Streaming IMAGES
+      for (auto & streams : IMAGE_STREAMS) {
+        std::vector<rs2::stream_profile> profiles;
+        for (auto & elem : streams) {
+          if (!_enabled_profiles[elem].empty()) {
+            profiles.insert(profiles.begin(),
+              _enabled_profiles[elem].begin(),
+              _enabled_profiles[elem].end());
+          }
+        }
+
+        if (!profiles.empty()) {
+          auto stream = streams.front();
+          auto & sens = _sensors[stream];
+          if (_frame_queue_size != _default_frame_queue_size &&
+            sens->supports(RS2_OPTION_FRAMES_QUEUE_SIZE))
+          {
+            sens->set_option(RS2_OPTION_FRAMES_QUEUE_SIZE, _frame_queue_size);
+          }
+          sens->open(profiles);
+
+          if (DEPTH == stream) {
+            auto depth_sensor = sens->as<rs2::depth_sensor>();
+            _depth_scale_meters = depth_sensor.get_depth_scale();
+          }
+
+          _opened_sensors.push_back(stream);
+        }
+      }          // end for
+
+      if (_align_depth && !_enabled_profiles[COLOR].empty() &&
+        ("zbuffer" == _registration_engine || _registration_benchmark))
+      {
+        setupRegistration();
+      }
+
+      if (_color_aligned_to_depth && !_enabled_profiles[COLOR].empty()) {
+        setupColorToDepth();
+      }
+
+      if (_upsample_depth) {
+        setupUpsampling();
+      }
+
+      if (_tsdf || _clustering || _pixels_to_3d || _pseudo_lidar) {
+        setupRays(_stream_intrinsics[DEPTH], _depth_rays);
+      }
+
+      if (_pseudo_lidar) {
+        setupPseudoLidar();
+      }
+
+      if (_quantized_depth) {
+        setupQuantizedDepth();
+      }
+
+      if ((_pixels_to_3d || _detection_fusion) && _align_depth &&
+        !_enabled_profiles[COLOR].empty())
+      {
+        setupRays(_stream_intrinsics[COLOR], _color_rays);
+      }
+
+      if (_tsdf) {
+        setupTsdf();
+      }
+
+      if (_video_encoding && !_enabled_profiles[COLOR].empty()) {
+        setupVideoEncoding();
+      }
+
+      setupProcessingPool();
+
+      // Records the arrival of every image frame and routes it either into the syncer of its
+      // sync group or straight to the frame callback.
+      for (auto & streams : IMAGE_STREAMS) {
+        for (auto & elem : streams) {
+          _arrival_ns[elem];
+          _stream_latency[elem];
+          _seq[elem];
+        }
+      }
+      _seq[GYRO];
+      _seq[ACCEL];
+      _route_callback = [this](rs2::frame frame)
+        {
+          auto profile = frame.get_profile();
+          stream_index_pair stream{profile.stream_type(), profile.stream_index()};
+          countArrival(stream, frame.get_frame_number());
+          if (_triggered_capture && 0 == _trigger_remaining.load(std::memory_order_acquire)) {
+            return;
+          }
+          auto & arrivals = _arrival_ns[stream];
+          arrivals[frame.get_frame_number() % arrivals.size()] =
+            std::chrono::steady_clock::now().time_since_epoch().count();
+          auto group = syncGroup(stream);
+          if (group < 0) {
+            _frame_callback(frame);
+          } else if (_frame_matcher) {
+            (*_matchers[group])(std::move(frame));
+          } else {
+            (*_syncers[group])(std::move(frame));
+          }
+        };
+
+      // One syncer or frame matcher per sync group, all delivering to the frame callback.
+      _matchers.clear();
+      _syncers.clear();
+      for (int group = 0; group < _sync_group_count; ++group) {
+        if (_frame_matcher) {
+          std::vector<stream_index_pair> matched_streams;
+          for (auto & elem : _sync_group) {
+            if (group == elem.second && !_enabled_profiles[elem.first].empty()) {
+              matched_streams.push_back(elem.first);
+            }
+          }
+          auto tolerance_ms = _frame_matcher_tolerance_ms;
+          if (tolerance_ms <= 0.0) {
+            // Half of the depth frame period
+            tolerance_ms = 500.0 / _fps[DEPTH];
+          }
+          _matchers.emplace_back(new FrameMatcher());
+          _matchers.back()->start(matched_streams, tolerance_ms, _frame_matcher_max_wait_ms,
+            _frame_callback);
+          RCLCPP_INFO(logger_, "Frame matcher of sync group %d is enabled - tolerance: %.1f ms, "
+            "max wait: %.1f ms", group, tolerance_ms, _frame_matcher_max_wait_ms);
+        } else {
+          _syncers.emplace_back(new PipelineSyncer());
+          _syncers.back()->start(_frame_callback);
+        }
+      }
+
+      // Streaming HID
+      for (const auto streams : HID_STREAMS) {
+        for (auto & elem : streams) {
+          if (true == _enable[elem]) {
+            auto & sens = _sensors[elem];
+            auto profiles = sens->get_stream_profiles();
+            for (rs2::stream_profile & profile : profiles) {
+              if (profile.fps() == _fps[elem] &&
+                profile.format() == _format[elem])
+              {
+                _enabled_profiles[elem].push_back(profile);
+                break;
+              }
+            }
+          }
+        }
+      }
+
+      auto gyro_profile = _enabled_profiles.find(GYRO);
+      auto accel_profile = _enabled_profiles.find(ACCEL);
+
+      if (gyro_profile != _enabled_profiles.end() &&
+        accel_profile != _enabled_profiles.end())
+      {
+        std::vector<rs2::stream_profile> profiles;
+        profiles.insert(profiles.begin(), gyro_profile->second.begin(), gyro_profile->second.end());
+        profiles.insert(profiles.begin(), accel_profile->second.begin(),
+          accel_profile->second.end());
+        auto & sens = _sensors[GYRO];
+        sens->open(profiles);
+        _opened_sensors.push_back(GYRO);
+
+        _imu_callback = [this](rs2::frame frame) {
+            RT_AUDIT_SCOPE("imu_callback");
+            auto stream = frame.get_profile().stream_type();
+            if (_accumulate && GYRO.first == stream) {
+              auto axes = *(reinterpret_cast<const float3 *>(frame.get_data()));
+              _gyro_samples.push(GyroSample{frame.get_timestamp(), axes.x, axes.y, axes.z});
+            }
+            if (false == _intialize_time_base) {
+              return;
+            }
+
+            RCLCPP_DEBUG(logger_, "Frame arrived: stream: %s ; index: %d ; Timestamp Domain: %s",
+            rs2_stream_to_string(frame.get_profile().stream_type()),
+            frame.get_profile().stream_index(),
+            rs2_timestamp_domain_to_string(frame.get_frame_timestamp_domain()));
+
+            auto stream_index = (stream == GYRO.first) ? GYRO : ACCEL;
+            auto axes = *(reinterpret_cast<const float3 *>(frame.get_data()));
+            if (GYRO == stream_index) {
+              _gyro_norm = std::sqrt(axes.x * axes.x + axes.y * axes.y + axes.z * axes.z);
+            }
+            _seq[stream_index] += 1;
+
+            // The raw topic costs nothing without subscribers.
+            auto & publisher = _imu_publishers[stream_index];
+            if (0 != publisher->get_subscription_count()) {
+              publishImuSample(publisher, stream_index, frame.get_timestamp(), axes);
+            }
+
+            auto decimated = _imu_decimated_publishers.find(stream_index);
+            if (decimated != _imu_decimated_publishers.end()) {
+              // Boxcar low-pass and decimation: every factor samples are averaged into one.
+              auto & decimator = _imu_decimators[stream_index];
+              decimator.sum[0] += axes.x;
+              decimator.sum[1] += axes.y;
+              decimator.sum[2] += axes.z;
+              decimator.timestamp_sum += frame.get_timestamp();
+              if (++decimator.count == decimator.factor) {
+                float3 mean{
+                  static_cast<float>(decimator.sum[0] / decimator.factor),
+                  static_cast<float>(decimator.sum[1] / decimator.factor),
+                  static_cast<float>(decimator.sum[2] / decimator.factor)};
+                // Stamped at the center of the averaged samples, which removes the group delay.
+                publishImuSample(decimated->second, stream_index,
+                  decimator.timestamp_sum / decimator.factor, mean);
+                decimator.sum[0] = decimator.sum[1] = decimator.sum[2] = 0.0;
+                decimator.timestamp_sum = 0.0;
+                decimator.count = 0;
+              }
+            }
+          };
+
+        if (true == _enable[GYRO]) {
+          RCLCPP_INFO(logger_, "%s stream is enabled - fps: %d", _stream_name[GYRO].c_str(),
+            _fps[GYRO]);
+          auto gyroInfo = getImuInfo(GYRO);
+          _imu_info_publisher[GYRO]->publish(gyroInfo);
+        }
+
+        if (true == _enable[ACCEL]) {
+          RCLCPP_INFO(logger_, "%s stream is enabled - fps: %d",
+            _stream_name[ACCEL].c_str(), _fps[ACCEL]);
+          auto accelInfo = getImuInfo(ACCEL);
+          _imu_info_publisher[ACCEL]->publish(accelInfo);
+        }
+      }
+
+
+      if (_accumulate) {
+        _accumulator.reset(_accumulate_max_voxels, _accumulate_voxel_size);
+        _gyro_to_depth = Eigen::Matrix3f::Identity();
+        if (_enabled_profiles.find(GYRO) != _enabled_profiles.end() && _enable[DEPTH]) {
+          auto ex = getRsExtrinsics(GYRO, DEPTH);
+          _gyro_to_depth = Eigen::Map<Eigen::Matrix3f>(ex.rotation);
+        } else {
+          RCLCPP_WARN(logger_, "Gyro is not available, accumulated point cloud is not "
+            "motion compensated");
+        }
+        RCLCPP_INFO(logger_, "Point cloud accumulation is enabled - voxel arena: %d voxels",
+          _accumulate_max_voxels);
+      }
+
+      if (true == _enable[DEPTH] &&
+        true == _enable[FISHEYE])
+      {
+        auto ex = getFisheye2DepthExtrinsicsMsg();
+        _fe_to_depth_publisher->publish(ex);
+      }
+
+      if (true == _enable[FISHEYE] &&
+        (_enable[GYRO] || _enable[ACCEL]))
+      {
+        auto ex = getFisheye2ImuExtrinsicsMsg();
+        _fe_to_imu_publisher->publish(ex);
+      }
+    } catch (const std::exception & ex) {
+      RCLCPP_ERROR(logger_, "An exception has been thrown: %s", ex.what());
+      throw;
+    } catch (...) {
+      RCLCPP_ERROR(logger_, "Unknown exception has occured!");
+      throw;
+    }
+  }
+
+  // Sync groups are declared as "depth+color;infra1+infra2". Each group has its own syncer,
+  // so a group only waits for its own streams; groups must be disjoint, a stream listed in two
+  // groups fails the configuration. Without an explicit declaration depth and color are
+  // paired when a product needs both of them. Streams outside all groups bypass the syncers
+  // and are published as soon as they arrive.
+  void parseSyncGroups()
+  {
+    auto groups = _sync_groups;
+    auto pairs_depth_color = _pointcloud || _pointcloud_bands || _align_depth ||
+      _color_aligned_to_depth;
+    if (groups.empty() && pairs_depth_color) {
+      groups = _stream_name[DEPTH] + "+" + _stream_name[COLOR];
+    }
+
+    _sync_group.clear();
+    _sync_group_count = 0;
+    std::stringstream groups_stream(groups);
+    std::string group;
+    while (std::getline(groups_stream, group, ';')) {
+      std::stringstream group_stream(group);
+      std::string name;
+      auto members = 0;
+      while (std::getline(group_stream, name, '+')) {
+        auto found = false;
+        for (auto & streams : IMAGE_STREAMS) {
+          for (auto & elem : streams) {
+            if (_stream_name[elem] != name) {
+              continue;
+            }
+            found = true;
+            if (_sync_group.count(elem)) {
+              throw std::runtime_error("Stream \"" + name + "\" of sync group \"" + group +
+                      "\" is already in an earlier sync group, sync groups must be disjoint");
+            }
+            _sync_group[elem] = _sync_group_count;
+            ++members;
+          }
+        }
+        if (!found && !name.empty()) {
+          RCLCPP_WARN(logger_, "Unknown stream \"%s\" in sync_groups is ignored", name.c_str());
+        }
+      }
+      if (members > 0) {
+        ++_sync_group_count;
+      }
+    }
+
+    _sync_frames = !_sync_group.empty();
+    if (pairs_depth_color &&
+      (!_sync_group.count(DEPTH) || !_sync_group.count(COLOR) ||
+      _sync_group[DEPTH] != _sync_group[COLOR]))
+    {
+      RCLCPP_WARN(logger_,
+        "Depth and color are not in a sync group, "
+        "point clouds and aligned depth are not published");
+    }
+  }
+
+  bool isSynced(const rs2::frame & frame)
+  {
+    auto profile = frame.get_profile();
+    return syncGroup(stream_index_pair{profile.stream_type(), profile.stream_index()}) >= 0;
+  }
+
+  // Sync group of stream, -1 when it is not synced.
+  int syncGroup(const stream_index_pair & stream) const
+  {
+    auto it = _sync_group.find(stream);
+    return it != _sync_group.end() ? it->second : -1;
+  }
+
+  void startStreams()
+  {
+    for (auto & stream : _opened_sensors) {
+      auto & sens = _sensors[stream];
+      if (GYRO == stream) {
+        sens->start(_imu_callback);
+      } else if (!_trigger_stop_sensors) {
+        // Otherwise the image sensors are started by each trigger.
+        sens->start(_route_callback);
+      }
+    }
+    _streaming = true;
+  }
+
+  void stopStreams()
+  {
+    for (auto & stream : _opened_sensors) {
+      if (GYRO == stream || !_trigger_stop_sensors) {
+        _sensors[stream]->stop();
+      }
+    }
+    _streaming = false;
+  }
+
+  void closeStreams()
+  {
+    for (auto & stream : _opened_sensors) {
+      _sensors[stream]->close();
+    }
+    _opened_sensors.clear();
+  }
+
+  void updateStreamCalibData(const rs2::video_stream_profile & video_profile)
+  {
+    stream_index_pair stream_index{video_profile.stream_type(), video_profile.stream_index()};
+    auto intrinsic = video_profile.get_intrinsics();
+    _stream_intrinsics[stream_index] = intrinsic;
+
+    _camera_info[stream_index].width = intrinsic.width;
+    _camera_info[stream_index].height = intrinsic.height;
+    _camera_info[stream_index].header.frame_id = _optical_frame_id[stream_index];
+
+    _camera_info[stream_index].k.at(0) = intrinsic.fx;
+    _camera_info[stream_index].k.at(2) = intrinsic.ppx;
+    _camera_info[stream_index].k.at(4) = intrinsic.fy;
+    _camera_info[stream_index].k.at(5) = intrinsic.ppy;
+    _camera_info[stream_index].k.at(8) = 1;
+
+    _camera_info[stream_index].p.at(0) = _camera_info[stream_index].k.at(0);
+    _camera_info[stream_index].p.at(1) = 0;
+    _camera_info[stream_index].p.at(2) = _camera_info[stream_index].k.at(2);
+    _camera_info[stream_index].p.at(3) = 0;
+    _camera_info[stream_index].p.at(4) = 0;
+    _camera_info[stream_index].p.at(5) = _camera_info[stream_index].k.at(4);
+    _camera_info[stream_index].p.at(6) = _camera_info[stream_index].k.at(5);
+    _camera_info[stream_index].p.at(7) = 0;
+    _camera_info[stream_index].p.at(8) = 0;
+    _camera_info[stream_index].p.at(9) = 0;
+    _camera_info[stream_index].p.at(10) = 1;
+    _camera_info[stream_index].p.at(11) = 0;
+
+
+    // Why Depth to Color?
+    if (stream_index == DEPTH && _enable[DEPTH] && _enable[COLOR]) {
+      rs2::stream_profile depth_profile;
+      if (!getEnabledProfile(DEPTH, depth_profile)) {
+        throw std::runtime_error("Depth profile not found!");
+      }
+      _depth2color_extrinsics = depth_profile.get_extrinsics_to(_enabled_profiles[COLOR].front());
+      // set depth to color translation values in Projection matrix (P)
+      _camera_info[stream_index].p.at(3) = _depth2color_extrinsics.translation[0];             // Tx
+      _camera_info[stream_index].p.at(7) = _depth2color_extrinsics.translation[1];             // Ty
+      _camera_info[stream_index].p.at(11) = _depth2color_extrinsics.translation[2];            // Tz
+    }
+
+    _camera_info[stream_index].distortion_model = "plumb_bob";
+
+    // set R (rotation matrix) values to identity matrix
+    _camera_info[stream_index].r.at(0) = 1.0;
+    _camera_info[stream_index].r.at(1) = 0.0;
+    _camera_info[stream_index].r.at(2) = 0.0;
+    _camera_info[stream_index].r.at(3) = 0.0;
+    _camera_info[stream_index].r.at(4) = 1.0;
+    _camera_info[stream_index].r.at(5) = 0.0;
+    _camera_info[stream_index].r.at(6) = 0.0;
+    _camera_info[stream_index].r.at(7) = 0.0;
+    _camera_info[stream_index].r.at(8) = 1.0;
+
+    for (int i = 0; i < 5; i++) {
+      _camera_info[stream_index].d.push_back(intrinsic.coeffs[i]);
+    }
+
+    if (_serialized_publish) {
+      // Created here: the frame callbacks only patch its stamp.
+      rclcpp::SerializedMessage serialized;
+      rclcpp::Serialization<sensor_msgs::msg::CameraInfo> serializer;
+      serializer.serialize_message(&_camera_info[stream_index], &serialized);
+      _camera_info_serialized[stream_index] = std::move(serialized);
+    }
+  }
+
+  Eigen::Quaternionf rotationMatrixToQuaternion(float rotation[9]) const
+  {
+    Eigen::Matrix3f m;
+    m << rotation[0], rotation[1], rotation[2],
+      rotation[3], rotation[4], rotation[5],
+      rotation[6], rotation[7], rotation[8];
+    Eigen::Quaternionf q(m);
+    return q;
+  }
+
+  void publishStaticTransforms()
+  {
+    std::lock_guard<std::mutex> lock(_transition_mutex);
+    RCLCPP_DEBUG(logger_, "publishStaticTransforms...");
+    // Publish transforms for the cameras
+    tf2::Quaternion q_c2co;
+    geometry_msgs::msg::TransformStamped b2c_msg;         // Base to Color
+    geometry_msgs::msg::TransformStamped c2co_msg;         // Color to Color_Optical
+
+    tf2::Quaternion q_d2do;
+    geometry_msgs::msg::TransformStamped b2d_msg;         // Base to Depth
+    geometry_msgs::msg::TransformStamped d2do_msg;         // Depth to Depth_Optical
+
+    tf2::Quaternion ir1_2_ir1o;
+    geometry_msgs::msg::TransformStamped b2ir1_msg;         // Base to IR1
+    geometry_msgs::msg::TransformStamped ir1_2_ir1o_msg;         // IR1 to IR1_Optical
+
+    tf2::Quaternion ir2_2_ir2o;
+    geometry_msgs::msg::TransformStamped b2ir2_msg;         // Base to IR2
+    geometry_msgs::msg::TransformStamped ir2_2_ir2o_msg;         // IR2 to IR2_Optical
+
+    // Get the current timestamp for all static transforms
+    rclcpp::Time transform_ts_ = _ros_clock.now();
+
+    // The depth frame is used as the base frame.
+    // Hence no additional transformation is done from base frame to depth frame.
+    // Transform base frame to depth frame
+    b2d_msg.header.stamp = transform_ts_;
+    b2d_msg.header.frame_id = _base_frame_id;
+    b2d_msg.child_frame_id = _frame_id[DEPTH];
+    b2d_msg.transform.translation.x = 0;
+    b2d_msg.transform.translation.y = 0;
+    b2d_msg.transform.translation.z = 0;
+    b2d_msg.transform.rotation.x = 0;
+    b2d_msg.transform.rotation.y = 0;
+    b2d_msg.transform.rotation.z = 0;
+    b2d_msg.transform.rotation.w = 1;
+    _static_tf_broadcaster_->sendTransform(b2d_msg);
+
+    // Transform depth frame to depth optical frame
+    q_d2do.setRPY(-M_PI / 2, 0.0, -M_PI / 2);
+    d2do_msg.header.stamp = transform_ts_;
+    d2do_msg.header.frame_id = _frame_id[DEPTH];
+    d2do_msg.child_frame_id = _optical_frame_id[DEPTH];
+    d2do_msg.transform.translation.x = 0;
+    d2do_msg.transform.translation.y = 0;
+    d2do_msg.transform.translation.z = 0;
+    d2do_msg.transform.rotation.x = q_d2do.getX();
+    d2do_msg.transform.rotation.y = q_d2do.getY();
+    d2do_msg.transform.rotation.z = q_d2do.getZ();
+    d2do_msg.transform.rotation.w = q_d2do.getW();
+    _static_tf_broadcaster_->sendTransform(d2do_msg);
+
+
+    if (true == _enable[COLOR]) {
+      // Transform base frame to color frame
+      auto q = rotationMatrixToQuaternion(_depth2color_extrinsics.rotation);
+
+      b2c_msg.header.stamp = transform_ts_;
+      b2c_msg.header.frame_id = _base_frame_id;
+      b2c_msg.child_frame_id = _frame_id[COLOR];
+      b2c_msg.transform.translation.x = _depth2color_extrinsics.translation[2];
+      b2c_msg.transform.translation.y = -_depth2color_extrinsics.translation[0];
+      b2c_msg.transform.translation.z = -_depth2color_extrinsics.translation[1];
+      b2c_msg.transform.rotation.x = q.x();
+      b2c_msg.transform.rotation.y = q.y();
+      b2c_msg.transform.rotation.z = q.z();
+      b2c_msg.transform.rotation.w = q.w();
+      _static_tf_broadcaster_->sendTransform(b2c_msg);
+
+      // Transform color frame to color optical frame
+      q_c2co.setRPY(-M_PI / 2, 0.0, -M_PI / 2);
+      c2co_msg.header.stamp = transform_ts_;
+      c2co_msg.header.frame_id = _frame_id[COLOR];
+      c2co_msg.child_frame_id = _optical_frame_id[COLOR];
+      c2co_msg.transform.translation.x = 0;
+      c2co_msg.transform.translation.y = 0;
+      c2co_msg.transform.translation.z = 0;
+      c2co_msg.transform.rotation.x = q_c2co.getX();
+      c2co_msg.transform.rotation.y = q_c2co.getY();
+      c2co_msg.transform.rotation.z = q_c2co.getZ();
+      c2co_msg.transform.rotation.w = q_c2co.getW();
+      _static_tf_broadcaster_->sendTransform(c2co_msg);
+    }
+
+    if (_enable[DEPTH]) {
+      rs2::stream_profile depth_profile;
+      if (!getEnabledProfile(DEPTH, depth_profile)) {
+        RCLCPP_ERROR(logger_, "Depth profile not found!");
+        rclcpp::shutdown();
+        exit(1);
+      }
+      if (true == _enable[INFRA1]) {
+        auto d2ir1_extrinsics = depth_profile.get_extrinsics_to(_enabled_profiles[INFRA1].front());
+        auto q = rotationMatrixToQuaternion(d2ir1_extrinsics.rotation);
+
+        // Transform base frame to infra1
+        b2ir1_msg.header.stamp = transform_ts_;
+        b2ir1_msg.header.frame_id = _base_frame_id;
+        b2ir1_msg.child_frame_id = _frame_id[INFRA1];
+        b2ir1_msg.transform.translation.x = d2ir1_extrinsics.translation[2];
+        b2ir1_msg.transform.translation.y = -d2ir1_extrinsics.translation[0];
+        b2ir1_msg.transform.translation.z = -d2ir1_extrinsics.translation[1];
+
+        b2ir1_msg.transform.rotation.x = q.x();
+        b2ir1_msg.transform.rotation.y = q.y();
+        b2ir1_msg.transform.rotation.z = q.z();
+        b2ir1_msg.transform.rotation.w = q.w();
+        _static_tf_broadcaster_->sendTransform(b2ir1_msg);
+
+        // Transform infra1 frame to infra1 optical frame
+        ir1_2_ir1o.setRPY(-M_PI / 2, 0.0, -M_PI / 2);
+        ir1_2_ir1o_msg.header.stamp = transform_ts_;
+        ir1_2_ir1o_msg.header.frame_id = _frame_id[INFRA1];
+        ir1_2_ir1o_msg.child_frame_id = _optical_frame_id[INFRA1];
+        ir1_2_ir1o_msg.transform.translation.x = 0;
+        ir1_2_ir1o_msg.transform.translation.y = 0;
+        ir1_2_ir1o_msg.transform.translation.z = 0;
+        ir1_2_ir1o_msg.transform.rotation.x = ir1_2_ir1o.getX();
+        ir1_2_ir1o_msg.transform.rotation.y = ir1_2_ir1o.getY();
+        ir1_2_ir1o_msg.transform.rotation.z = ir1_2_ir1o.getZ();
+        ir1_2_ir1o_msg.transform.rotation.w = ir1_2_ir1o.getW();
+        _static_tf_broadcaster_->sendTransform(ir1_2_ir1o_msg);
+      }
 
-      auto frame_callback = [this](rs2::frame frame)
+      if (true == _enable[INFRA2]) {
+        auto d2ir2_extrinsics = depth_profile.get_extrinsics_to(_enabled_profiles[INFRA2].front());
+        auto q = rotationMatrixToQuaternion(d2ir2_extrinsics.rotation);
+
+        // Transform base frame to infra2
+        b2ir2_msg.header.stamp = transform_ts_;
+        b2ir2_msg.header.frame_id = _base_frame_id;
+        b2ir2_msg.child_frame_id = _frame_id[INFRA2];
+        b2ir2_msg.transform.translation.x = d2ir2_extrinsics.translation[2];
+        b2ir2_msg.transform.translation.y = -d2ir2_extrinsics.translation[0];
+        b2ir2_msg.transform.translation.z = -d2ir2_extrinsics.translation[1];
+        b2ir2_msg.transform.rotation.x = q.x();
+        b2ir2_msg.transform.rotation.y = q.y();
+        b2ir2_msg.transform.rotation.z = q.z();
+        b2ir2_msg.transform.rotation.w = q.w();
+        _static_tf_broadcaster_->sendTransform(b2ir2_msg);
+
+        // Transform infra2 frame to infra1 optical frame
+        ir2_2_ir2o.setRPY(-M_PI / 2, 0.0, -M_PI / 2);
+        ir2_2_ir2o_msg.header.stamp = transform_ts_;
+        ir2_2_ir2o_msg.header.frame_id = _frame_id[INFRA2];
+        ir2_2_ir2o_msg.child_frame_id = _optical_frame_id[INFRA2];
+        ir2_2_ir2o_msg.transform.translation.x = 0;
+        ir2_2_ir2o_msg.transform.translation.y = 0;
+        ir2_2_ir2o_msg.transform.translation.z = 0;
+        ir2_2_ir2o_msg.transform.rotation.x = ir2_2_ir2o.getX();
+        ir2_2_ir2o_msg.transform.rotation.y = ir2_2_ir2o.getY();
+        ir2_2_ir2o_msg.transform.rotation.z = ir2_2_ir2o.getZ();
+        ir2_2_ir2o_msg.transform.rotation.w = ir2_2_ir2o.getW();
+        _static_tf_broadcaster_->sendTransform(ir2_2_ir2o_msg);
+      }
+    }
+    // Publish Fisheye TF
+  }
+
+  void setupProcessingPool()
+  {
+    if (_upsample_depth || _tsdf || _hole_filling || (_align_depth &&
+      ("zbuffer" == _registration_engine || _registration_benchmark)))
+    {
+      auto threads = _processing_threads;
+      if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+      }
+      _processing_pool.resize(threads);
+      RCLCPP_INFO(logger_, "Processing pool: %d threads", _processing_pool.size());
+    }
+  }
+
+  // Prepare the z-buffered depth to color registration: the depth pixel corner rays (for a
+  // depth of 1 m, deprojection is linear in depth for the depth camera distortion models),
+  // the z-buffer and the worker pool.
+  void setupRegistration()
+  {
+    _depth_to_color = getRsExtrinsics(DEPTH, COLOR);
+    auto & depth_intrin = _stream_intrinsics[DEPTH];
+    auto & color_intrin = _stream_intrinsics[COLOR];
+
+    _registration_rays.resize(2 * (depth_intrin.width + 1) * (depth_intrin.height + 1));
+    auto ray = _registration_rays.data();
+    for (int y = 0; y <= depth_intrin.height; ++y) {
+      for (int x = 0; x <= depth_intrin.width; ++x) {
+        float pixel[2] = {x - 0.5f, y - 0.5f};
+        float point[3];
+        rs2_deproject_pixel_to_point(point, &depth_intrin, pixel, 1.f);
+        *ray++ = point[0];
+        *ray++ = point[1];
+      }
+    }
+
+    auto color_pixels = color_intrin.width * color_intrin.height;
+    _registration_zbuffer.reset(new std::atomic<uint16_t>[color_pixels]);
+    _registered_depth.resize(color_pixels);
+    RCLCPP_INFO(logger_, "Depth registration engine: %s", _registration_engine.c_str());
+  }
+
+  // Register depth onto the color image. Every depth pixel is splatted over the color pixels
+  // covered by its footprint, and each color pixel keeps the nearest depth (atomic min), so
+  // background never bleeds over foreground edges. Single pixel splat holes are filled from
+  // their neighbours. The result is in depth units, like rs2::align.
+  void registerDepth(const rs2::depth_frame & depth_frame)
+  {
+    auto depth = reinterpret_cast<const uint16_t *>(depth_frame.get_data());
+    auto & depth_intrin = _stream_intrinsics[DEPTH];
+    auto & color_intrin = _stream_intrinsics[COLOR];
+    auto tasks = _processing_pool.size() * 4;
+
+    _processing_pool.run(tasks, [&](int task) {
+        auto begin = color_intrin.height * task / tasks;
+        auto end = color_intrin.height * (task + 1) / tasks;
+        auto zbuffer = _registration_zbuffer.get();
+        for (int i = begin * color_intrin.width; i < end * color_intrin.width; ++i) {
+          zbuffer[i].store(std::numeric_limits<uint16_t>::max(), std::memory_order_relaxed);
+        }
+      });
+
+    _processing_pool.run(tasks, [&](int task) {
+        splatDepthRows(depth, depth_intrin.height * task / tasks,
+        depth_intrin.height * (task + 1) / tasks);
+      });
+
+    _processing_pool.run(tasks, [&](int task) {
+        resolveRegisteredRows(color_intrin.height * task / tasks,
+        color_intrin.height * (task + 1) / tasks);
+      });
+  }
+
+  void splatDepthRows(const uint16_t * depth, int row_begin, int row_end)
+  {
+    auto & depth_intrin = _stream_intrinsics[DEPTH];
+    auto & color_intrin = _stream_intrinsics[COLOR];
+    auto ray_stride = 2 * (depth_intrin.width + 1);
+    auto zbuffer = _registration_zbuffer.get();
+
+    for (int y = row_begin; y < row_end; ++y) {
+      auto row = depth + y * depth_intrin.width;
+      for (int x = 0; x < depth_intrin.width; ++x) {
+        auto value = row[x];
+        if (0 == value) {
+          continue;
+        }
+        auto z = value * _depth_scale_meters;
+
+        // Project the top-left and the bottom-right corners of the depth pixel
+        int corners[2][2];
+        for (int c = 0; c < 2; ++c) {
+          auto ray = _registration_rays.data() + (y + c) * ray_stride + 2 * (x + c);
+          float from_point[3] = {ray[0] * z, ray[1] * z, z};
+          float other_point[3], other_pixel[2];
+          rs2_transform_point_to_point(other_point, &_depth_to_color, from_point);
+          rs2_project_point_to_pixel(other_pixel, &color_intrin, other_point);
+          corners[c][0] = static_cast<int>(other_pixel[0] + 0.5f);
+          corners[c][1] = static_cast<int>(other_pixel[1] + 0.5f);
+        }
+
+        if (corners[0][0] < 0 || corners[0][1] < 0 || corners[1][0] >= color_intrin.width ||
+          corners[1][1] >= color_intrin.height)
         {
-          // We compute a ROS timestamp which is based on an initial ROS time at point of first
-          // frame, and the incremental timestamp from the camera.
-          // In sync mode the timestamp is based on ROS time
-          if (false == _intialize_time_base) {
-            _intialize_time_base = true;
-            _ros_time_base = _ros_clock.now();
-            _camera_time_base = frame.get_timestamp();
+          continue;
+        }
+
+        for (int other_y = corners[0][1]; other_y <= corners[1][1]; ++other_y) {
+          auto cell = zbuffer + other_y * color_intrin.width;
+          for (int other_x = corners[0][0]; other_x <= corners[1][0]; ++other_x) {
+            auto current = cell[other_x].load(std::memory_order_relaxed);
+            while (value < current &&
+              !cell[other_x].compare_exchange_weak(current, value, std::memory_order_relaxed))
+            {
+            }
           }
+        }
+      }
+    }
+  }
 
-          rclcpp::Time t;
-          if (_sync_frames) {
-            t = _ros_clock.now();
-          } else {
-            uint64_t elapsed_camera_ns = (/*ms*/ frame.get_timestamp() - /*ms*/ _camera_time_base) *
-              1000000;
-            t = rclcpp::Time(_ros_time_base.nanoseconds() + elapsed_camera_ns, RCL_ROS_TIME);
+  void resolveRegisteredRows(int row_begin, int row_end)
+  {
+    static const uint16_t empty = std::numeric_limits<uint16_t>::max();
+    auto & color_intrin = _stream_intrinsics[COLOR];
+    auto width = color_intrin.width;
+    auto height = color_intrin.height;
+    auto zbuffer = _registration_zbuffer.get();
+
+    for (int y = row_begin; y < row_end; ++y) {
+      auto cell = zbuffer + y * width;
+      auto out = _registered_depth.data() + y * width;
+      for (int x = 0; x < width; ++x) {
+        auto value = cell[x].load(std::memory_order_relaxed);
+        if (empty == value && _registration_hole_fill) {
+          // A hole flanked on both sides: take the farther neighbour, so a fill never grows
+          // the foreground.
+          uint16_t a = empty, b = empty;
+          if (x > 0 && x < width - 1) {
+            a = cell[x - 1].load(std::memory_order_relaxed);
+            b = cell[x + 1].load(std::memory_order_relaxed);
           }
-          auto is_color_frame_arrived = false;
-          auto is_depth_frame_arrived = false;
-          rs2::frame depth_frame;
-          if (frame.is<rs2::frameset>()) {
-            RCLCPP_DEBUG(logger_, "Frameset arrived");
-            auto frameset = frame.as<rs2::frameset>();
-            for (auto it = frameset.begin(); it != frameset.end(); ++it) {
-              auto f = (*it);
-              auto stream_type = f.get_profile().stream_type();
-              if (RS2_STREAM_COLOR == stream_type) {
-                is_color_frame_arrived = true;
-              } else if (RS2_STREAM_DEPTH == stream_type) {
-                depth_frame = f;
-                is_depth_frame_arrived = true;
-              }
+          if ((empty == a || empty == b) && y > 0 && y < height - 1) {
+            a = cell[x - width].load(std::memory_order_relaxed);
+            b = cell[x + width].load(std::memory_order_relaxed);
+          }
+          if (empty != a && empty != b) {
+            value = std::max(a, b);
+          }
+        }
+        out[x] = (empty == value) ? 0 : value;
+      }
+    }
+  }
 
-              RCLCPP_DEBUG(logger_,
-                "Frameset contain %s frame. frame_number: %llu ; frame_TS: %f ; ros_TS(NSec): %lu",
-                rs2_stream_to_string(stream_type), frame.get_frame_number(),
-                frame.get_timestamp(), t.nanoseconds());
-              publishFrame(f, t);
-            }
+  // Cache, for every depth pixel, the projection into color as a function of its depth:
+  // u = (z * ax + bx) / (z * az + bz), v = (z * ay + by) / (z * az + bz). This is exact for an
+  // undistorted color stream; otherwise the generic rs2 projection is used per pixel.
+  void setupColorToDepth()
+  {
+    _depth_to_color = getRsExtrinsics(DEPTH, COLOR);
+    auto & depth_intrin = _stream_intrinsics[DEPTH];
+    auto & color_intrin = _stream_intrinsics[COLOR];
+    auto & r = _depth_to_color.rotation;
+    auto & tr = _depth_to_color.translation;
+
+    _color_to_depth_exact = true;
+    if (RS2_DISTORTION_NONE != color_intrin.model) {
+      for (auto coeff : color_intrin.coeffs) {
+        _color_to_depth_exact = _color_to_depth_exact && 0.f == coeff;
+      }
+    }
 
-            if (_align_depth && is_depth_frame_arrived && is_color_frame_arrived) {
-              RCLCPP_DEBUG(logger_, "publishAlignedDepthTopic(...)");
-              publishAlignedDepthImg(frame, t);
+    auto pixels = depth_intrin.width * depth_intrin.height;
+    for (auto coeffs : {&_color_to_depth_ax, &_color_to_depth_ay, &_color_to_depth_az}) {
+      coeffs->resize(pixels);
+    }
+    for (int y = 0; y < depth_intrin.height; ++y) {
+      for (int x = 0; x < depth_intrin.width; ++x) {
+        float pixel[2] = {static_cast<float>(x), static_cast<float>(y)};
+        float ray[3];
+        rs2_deproject_pixel_to_point(ray, &depth_intrin, pixel, 1.f);
+        // Rotated ray, the extrinsics rotation is column-major
+        float a[3];
+        for (int i = 0; i < 3; ++i) {
+          a[i] = r[i] * ray[0] + r[i + 3] * ray[1] + r[i + 6] * ray[2];
+        }
+        auto index = y * depth_intrin.width + x;
+        _color_to_depth_ax[index] = color_intrin.fx * a[0] + color_intrin.ppx * a[2];
+        _color_to_depth_ay[index] = color_intrin.fy * a[1] + color_intrin.ppy * a[2];
+        _color_to_depth_az[index] = a[2];
+      }
+    }
+    _color_to_depth_b[0] = color_intrin.fx * tr[0] + color_intrin.ppx * tr[2];
+    _color_to_depth_b[1] = color_intrin.fy * tr[1] + color_intrin.ppy * tr[2];
+    _color_to_depth_b[2] = tr[2];
+    RCLCPP_INFO(logger_, "Color aligned to depth is enabled (%s projection)",
+      _color_to_depth_exact ? "cached" : "distorted");
+  }
+
+  // Resample the color image onto the depth grid with bilinear sampling. Pixels without depth
+  // or projecting outside of the color image are black.
+  void publishColorAlignedToDepth(
+    const rs2::frame & depth_frame, const rs2::frame & color_frame,
+    const rclcpp::Time & t)
+  {
+    auto start = std::chrono::steady_clock::now();
+    auto & depth_intrin = _stream_intrinsics[DEPTH];
+    auto & color_intrin = _stream_intrinsics[COLOR];
+    auto depth = reinterpret_cast<const uint16_t *>(depth_frame.get_data());
+    auto color = reinterpret_cast<const uint8_t *>(color_frame.get_data());
+
+    auto img = std::make_shared<sensor_msgs::msg::Image>();
+    img->header.frame_id = _optical_frame_id[DEPTH];
+    img->header.stamp = t;
+    img->width = depth_intrin.width;
+    img->height = depth_intrin.height;
+    img->encoding = sensor_msgs::image_encodings::RGB8;
+    img->is_bigendian = false;
+    img->step = depth_intrin.width * 3;
+    img->data.resize(img->step * img->height);
+    auto out = img->data.data();
+
+    auto pixels = depth_intrin.width * depth_intrin.height;
+    float u[4], v[4];
+    for (int i = 0; i < pixels; i += 4) {
+      auto lanes = std::min(4, pixels - i);
+      projectDepthToColor(depth + i, i, lanes, u, v);
+      for (int lane = 0; lane < lanes; ++lane, out += 3) {
+        sampleBilinear(color, color_intrin.width, color_intrin.height,
+          depth[i + lane] ? u[lane] : -1.f, v[lane], out);
+      }
+    }
+
+    _color_to_depth_publisher.publish(img);
+    auto info_msg = _camera_info[DEPTH];
+    info_msg.header.stamp = t;
+    _color_to_depth_info_publisher->publish(info_msg);
+    recordProduct(PRODUCT_COLOR_TO_DEPTH, img->data.size(), start);
+
+    _color_to_depth_stats.add(elapsedMs(start));
+    if (_color_to_depth_stats.count() >= STATS_REPORT_FRAMES) {
+      RCLCPP_INFO(logger_, "Color aligned to depth over %d frames: mean %.2f ms, max %.2f ms",
+        _color_to_depth_stats.count(), _color_to_depth_stats.mean(), _color_to_depth_stats.max());
+      _color_to_depth_stats.reset();
+    }
+  }
+
+  // Color pixel coordinates of up to 4 depth pixels starting at index.
+  void projectDepthToColor(const uint16_t * depth, int index, int lanes, float * u, float * v)
+  {
+#ifdef __SSE2__
+    if (_color_to_depth_exact && 4 == lanes) {
+      auto z = _mm_mul_ps(
+        _mm_cvtepi32_ps(_mm_unpacklo_epi16(
+          _mm_loadl_epi64(reinterpret_cast<const __m128i *>(depth)), _mm_setzero_si128())),
+        _mm_set1_ps(_depth_scale_meters));
+      auto ax = _mm_loadu_ps(&_color_to_depth_ax[index]);
+      auto ay = _mm_loadu_ps(&_color_to_depth_ay[index]);
+      auto az = _mm_loadu_ps(&_color_to_depth_az[index]);
+      auto den = _mm_add_ps(_mm_mul_ps(z, az), _mm_set1_ps(_color_to_depth_b[2]));
+      _mm_storeu_ps(u, _mm_div_ps(
+          _mm_add_ps(_mm_mul_ps(z, ax), _mm_set1_ps(_color_to_depth_b[0])), den));
+      _mm_storeu_ps(v, _mm_div_ps(
+          _mm_add_ps(_mm_mul_ps(z, ay), _mm_set1_ps(_color_to_depth_b[1])), den));
+      return;
+    }
+#endif
+    auto & depth_intrin = _stream_intrinsics[DEPTH];
+    for (int lane = 0; lane < lanes; ++lane) {
+      auto z = depth[lane] * _depth_scale_meters;
+      auto i = index + lane;
+      if (_color_to_depth_exact) {
+        auto den = z * _color_to_depth_az[i] + _color_to_depth_b[2];
+        u[lane] = (z * _color_to_depth_ax[i] + _color_to_depth_b[0]) / den;
+        v[lane] = (z * _color_to_depth_ay[i] + _color_to_depth_b[1]) / den;
+      } else {
+        float pixel[2] = {static_cast<float>(i % depth_intrin.width),
+          static_cast<float>(i / depth_intrin.width)};
+        float depth_point[3], color_point[3], color_pixel[2];
+        rs2_deproject_pixel_to_point(depth_point, &depth_intrin, pixel, z);
+        rs2_transform_point_to_point(color_point, &_depth_to_color, depth_point);
+        rs2_project_point_to_pixel(color_pixel, &_stream_intrinsics[COLOR], color_point);
+        u[lane] = color_pixel[0];
+        v[lane] = color_pixel[1];
+      }
+    }
+  }
+
+  static void sampleBilinear(
+    const uint8_t * rgb, int width, int height, float u, float v, uint8_t * out)
+  {
+    // The negated comparisons also reject NaN coordinates.
+    if (!(u >= 0.f && v >= 0.f && u < width - 1 && v < height - 1)) {
+      out[0] = out[1] = out[2] = 0;
+      return;
+    }
+    auto x = static_cast<int>(u);
+    auto y = static_cast<int>(v);
+    // 8-bit fixed point weights
+    auto wx = static_cast<int>((u - x) * 256.f);
+    auto wy = static_cast<int>((v - y) * 256.f);
+    auto p00 = rgb + (y * width + x) * 3;
+    auto p10 = p00 + width * 3;
+    for (int c = 0; c < 3; ++c) {
+      auto top = p00[c] * (256 - wx) + p00[c + 3] * wx;
+      auto bottom = p10[c] * (256 - wx) + p10[c + 3] * wx;
+      out[c] = static_cast<uint8_t>((top * (256 - wy) + bottom * wy + (1 << 15)) >> 16);
+    }
+  }
+
+  void setupUpsampling()
+  {
+    auto radius = _upsample_radius;
+    _upsample_spatial_lut.resize(2 * radius + 1);
+    for (int k = -radius; k <= radius; ++k) {
+      _upsample_spatial_lut[k + radius] =
+        std::exp(-0.5 * k * k / (_upsample_sigma_spatial * _upsample_sigma_spatial));
+    }
+    for (int diff = 0; diff < 256; ++diff) {
+      _upsample_range_lut[diff] =
+        std::exp(-0.5 * diff * diff / (_upsample_sigma_color * _upsample_sigma_color));
+    }
+    RCLCPP_INFO(logger_, "Upsampled depth is enabled - radius: %d, budget: %.1f ms",
+      _upsample_radius, _upsample_budget_ms);
+  }
+
+  // Fill the holes of the depth aligned to color with a joint-bilateral filter guided by the
+  // color luma. The filter is separable: a horizontal pass keeps the normalized depth and its
+  // weight per pixel, and a vertical pass combines them for the holes only, so measured depth
+  // is never altered. Both passes run in row tiles on the processing pool. When the compute
+  // budget runs out the plain aligned depth is published instead.
+  void publishUpsampledDepth(const rs2::frame & color_frame, const rclcpp::Time & t)
+  {
+    static const int tile_rows = 32;
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double, std::milli>(_upsample_budget_ms));
+    auto width = _stream_intrinsics[COLOR].width;
+    auto height = _stream_intrinsics[COLOR].height;
+    auto pixels = width * height;
+    auto depth = _aligned_depth_data;
+    auto color = reinterpret_cast<const uint8_t *>(color_frame.get_data());
+    auto radius = _upsample_radius;
+
+    _upsample_luma.resize(pixels);
+    _upsample_value.resize(pixels);
+    _upsample_weight.resize(pixels);
+
+    auto img = std::make_shared<sensor_msgs::msg::Image>();
+    img->header.frame_id = _optical_frame_id[COLOR];
+    img->header.stamp = t;
+    img->width = width;
+    img->height = height;
+    img->encoding = sensor_msgs::image_encodings::TYPE_16UC1;
+    img->is_bigendian = false;
+    img->step = width * sizeof(uint16_t);
+    img->data.resize(img->step * height);
+    auto out = reinterpret_cast<uint16_t *>(img->data.data());
+
+    std::atomic<bool> over_budget{false};
+    auto tiles = (height + tile_rows - 1) / tile_rows;
+    _processing_pool.run(tiles, [&](int tile) {
+        if (std::chrono::steady_clock::now() > deadline) {
+          over_budget = true;
+          return;
+        }
+        for (int y = tile * tile_rows; y < std::min(height, (tile + 1) * tile_rows); ++y) {
+          auto rgb = color + y * width * 3;
+          auto luma = _upsample_luma.data() + y * width;
+          for (int x = 0; x < width; ++x, rgb += 3) {
+            luma[x] = static_cast<uint8_t>((rgb[0] * 77 + rgb[1] * 150 + rgb[2] * 29) >> 8);
+          }
+          auto row = depth + y * width;
+          for (int x = 0; x < width; ++x) {
+            float sum = 0.f, weight = 0.f;
+            for (int k = std::max(-radius, -x); k <= std::min(radius, width - 1 - x); ++k) {
+              if (row[x + k]) {
+                auto w = _upsample_spatial_lut[k + radius] *
+                  _upsample_range_lut[std::abs(luma[x] - luma[x + k])];
+                sum += w * row[x + k];
+                weight += w;
+              }
             }
+            _upsample_value[y * width + x] = (weight > 0.f) ? sum / weight : 0.f;
+            _upsample_weight[y * width + x] = weight;
+          }
+        }
+      });
 
-            if (_pointcloud && is_depth_frame_arrived && is_color_frame_arrived) {
-              RCLCPP_DEBUG(logger_, "publishPCTopic(...)");
-              publishPCTopic(t);
+    _processing_pool.run(tiles, [&](int tile) {
+        if (over_budget || std::chrono::steady_clock::now() > deadline) {
+          over_budget = true;
+          return;
+        }
+        for (int y = tile * tile_rows; y < std::min(height, (tile + 1) * tile_rows); ++y) {
+          for (int x = 0; x < width; ++x) {
+            auto i = y * width + x;
+            if (depth[i]) {
+              out[i] = depth[i];
+              continue;
             }
+            float sum = 0.f, weight = 0.f;
+            for (int k = std::max(-radius, -y); k <= std::min(radius, height - 1 - y); ++k) {
+              auto j = i + k * width;
+              auto w = _upsample_spatial_lut[k + radius] *
+                _upsample_range_lut[std::abs(_upsample_luma[i] - _upsample_luma[j])] *
+                _upsample_weight[j];
+              sum += w * _upsample_value[j];
+              weight += w;
+            }
+            out[i] = (weight > 0.f) ? static_cast<uint16_t>(sum / weight + 0.5f) : 0;
+          }
+        }
+      });
+
+    if (over_budget) {
+      // Fall back to the nearest aligned depth
+      memcpy(out, depth, pixels * sizeof(uint16_t));
+      ++_upsample_fallbacks;
+    }
+    _upsample_depth_publisher.publish(img);
+    recordProduct(PRODUCT_UPSAMPLED_DEPTH, img->data.size(), start);
+
+    _upsample_stats.add(elapsedMs(start));
+    if (_upsample_stats.count() >= STATS_REPORT_FRAMES) {
+      RCLCPP_INFO(logger_, "Depth upsampling over %d frames: mean %.2f ms, max %.2f ms, "
+        "%d over budget", _upsample_stats.count(), _upsample_stats.mean(),
+        _upsample_stats.max(), _upsample_fallbacks);
+      _upsample_stats.reset();
+      _upsample_fallbacks = 0;
+    }
+  }
+
+  rs2_extrinsics getRsExtrinsics(
+    const stream_index_pair & from_stream,
+    const stream_index_pair & to_stream)
+  {
+    auto & from = _enabled_profiles[from_stream].front();
+    auto & to = _enabled_profiles[to_stream].front();
+    return from.get_extrinsics_to(to);
+  }
+
+  void publishAlignedDepthImg(rs2::frame frame, const rclcpp::Time & t)
+  {
+    RT_AUDIT_SCOPE("publish_aligned_depth");
+    auto product_start = std::chrono::steady_clock::now();
+    auto width = _stream_intrinsics[COLOR].width;
+    auto height = _stream_intrinsics[COLOR].height;
+    auto bpp = static_cast<int>(sizeof(uint16_t));
+    auto zbuffer_engine = ("zbuffer" == _registration_engine);
+
+    if (zbuffer_engine || _registration_benchmark) {
+      auto start = std::chrono::steady_clock::now();
+      registerDepth(frame.as<rs2::frameset>().get_depth_frame());
+      _registration_stats.add(elapsedMs(start));
+      _aligned_depth_data = _registered_depth.data();
+    }
+    if (!zbuffer_engine || _registration_benchmark) {
+      auto start = std::chrono::steady_clock::now();
+      _aligned_frameset = frame.apply_filter(_align);
+      _align_stats.add(elapsedMs(start));
+      if (!zbuffer_engine) {
+        auto aligned_depth = _aligned_frameset.get_depth_frame();
+        width = aligned_depth.get_width();
+        height = aligned_depth.get_height();
+        bpp = aligned_depth.get_bytes_per_pixel();
+        _aligned_depth_data = reinterpret_cast<const uint16_t *>(aligned_depth.get_data());
+      }
+    }
+    RCLCPP_DEBUG(logger_, "aligned done!");
+
+    if (_registration_benchmark && _registration_stats.count() >= STATS_REPORT_FRAMES) {
+      RCLCPP_INFO(logger_, "Depth registration over %d frames: zbuffer mean %.2f ms "
+        "(max %.2f ms), rs2::align mean %.2f ms (max %.2f ms)", _registration_stats.count(),
+        _registration_stats.mean(), _registration_stats.max(), _align_stats.mean(),
+        _align_stats.max());
+      _registration_stats.reset();
+      _align_stats.reset();
+    }
+
+    auto depth_image = cv::Mat(cv::Size(width, height), _image_format[DEPTH],
+        const_cast<uint16_t *>(_aligned_depth_data), cv::Mat::AUTO_STEP);
+
+    sensor_msgs::msg::Image::SharedPtr img;
+    auto info_msg = _camera_info[DEPTH];
+    img = cv_bridge::CvImage(
+      std_msgs::msg::Header(), sensor_msgs::image_encodings::TYPE_16UC1, depth_image).toImageMsg();
+    img->width = width;
+    img->height = height;
+    img->is_bigendian = false;
+    img->step = width * bpp;
+    img->header.frame_id = _optical_frame_id[COLOR];
+    img->header.stamp = t;
+    _align_depth_publisher.publish(img);
+    _align_depth_camera_publisher->publish(info_msg);
+    recordProduct(PRODUCT_ALIGNED_DEPTH, img->data.size(), product_start);
+  }
 
-            if (_align_depth && _align_pointcloud && is_depth_frame_arrived &&
-              is_color_frame_arrived)
-            {
-              RCLCPP_DEBUG(logger_, "publishAlignedPCTopic(...)");
-              publishAlignedPCTopic(t);
-            }
+  // Decide whether the products of this depth frame should be published. A sparse grid of
+  // depth rows is compared against the last published keyframe; the frame is suppressed when
+  // the scene is static (and the camera is not rotating) unless the keyframe heartbeat is due.
+  bool passChangeGate(const rs2::frame & depth_frame)
+  {
+    auto vf = depth_frame.as<rs2::video_frame>();
+    auto width = vf.get_width();
+    auto height = vf.get_height();
+    auto depth = reinterpret_cast<const uint16_t *>(vf.get_data());
+    auto step = _change_gate_grid_step;
+    auto sampled_rows = (height + step - 1) / step;
+    auto now = std::chrono::steady_clock::now();
+
+    ++_gate_frames;
+    auto changed = 0;
+    auto is_keyframe_due = true;
+    if (_gate_reference.size() == static_cast<size_t>(sampled_rows * width)) {
+      auto delta = static_cast<uint16_t>(std::min(65535.0,
+        _change_gate_depth_delta / _depth_scale_meters));
+      for (int r = 0; r < sampled_rows; ++r) {
+        changed += countChangedSamples(depth + r * step * width, &_gate_reference[r * width],
+            width, delta);
+      }
+      is_keyframe_due = std::chrono::duration<double>(now - _gate_last_keyframe).count() >=
+        _change_gate_keyframe_period;
+    } else {
+      _gate_reference.resize(sampled_rows * width);
+      _gate_report_start = now;
+    }
 
-          } else {
-            auto stream_type = frame.get_profile().stream_type();
-            RCLCPP_DEBUG(logger_,
-              "%s video frame arrived. frame_number: %llu ; frame_TS: %f ; ros_TS(NSec): %lu",
-              rs2_stream_to_string(stream_type), frame.get_frame_number(),
-              frame.get_timestamp(), t.nanoseconds());
-            publishFrame(frame, t);
-          }
-        };
+    auto is_moving = _change_gate_gyro_threshold > 0.0 &&
+      _gyro_norm.load() > _change_gate_gyro_threshold;
+    auto is_static = !is_moving &&
+      changed <= _change_gate_changed_ratio * sampled_rows * width;
 
-      // Streaming IMAGES
-      for (auto & streams : IMAGE_STREAMS) {
-        std::vector<rs2::stream_profile> profiles;
-        for (auto & elem : streams) {
-          if (!_enabled_profiles[elem].empty()) {
-            profiles.insert(profiles.begin(),
-              _enabled_profiles[elem].begin(),
-              _enabled_profiles[elem].end());
-          }
-        }
+    auto publish = !is_static || is_keyframe_due;
+    if (publish) {
+      for (int r = 0; r < sampled_rows; ++r) {
+        memcpy(&_gate_reference[r * width], depth + r * step * width, width * sizeof(uint16_t));
+      }
+      _gate_last_keyframe = now;
+    } else {
+      ++_gate_suppressed;
+      _gate_bytes_saved += gatedBytesPerFrame();
+    }
 
-        if (!profiles.empty()) {
-          auto stream = streams.front();
-          auto & sens = _sensors[stream];
-          sens->open(profiles);
+    if (_gate_frames >= STATS_REPORT_FRAMES) {
+      auto period = std::chrono::duration<double>(now - _gate_report_start).count();
+      RCLCPP_INFO(logger_,
+        "Change gate: suppressed %d of %d depth frames, saved %.1f MB (%.2f MB/s)",
+        _gate_suppressed, _gate_frames, _gate_bytes_saved / 1e6,
+        (period > 0.0) ? _gate_bytes_saved / 1e6 / period : 0.0);
+      _gate_frames = 0;
+      _gate_suppressed = 0;
+      _gate_bytes_saved = 0.0;
+      _gate_report_start = now;
+    }
+    return publish;
+  }
 
-          if (DEPTH == stream) {
-            auto depth_sensor = sens->as<rs2::depth_sensor>();
-            _depth_scale_meters = depth_sensor.get_depth_scale();
-          }
+  // Bytes that the gated depth products would have put on the wire for a single frame.
+  double gatedBytesPerFrame()
+  {
+    static const auto point_step = static_cast<double>(XYZRGB_POINT_STEP);
+    auto depth_pixels = static_cast<double>(_stream_intrinsics[DEPTH].width) *
+      _stream_intrinsics[DEPTH].height;
+    auto color_pixels = static_cast<double>(_stream_intrinsics[COLOR].width) *
+      _stream_intrinsics[COLOR].height;
+    auto bytes = depth_pixels * sizeof(uint16_t);
+    if (_pointcloud) {
+      bytes += depth_pixels * point_step;
+    }
+    if (_pointcloud_bands) {
+      bytes += depth_pixels * point_step;
+    }
+    if (_align_depth) {
+      bytes += color_pixels * sizeof(uint16_t);
+    }
+    if (_align_depth && _align_pointcloud) {
+      bytes += color_pixels * point_step;
+    }
+    return bytes;
+  }
 
-          if (_sync_frames) {
-            sens->start(_syncer);
-          } else {
-            sens->start(frame_callback);
-          }
+  // Rotation of the depth camera between the previously integrated gyro sample and frame_ts,
+  // expressed as the current camera orientation in the previous camera frame.
+  Eigen::Matrix3f integrateGyro(double frame_ts)
+  {
+    Eigen::Matrix3f rotation = Eigen::Matrix3f::Identity();
+    GyroSample * sample;
+    while ((sample = _gyro_samples.front()) != nullptr && sample->timestamp <= frame_ts) {
+      if (_last_gyro_ts > 0.0 && sample->timestamp > _last_gyro_ts) {
+        auto dt = std::min(sample->timestamp - _last_gyro_ts, 100.0) / 1000.0;
+        Eigen::Vector3f omega = _gyro_to_depth * Eigen::Vector3f(sample->x, sample->y, sample->z);
+        auto angle = omega.norm() * dt;
+        if (angle > 0.f) {
+          rotation = rotation * Eigen::AngleAxisf(angle, omega.normalized()).toRotationMatrix();
         }
-      }          // end for
-
-      if (_sync_frames) {
-        _syncer.start(frame_callback);
       }
+      _last_gyro_ts = std::max(_last_gyro_ts, sample->timestamp);
+      _gyro_samples.pop();
+    }
+    return rotation;
+  }
 
-      // Streaming HID
-      for (const auto streams : HID_STREAMS) {
-        for (auto & elem : streams) {
-          if (true == _enable[elem]) {
-            auto & sens = _sensors[elem];
-            auto profiles = sens->get_stream_profiles();
-            for (rs2::stream_profile & profile : profiles) {
-              if (profile.fps() == _fps[elem] &&
-                profile.format() == _format[elem])
-              {
-                _enabled_profiles[elem].push_back(profile);
-                break;
-              }
-            }
-          }
+  void accumulatePointCloud(const rs2::frame & depth_frame, const rclcpp::Time & t)
+  {
+    auto start = std::chrono::steady_clock::now();
+    auto depth_intrinsics = _stream_intrinsics[DEPTH];
+    auto depth = reinterpret_cast<const uint16_t *>(depth_frame.get_data());
+    auto step = _accumulate_pixel_step;
+
+    // Previous observations move opposite to the camera rotation.
+    Eigen::Matrix3f rotation = integrateGyro(depth_frame.get_timestamp()).transpose();
+    _accumulator.advance(rotation, _accumulate_decay, _accumulate_min_weight);
+
+    float depth_point[3];
+    for (int y = 0; y < depth_intrinsics.height; y += step) {
+      for (int x = 0; x < depth_intrinsics.width; x += step) {
+        auto scaled_depth = depth[y * depth_intrinsics.width + x] * _depth_scale_meters;
+        if (scaled_depth <= 0.f || scaled_depth > _accumulate_max_depth) {
+          continue;
         }
+        float depth_pixel[2] = {static_cast<float>(x), static_cast<float>(y)};
+        rs2_deproject_pixel_to_point(depth_point, &depth_intrinsics, depth_pixel, scaled_depth);
+        _accumulator.insert(Eigen::Vector3f(depth_point[0], depth_point[1], depth_point[2]));
       }
+    }
 
-      auto gyro_profile = _enabled_profiles.find(GYRO);
-      auto accel_profile = _enabled_profiles.find(ACCEL);
+    auto now = std::chrono::steady_clock::now();
+    if (std::chrono::duration<double>(now - _accumulate_last_publish).count() <
+      1.0 / _accumulate_publish_rate)
+    {
+      return;
+    }
+    _accumulate_last_publish = now;
 
-      if (gyro_profile != _enabled_profiles.end() &&
-        accel_profile != _enabled_profiles.end())
-      {
-        std::vector<rs2::stream_profile> profiles;
-        profiles.insert(profiles.begin(), gyro_profile->second.begin(), gyro_profile->second.end());
-        profiles.insert(profiles.begin(), accel_profile->second.begin(),
-          accel_profile->second.end());
-        auto & sens = _sensors[GYRO];
-        sens->open(profiles);
+    sensor_msgs::msg::PointCloud2 msg_pointcloud;
+    msg_pointcloud.header.stamp = t;
+    msg_pointcloud.header.frame_id = _optical_frame_id[DEPTH];
+    msg_pointcloud.height = 1;
+    msg_pointcloud.is_dense = true;
+    sensor_msgs::PointCloud2Modifier modifier(msg_pointcloud);
+    modifier.setPointCloud2FieldsByString(1, "xyz");
+    modifier.resize(_accumulator.size());
 
-        sens->start([this](rs2::frame frame) {
-            auto stream = frame.get_profile().stream_type();
-            if (false == _intialize_time_base) {
-              return;
-            }
+    sensor_msgs::PointCloud2Iterator<float> iter_x(msg_pointcloud, "x");
+    sensor_msgs::PointCloud2Iterator<float> iter_y(msg_pointcloud, "y");
+    sensor_msgs::PointCloud2Iterator<float> iter_z(msg_pointcloud, "z");
+    for (size_t i = 0; i < _accumulator.size(); ++i) {
+      auto & point = _accumulator[i].point;
+      *iter_x = point.x();
+      *iter_y = point.y();
+      *iter_z = point.z();
+      ++iter_x; ++iter_y; ++iter_z;
+    }
+    _accumulate_publisher->publish(msg_pointcloud);
+    recordProduct(PRODUCT_ACCUMULATED_POINTCLOUD, msg_pointcloud.data.size(), start);
+    RCLCPP_DEBUG(logger_, "Accumulated point cloud published: %zu of %zu voxels",
+      _accumulator.size(), _accumulator.capacity());
+  }
 
-            RCLCPP_DEBUG(logger_, "Frame arrived: stream: %s ; index: %d ; Timestamp Domain: %s",
-            rs2_stream_to_string(frame.get_profile().stream_type()),
-            frame.get_profile().stream_index(),
-            rs2_timestamp_domain_to_string(frame.get_frame_timestamp_domain()));
+  // Deprojection of every pixel center for a depth of 1 m: a point is the ray times z.
+  void setupRays(const rs2_intrinsics & intrinsics, std::vector<float> & rays)
+  {
+    rays.resize(2 * intrinsics.width * intrinsics.height);
+    auto ray = rays.data();
+    for (int y = 0; y < intrinsics.height; ++y) {
+      for (int x = 0; x < intrinsics.width; ++x) {
+        float pixel[2] = {static_cast<float>(x), static_cast<float>(y)};
+        float point[3];
+        rs2_deproject_pixel_to_point(point, &intrinsics, pixel, 1.f);
+        *ray++ = point[0];
+        *ray++ = point[1];
+      }
+    }
+  }
 
-            auto stream_index = (stream == GYRO.first) ? GYRO : ACCEL;
-            // if (0 != _info_publisher[stream_index].getNumSubscribers() ||
-            //    0 != _imu_publishers[stream_index].getNumSubscribers())
-            {
-              uint64_t elapsed_camera_ns = (frame.get_timestamp() - _camera_time_base) * 1000000;
-              rclcpp::Time t(_ros_time_base.nanoseconds() + elapsed_camera_ns, RCL_ROS_TIME);
+  void setupTsdf()
+  {
+    _tsdf_volume.reset(_tsdf_max_blocks, _tsdf_voxel_size, _tsdf_truncation);
+    _tsdf_block_frame.assign(_tsdf_max_blocks, 0);
+    _tsdf_frame = 0;
+    _tsdf_pose_valid = false;
+    if (_tsdf_world_frame.empty()) {
+      _tsdf_world_frame = _base_frame_id;
+    }
+    RCLCPP_INFO(logger_, "TSDF integration is enabled - voxel: %.3f m, %d blocks, frame: %s",
+      _tsdf_voxel_size, _tsdf_max_blocks, _tsdf_world_frame.c_str());
+  }
 
-              auto imu_msg = sensor_msgs::msg::Imu();
-              imu_msg.header.frame_id = _optical_frame_id[stream_index];
-              imu_msg.orientation.x = 0.0;
-              imu_msg.orientation.y = 0.0;
-              imu_msg.orientation.z = 0.0;
-              imu_msg.orientation.w = 0.0;
-              imu_msg.orientation_covariance = {-1.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+  // Integrate a depth frame into the TSDF volume. The camera is static, so its pose in the
+  // world frame is looked up once from TF. Depth rows are walked in parallel along the cached
+  // pixel rays to find the blocks within the truncation band; the blocks are then allocated
+  // serially and integrated in parallel, each block by a single task.
+  void integrateTsdf(const rs2::frame & depth_frame, const rclcpp::Time & t)
+  {
+    if (!_tsdf_pose_valid) {
+      try {
+        auto transform = _tf_buffer->lookupTransform(_tsdf_world_frame,
+            _optical_frame_id[DEPTH], tf2::TimePointZero);
+        auto & translation = transform.transform.translation;
+        auto & rotation = transform.transform.rotation;
+        _tsdf_camera_to_world = Eigen::Translation3f(translation.x, translation.y,
+            translation.z) * Eigen::Quaternionf(rotation.w, rotation.x, rotation.y, rotation.z);
+        _tsdf_world_to_camera = _tsdf_camera_to_world.inverse();
+        _tsdf_pose_valid = true;
+      } catch (const tf2::TransformException & ex) {
+        RCLCPP_WARN(logger_, "TSDF waits for the %s to %s transform: %s",
+          _tsdf_world_frame.c_str(), _optical_frame_id[DEPTH].c_str(), ex.what());
+        return;
+      }
+    }
 
-              auto axes = *(reinterpret_cast<const float3 *>(frame.get_data()));
-              if (GYRO == stream_index) {
-                imu_msg.angular_velocity.x = axes.x;
-                imu_msg.angular_velocity.y = axes.y;
-                imu_msg.angular_velocity.z = axes.z;
-              } else if (ACCEL == stream_index) {
-                imu_msg.linear_acceleration.x = axes.x;
-                imu_msg.linear_acceleration.y = axes.y;
-                imu_msg.linear_acceleration.z = axes.z;
+    auto start = std::chrono::steady_clock::now();
+    auto & depth_intrin = _stream_intrinsics[DEPTH];
+    auto depth = reinterpret_cast<const uint16_t *>(depth_frame.get_data());
+    auto step = _tsdf_pixel_step;
+    auto truncation = static_cast<float>(_tsdf_truncation);
+    auto sample_step = static_cast<float>(_tsdf_voxel_size) * TsdfVolume::BLOCK_SIDE / 2;
+    auto max_depth = static_cast<float>(_tsdf_max_depth);
+    auto tasks = _processing_pool.size() * 4;
+    _tsdf_task_keys.resize(tasks);
+
+    _processing_pool.run(tasks, [&](int task) {
+        auto & keys = _tsdf_task_keys[task];
+        keys.clear();
+        auto last_key = ~0ULL;
+        auto rows = (depth_intrin.height + step - 1) / step;
+        for (int y = rows * task / tasks * step; y < rows * (task + 1) / tasks * step;
+          y += step)
+        {
+          for (int x = 0; x < depth_intrin.width; x += step) {
+            auto z = depth[y * depth_intrin.width + x] * _depth_scale_meters;
+            if (z <= 0.f || z > max_depth) {
+              continue;
+            }
+            auto ray = _depth_rays.data() + 2 * (y * depth_intrin.width + x);
+            for (auto s = -truncation; s < truncation + sample_step; s += sample_step) {
+              auto range = z + std::min(s, truncation);
+              auto point = _tsdf_camera_to_world *
+                Eigen::Vector3f(ray[0] * range, ray[1] * range, range);
+              auto key = _tsdf_volume.blockKey(point);
+              if (key != last_key) {
+                keys.push_back(key);
+                last_key = key;
               }
-              _seq[stream_index] += 1;
-              imu_msg.header.stamp = t;
-              _imu_publishers[stream_index]->publish(imu_msg);
-              RCLCPP_DEBUG(logger_, "Publish %s stream", rs2_stream_to_string(
-                frame.get_profile().stream_type()));
             }
-          });
-
-        if (true == _enable[GYRO]) {
-          RCLCPP_INFO(logger_, "%s stream is enabled - fps: %d", _stream_name[GYRO].c_str(),
-            _fps[GYRO]);
-          auto gyroInfo = getImuInfo(GYRO);
-          _imu_info_publisher[GYRO]->publish(gyroInfo);
+          }
         }
+      });
+
+    ++_tsdf_frame;
+    _tsdf_visible.clear();
+    auto full = false;
+    for (auto & keys : _tsdf_task_keys) {
+      for (auto key : keys) {
+        auto index = _tsdf_volume.allocate(key);
+        if (index < 0) {
+          full = true;
+        } else if (_tsdf_block_frame[index] != _tsdf_frame) {
+          _tsdf_block_frame[index] = _tsdf_frame;
+          _tsdf_visible.push_back(index);
+        }
+      }
+    }
+    if (full && !_tsdf_full) {
+      RCLCPP_WARN(logger_, "TSDF volume is full (%d blocks), new blocks are ignored",
+        _tsdf_max_blocks);
+    }
+    _tsdf_full = full;
 
-        if (true == _enable[ACCEL]) {
-          RCLCPP_INFO(logger_, "%s stream is enabled - fps: %d",
-            _stream_name[ACCEL].c_str(), _fps[ACCEL]);
-          auto accelInfo = getImuInfo(ACCEL);
-          _imu_info_publisher[ACCEL]->publish(accelInfo);
+    auto visible = static_cast<int>(_tsdf_visible.size());
+    _processing_pool.run(tasks, [&](int task) {
+        for (int i = visible * task / tasks; i < visible * (task + 1) / tasks; ++i) {
+          _tsdf_volume.integrateBlock(_tsdf_visible[i], depth, depth_intrin,
+            _tsdf_world_to_camera, _depth_scale_meters, max_depth, TSDF_MAX_WEIGHT);
         }
+      });
+
+    _tsdf_stats.add(elapsedMs(start));
+    if (_tsdf_stats.count() >= STATS_REPORT_FRAMES) {
+      RCLCPP_INFO(logger_, "TSDF integration over %d frames: mean %.2f ms, max %.2f ms, "
+        "%zu of %zu blocks", _tsdf_stats.count(), _tsdf_stats.mean(), _tsdf_stats.max(),
+        _tsdf_volume.size(), _tsdf_volume.capacity());
+      _tsdf_stats.reset();
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (std::chrono::duration<double>(now - _tsdf_last_publish).count() <
+      1.0 / _tsdf_publish_rate)
+    {
+      return;
+    }
+    _tsdf_last_publish = now;
+
+    _tsdf_volume.extractSurface(_tsdf_surface, TSDF_MIN_WEIGHT);
+    sensor_msgs::msg::PointCloud2 msg_pointcloud;
+    msg_pointcloud.header.stamp = t;
+    msg_pointcloud.header.frame_id = _tsdf_world_frame;
+    msg_pointcloud.height = 1;
+    msg_pointcloud.is_dense = true;
+    sensor_msgs::PointCloud2Modifier modifier(msg_pointcloud);
+    modifier.setPointCloud2FieldsByString(1, "xyz");
+    modifier.resize(_tsdf_surface.size());
+
+    sensor_msgs::PointCloud2Iterator<float> iter_x(msg_pointcloud, "x");
+    sensor_msgs::PointCloud2Iterator<float> iter_y(msg_pointcloud, "y");
+    sensor_msgs::PointCloud2Iterator<float> iter_z(msg_pointcloud, "z");
+    for (auto & point : _tsdf_surface) {
+      *iter_x = point.x();
+      *iter_y = point.y();
+      *iter_z = point.z();
+      ++iter_x; ++iter_y; ++iter_z;
+    }
+    _tsdf_publisher->publish(msg_pointcloud);
+    recordProduct(PRODUCT_TSDF, msg_pointcloud.data.size(), start);
+  }
+
+  // Build the 64K entry depth to code table, so quantization is one lookup per pixel, and the
+  // code to depth table that is published with every image.
+  void setupQuantizedDepth()
+  {
+    auto disparity = ("disparity" == _quantized_depth_mode);
+    auto near = disparity ? 1.0 / _quantized_depth_min : std::log(_quantized_depth_min);
+    auto far = disparity ? 1.0 / _quantized_depth_max : std::log(_quantized_depth_max);
+
+    _quantization_lut.resize(65536);
+    _quantization_lut[0] = 0;
+    for (int value = 1; value < 65536; ++value) {
+      auto z = value * _depth_scale_meters;
+      if (z < _quantized_depth_min || z > _quantized_depth_max) {
+        _quantization_lut[value] = 0;
+        continue;
       }
+      auto position = ((disparity ? 1.0 / z : std::log(z)) - far) / (near - far);
+      if (!disparity) {
+        // Log codes grow with depth
+        position = 1.0 - position;
+      }
+      _quantization_lut[value] = static_cast<uint8_t>(1 + std::lround(254 * position));
+    }
+
+    _quantization.mode = _quantized_depth_mode;
+    _quantization.min_depth = _quantized_depth_min;
+    _quantization.max_depth = _quantized_depth_max;
+    _quantization.depth_lut[0] = 0.f;
+    for (int code = 1; code < 256; ++code) {
+      auto position = (code - 1) / 254.0;
+      _quantization.depth_lut[code] = disparity ?
+        1.0 / (far + position * (near - far)) : std::exp(near + position * (far - near));
+    }
+    RCLCPP_INFO(logger_, "Quantized depth is enabled - %s over [%.2f, %.2f] m",
+      _quantized_depth_mode.c_str(), _quantized_depth_min, _quantized_depth_max);
+  }
 
+  void publishQuantizedDepth(const rs2::frame & depth_frame, const rclcpp::Time & t)
+  {
+    if (0 == _quantized_depth_publisher.getNumSubscribers()) {
+      return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    auto width = _stream_intrinsics[DEPTH].width;
+    auto height = _stream_intrinsics[DEPTH].height;
+    auto depth = reinterpret_cast<const uint16_t *>(depth_frame.get_data());
 
-      if (true == _enable[DEPTH] &&
-        true == _enable[FISHEYE])
+    auto img = std::make_shared<sensor_msgs::msg::Image>();
+    img->header.frame_id = _optical_frame_id[DEPTH];
+    img->header.stamp = t;
+    img->width = width;
+    img->height = height;
+    img->encoding = sensor_msgs::image_encodings::MONO8;
+    img->is_bigendian = false;
+    img->step = width;
+    img->data.resize(width * height);
+
+    // SSE2 has no gather: the lookups are unrolled so they can issue back to back.
+    auto lut = _quantization_lut.data();
+    auto out = img->data.data();
+    auto pixels = width * height;
+    int i = 0;
+    for (; i + 8 <= pixels; i += 8) {
+      out[i] = lut[depth[i]];
+      out[i + 1] = lut[depth[i + 1]];
+      out[i + 2] = lut[depth[i + 2]];
+      out[i + 3] = lut[depth[i + 3]];
+      out[i + 4] = lut[depth[i + 4]];
+      out[i + 5] = lut[depth[i + 5]];
+      out[i + 6] = lut[depth[i + 6]];
+      out[i + 7] = lut[depth[i + 7]];
+    }
+    for (; i < pixels; ++i) {
+      out[i] = lut[depth[i]];
+    }
+
+    _quantization.header = img->header;
+    _quantized_depth_publisher.publish(img);
+    _quantization_publisher->publish(_quantization);
+    recordProduct(PRODUCT_QUANTIZED_DEPTH, img->data.size(), start);
+  }
+
+  void setupVideoEncoding()
+  {
+    ColorEncoder::Settings settings;
+    settings.width = _stream_intrinsics[COLOR].width;
+    settings.height = _stream_intrinsics[COLOR].height;
+    settings.fps = _fps[COLOR];
+    settings.bitrate_kbps = _video_bitrate;
+    settings.gop = _video_gop;
+    settings.threads = _video_threads;
+    settings.preset = _video_preset;
+    settings.profile = _video_profile;
+    settings.zero_latency = _video_zero_latency;
+    settings.frame_id = _optical_frame_id[COLOR];
+    auto publisher = _video_publisher;
+    auto metrics = _product_metrics[PRODUCT_VIDEO];
+    if (!_color_encoder.start(settings,
+      [publisher, metrics](EncodedVideo::UniquePtr msg)
       {
-        auto ex = getFisheye2DepthExtrinsicsMsg();
-        _fe_to_depth_publisher->publish(ex);
+        metrics.messages->add();
+        metrics.bytes->add(msg->data.size());
+        publisher->publish(std::move(msg));
+      }))
+    {
+      RCLCPP_WARN(logger_, "H.264 encoder is unavailable, video encoding disabled");
+      _video_encoding = false;
+      return;
+    }
+    RCLCPP_INFO(logger_, "Color video encoding is enabled - H.264 %dx%d, %d kbit/s, GOP %d",
+      settings.width, settings.height, _video_bitrate, _video_gop);
+  }
+
+  void encodeColorFrame(const rs2::frame & color_frame, const rclcpp::Time & t)
+  {
+    auto subscribers = _video_publisher->get_subscription_count();
+    // Start a new subscriber on a keyframe instead of leaving it to wait for the next GOP.
+    auto keyframe = subscribers > _video_subscribers;
+    _video_subscribers = subscribers;
+    if (0 != subscribers) {
+      _color_encoder.submit(color_frame, t, keyframe);
+    }
+  }
+
+  void publishValidityMask(const rs2::frame & depth_frame, const rclcpp::Time & t)
+  {
+    auto start = std::chrono::steady_clock::now();
+    auto width = _stream_intrinsics[DEPTH].width;
+    auto height = _stream_intrinsics[DEPTH].height;
+    auto depth = reinterpret_cast<const uint16_t *>(depth_frame.get_data());
+    // Depth range in depth units; 0 (no depth) is always invalid.
+    auto lo = static_cast<uint16_t>(std::min(65535.0, std::max(1.0, std::ceil(
+        _validity_min_depth / _depth_scale_meters))));
+    auto hi = static_cast<uint16_t>(std::min(65535.0, std::max(0.0, std::floor(
+        _validity_max_depth / _depth_scale_meters))));
+
+    DepthValidityMask msg;
+    msg.header.stamp = t;
+    msg.header.frame_id = _optical_frame_id[DEPTH];
+    msg.frame_number = depth_frame.get_frame_number();
+    msg.width = width;
+    msg.height = height;
+    msg.row_step = (width + 7) / 8;
+    msg.min_depth = _validity_min_depth;
+    msg.max_depth = _validity_max_depth;
+    msg.data.assign(msg.row_step * height, 0);
+    for (int y = 0; y < height; ++y) {
+      packValidityBits(depth + y * width, width, lo, hi, msg.data.data() + y * msg.row_step);
+    }
+    _validity_mask_publisher->publish(msg);
+    recordProduct(PRODUCT_VALIDITY_MASK, msg.data.size(), start);
+  }
+
+  // Fill depth holes with a push-pull pyramid. The push passes halve the resolution, each
+  // parent taking the farthest valid child so that holes (mostly occlusion shadows) are filled
+  // with background rather than grown foreground; the pull passes fill the holes of every
+  // level from its parent. Passes run in row tiles on the processing pool and stop when the
+  // time budget runs out, leaving the remaining holes at 0. The mask marks filled pixels.
+  void publishFilledDepth(const rs2::frame & depth_frame, const rclcpp::Time & t)
+  {
+    if (0 == _filled_depth_publisher.getNumSubscribers() &&
+      0 == _filled_mask_publisher.getNumSubscribers())
+    {
+      return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double, std::milli>(_hole_filling_budget_ms));
+    auto depth = reinterpret_cast<const uint16_t *>(depth_frame.get_data());
+    auto width = _stream_intrinsics[DEPTH].width;
+    auto height = _stream_intrinsics[DEPTH].height;
+    auto tasks = _processing_pool.size() * 2;
+
+    _fill_levels.resize(_hole_filling_max_levels + 1);
+    _fill_widths.resize(_hole_filling_max_levels + 1);
+    _fill_heights.resize(_hole_filling_max_levels + 1);
+    _fill_widths[0] = width;
+    _fill_heights[0] = height;
+    _fill_levels[0].assign(depth, depth + width * height);
+
+    std::atomic<bool> over_budget{false};
+    auto run_tiles = [&](int rows, const std::function<void(int, int)> & pass) {
+        _processing_pool.run(tasks, [&](int task) {
+            if (over_budget || std::chrono::steady_clock::now() > deadline) {
+              over_budget = true;
+              return;
+            }
+            pass(rows * task / tasks, rows * (task + 1) / tasks);
+          });
+        return !over_budget;
+      };
+
+    // Push
+    auto top = 0;
+    while (top < _hole_filling_max_levels && _fill_widths[top] > 1 && _fill_heights[top] > 1) {
+      auto & child = _fill_levels[top];
+      auto child_width = _fill_widths[top];
+      auto child_height = _fill_heights[top];
+      auto parent_width = (child_width + 1) / 2;
+      auto parent_height = (child_height + 1) / 2;
+      auto & parent = _fill_levels[top + 1];
+      parent.resize(parent_width * parent_height);
+      auto complete = run_tiles(parent_height, [&](int row_begin, int row_end) {
+            for (int y = row_begin; y < row_end; ++y) {
+              auto y1 = std::min(2 * y + 1, child_height - 1);
+              for (int x = 0; x < parent_width; ++x) {
+                auto x1 = std::min(2 * x + 1, child_width - 1);
+                parent[y * parent_width + x] = std::max(
+                  std::max(child[2 * y * child_width + 2 * x], child[2 * y * child_width + x1]),
+                  std::max(child[y1 * child_width + 2 * x], child[y1 * child_width + x1]));
+              }
+            }
+          });
+      if (!complete) {
+        break;
       }
+      ++top;
+      _fill_widths[top] = parent_width;
+      _fill_heights[top] = parent_height;
+    }
 
-      if (true == _enable[FISHEYE] &&
-        (_enable[GYRO] || _enable[ACCEL]))
+    // Pull
+    for (auto level = top - 1; level >= 0; --level) {
+      auto & child = _fill_levels[level];
+      auto & parent = _fill_levels[level + 1];
+      auto child_width = _fill_widths[level];
+      auto parent_width = _fill_widths[level + 1];
+      if (!run_tiles(_fill_heights[level], [&](int row_begin, int row_end) {
+          for (int y = row_begin; y < row_end; ++y) {
+            for (int x = 0; x < child_width; ++x) {
+              auto & value = child[y * child_width + x];
+              if (0 == value) {
+                value = parent[(y / 2) * parent_width + x / 2];
+              }
+            }
+          }
+        }))
       {
-        auto ex = getFisheye2ImuExtrinsicsMsg();
-        _fe_to_imu_publisher->publish(ex);
+        break;
       }
-    } catch (const std::exception & ex) {
-      RCLCPP_ERROR(logger_, "An exception has been thrown: %s", ex.what());
-      throw;
-    } catch (...) {
-      RCLCPP_ERROR(logger_, "Unknown exception has occured!");
-      throw;
+    }
+
+    auto filled = std::make_shared<sensor_msgs::msg::Image>();
+    filled->header.frame_id = _optical_frame_id[DEPTH];
+    filled->header.stamp = t;
+    filled->width = width;
+    filled->height = height;
+    filled->encoding = sensor_msgs::image_encodings::TYPE_16UC1;
+    filled->is_bigendian = false;
+    filled->step = width * sizeof(uint16_t);
+    filled->data.resize(filled->step * height);
+    memcpy(filled->data.data(), _fill_levels[0].data(), filled->data.size());
+
+    auto mask = std::make_shared<sensor_msgs::msg::Image>();
+    mask->header = filled->header;
+    mask->width = width;
+    mask->height = height;
+    mask->encoding = sensor_msgs::image_encodings::MONO8;
+    mask->is_bigendian = false;
+    mask->step = width;
+    mask->data.resize(width * height);
+    for (int i = 0; i < width * height; ++i) {
+      mask->data[i] = (0 == depth[i] && 0 != _fill_levels[0][i]) ? 255 : 0;
+    }
+
+    _filled_depth_publisher.publish(filled);
+    _filled_mask_publisher.publish(mask);
+    recordProduct(PRODUCT_FILLED_DEPTH, filled->data.size() + mask->data.size(), start);
+
+    if (over_budget) {
+      ++_hole_filling_over_budget;
+    }
+    _hole_filling_stats.add(elapsedMs(start));
+    if (_hole_filling_stats.count() >= STATS_REPORT_FRAMES) {
+      RCLCPP_INFO(logger_, "Hole filling over %d frames: mean %.2f ms, max %.2f ms, "
+        "%d over budget", _hole_filling_stats.count(), _hole_filling_stats.mean(),
+        _hole_filling_stats.max(), _hole_filling_over_budget);
+      _hole_filling_stats.reset();
+      _hole_filling_over_budget = 0;
     }
   }
 
-  void updateStreamCalibData(const rs2::video_stream_profile & video_profile)
+  // Sample tables of the pseudo LiDAR: for every (ring, column) the depth pixel on that
+  // elevation and azimuth in the depth optical frame, and its ray. Ring 0 is the lowest.
+  void setupPseudoLidar()
   {
-    stream_index_pair stream_index{video_profile.stream_type(), video_profile.stream_index()};
-    auto intrinsic = video_profile.get_intrinsics();
-    _stream_intrinsics[stream_index] = intrinsic;
-
-    _camera_info[stream_index].width = intrinsic.width;
-    _camera_info[stream_index].height = intrinsic.height;
-    _camera_info[stream_index].header.frame_id = _optical_frame_id[stream_index];
+    auto & intrinsics = _stream_intrinsics[DEPTH];
+    auto rings = _pseudo_lidar_rings;
+    auto columns = _pseudo_lidar_columns;
+    auto min_azimuth = std::atan2(-intrinsics.ppx, intrinsics.fx);
+    auto max_azimuth = std::atan2(intrinsics.width - 1 - intrinsics.ppx, intrinsics.fx);
+    auto min_elevation = _pseudo_lidar_min_elevation * M_PI / 180.0;
+    auto max_elevation = _pseudo_lidar_max_elevation * M_PI / 180.0;
+
+    _pseudo_lidar_index.assign(rings * columns, -1);
+    _pseudo_lidar_ray_x.assign(rings * columns, 0.f);
+    _pseudo_lidar_ray_y.assign(rings * columns, 0.f);
+    for (int ring = 0; ring < rings; ++ring) {
+      auto elevation = (rings > 1) ?
+        min_elevation + (max_elevation - min_elevation) * ring / (rings - 1) : min_elevation;
+      for (int column = 0; column < columns; ++column) {
+        auto azimuth = (columns > 1) ?
+          min_azimuth + (max_azimuth - min_azimuth) * column / (columns - 1) : 0.0;
+        // Optical frame: x right, y down, z forward
+        auto u = static_cast<int>(std::lround(intrinsics.fx * std::tan(azimuth) + intrinsics.ppx));
+        auto v = static_cast<int>(std::lround(
+            intrinsics.ppy - intrinsics.fy * std::tan(elevation) / std::cos(azimuth)));
+        if (u < 0 || v < 0 || u >= intrinsics.width || v >= intrinsics.height) {
+          continue;
+        }
+        auto sample = ring * columns + column;
+        auto pixel = v * intrinsics.width + u;
+        _pseudo_lidar_index[sample] = pixel;
+        _pseudo_lidar_ray_x[sample] = _depth_rays[2 * pixel];
+        _pseudo_lidar_ray_y[sample] = _depth_rays[2 * pixel + 1];
+      }
+    }
+    RCLCPP_INFO(logger_, "Pseudo LiDAR is enabled - %d rings of %d columns", rings, columns);
+  }
 
-    _camera_info[stream_index].k.at(0) = intrinsic.fx;
-    _camera_info[stream_index].k.at(2) = intrinsic.ppx;
-    _camera_info[stream_index].k.at(4) = intrinsic.fy;
-    _camera_info[stream_index].k.at(5) = intrinsic.ppy;
-    _camera_info[stream_index].k.at(8) = 1;
+  // Publish the depth sampled along the pseudo LiDAR rings as an organized cloud, one row per
+  // ring, in the point layout of the Velodyne driver (x, y, z, intensity, ring). Intensity
+  // comes from the infra1 frame when it is available.
+  void publishPseudoLidar(
+    const rs2::frame & depth_frame, const rs2::frame & infra1_frame,
+    const rclcpp::Time & t)
+  {
+    static const uint32_t point_step = 32;
+    auto start = std::chrono::steady_clock::now();
+    auto depth = reinterpret_cast<const uint16_t *>(depth_frame.get_data());
+    const uint8_t * infra1 = nullptr;
+    if (infra1_frame && infra1_frame.as<rs2::video_frame>().get_width() ==
+      _stream_intrinsics[DEPTH].width)
+    {
+      infra1 = reinterpret_cast<const uint8_t *>(infra1_frame.get_data());
+    }
+    auto columns = _pseudo_lidar_columns;
+    auto samples = _pseudo_lidar_rings * columns;
+
+    sensor_msgs::msg::PointCloud2 msg;
+    msg.header.stamp = t;
+    msg.header.frame_id = _optical_frame_id[DEPTH];
+    msg.height = _pseudo_lidar_rings;
+    msg.width = columns;
+    msg.is_bigendian = false;
+    msg.is_dense = false;
+    msg.point_step = point_step;
+    msg.row_step = point_step * columns;
+    static const char * names[] = {"x", "y", "z", "intensity", "ring"};
+    static const uint32_t offsets[] = {0, 4, 8, 16, 20};
+    for (int i = 0; i < 5; ++i) {
+      sensor_msgs::msg::PointField field;
+      field.name = names[i];
+      field.offset = offsets[i];
+      field.datatype = (4 == i) ? sensor_msgs::msg::PointField::UINT16 :
+        sensor_msgs::msg::PointField::FLOAT32;
+      field.count = 1;
+      msg.fields.push_back(field);
+    }
+    msg.data.assign(samples * point_step, 0);
+
+    auto scale = _depth_scale_meters;
+    auto max_range = static_cast<float>(_pseudo_lidar_max_range);
+    auto nan = std::numeric_limits<float>::quiet_NaN();
+    float x[4], y[4], z[4];
+    for (int i = 0; i < samples; i += 4) {
+      auto lanes = std::min(4, samples - i);
+      int32_t values[4] = {0, 0, 0, 0};
+      for (int lane = 0; lane < lanes; ++lane) {
+        auto index = _pseudo_lidar_index[i + lane];
+        values[lane] = (index >= 0) ? depth[index] : 0;
+      }
+#ifdef __SSE2__
+      if (4 == lanes) {
+        auto depth_v = _mm_mul_ps(
+          _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(values))),
+          _mm_set1_ps(scale));
+        auto valid = _mm_and_ps(_mm_cmpgt_ps(depth_v, _mm_setzero_ps()),
+            _mm_cmple_ps(depth_v, _mm_set1_ps(max_range)));
+        auto nan_v = _mm_andnot_ps(valid, _mm_set1_ps(nan));
+        _mm_storeu_ps(z, _mm_or_ps(_mm_and_ps(valid, depth_v), nan_v));
+        _mm_storeu_ps(x, _mm_or_ps(_mm_and_ps(valid,
+          _mm_mul_ps(depth_v, _mm_loadu_ps(&_pseudo_lidar_ray_x[i]))), nan_v));
+        _mm_storeu_ps(y, _mm_or_ps(_mm_and_ps(valid,
+          _mm_mul_ps(depth_v, _mm_loadu_ps(&_pseudo_lidar_ray_y[i]))), nan_v));
+      } else
+#endif
+      {
+        for (int lane = 0; lane < lanes; ++lane) {
+          auto range = values[lane] * scale;
+          auto valid = range > 0.f && range <= max_range;
+          z[lane] = valid ? range : nan;
+          x[lane] = valid ? range * _pseudo_lidar_ray_x[i + lane] : nan;
+          y[lane] = valid ? range * _pseudo_lidar_ray_y[i + lane] : nan;
+        }
+      }
 
-    _camera_info[stream_index].p.at(0) = _camera_info[stream_index].k.at(0);
-    _camera_info[stream_index].p.at(1) = 0;
-    _camera_info[stream_index].p.at(2) = _camera_info[stream_index].k.at(2);
-    _camera_info[stream_index].p.at(3) = 0;
-    _camera_info[stream_index].p.at(4) = 0;
-    _camera_info[stream_index].p.at(5) = _camera_info[stream_index].k.at(4);
-    _camera_info[stream_index].p.at(6) = _camera_info[stream_index].k.at(5);
-    _camera_info[stream_index].p.at(7) = 0;
-    _camera_info[stream_index].p.at(8) = 0;
-    _camera_info[stream_index].p.at(9) = 0;
-    _camera_info[stream_index].p.at(10) = 1;
-    _camera_info[stream_index].p.at(11) = 0;
+      for (int lane = 0; lane < lanes; ++lane) {
+        auto sample = i + lane;
+        auto point = msg.data.data() + sample * point_step;
+        auto index = _pseudo_lidar_index[sample];
+        float intensity = (infra1 && index >= 0) ? infra1[index] : 0.f;
+        auto ring = static_cast<uint16_t>(sample / columns);
+        memcpy(point, &x[lane], sizeof(float));
+        memcpy(point + 4, &y[lane], sizeof(float));
+        memcpy(point + 8, &z[lane], sizeof(float));
+        memcpy(point + 16, &intensity, sizeof(float));
+        memcpy(point + 20, &ring, sizeof(ring));
+      }
+    }
+    _pseudo_lidar_publisher->publish(msg);
+    recordProduct(PRODUCT_PSEUDO_LIDAR, msg.data.size(), start);
+
+    _pseudo_lidar_stats.add(elapsedMs(start));
+    if (_pseudo_lidar_stats.count() >= STATS_REPORT_FRAMES) {
+      RCLCPP_INFO(logger_, "Pseudo LiDAR over %d frames: mean %.3f ms, max %.3f ms",
+        _pseudo_lidar_stats.count(), _pseudo_lidar_stats.mean(), _pseudo_lidar_stats.max());
+      _pseudo_lidar_stats.reset();
+    }
+  }
 
+  // Euclidean clustering on the organized depth grid: neighbouring grid cells whose points
+  // are closer than _cluster_distance are joined with union-find, which is linear in the
+  // number of cells and needs no k-d tree. Only per cluster statistics are published.
+  void publishClusters(const rs2::frame & depth_frame, const rclcpp::Time & t)
+  {
+    auto start = std::chrono::steady_clock::now();
+    auto & depth_intrin = _stream_intrinsics[DEPTH];
+    auto depth = reinterpret_cast<const uint16_t *>(depth_frame.get_data());
+    auto step = _cluster_pixel_step;
+    auto width = (depth_intrin.width + step - 1) / step;
+    auto height = (depth_intrin.height + step - 1) / step;
+    auto cells = width * height;
+    auto max_depth = static_cast<float>(_cluster_max_depth);
+    auto max_distance2 = static_cast<float>(_cluster_distance * _cluster_distance);
+
+    _cluster_points.resize(cells);
+    _cluster_parent.resize(cells);
+    for (int y = 0; y < height; ++y) {
+      for (int x = 0; x < width; ++x) {
+        auto i = y * width + x;
+        auto pixel = y * step * depth_intrin.width + x * step;
+        auto z = depth[pixel] * _depth_scale_meters;
+        if (z <= 0.f || z > max_depth) {
+          _cluster_parent[i] = -1;
+          continue;
+        }
+        auto ray = _depth_rays.data() + 2 * pixel;
+        _cluster_points[i] = Eigen::Vector3f(ray[0] * z, ray[1] * z, z);
+        _cluster_parent[i] = i;
+        if (x > 0) {
+          joinClusterCells(i, i - 1, max_distance2);
+        }
+        if (y > 0) {
+          joinClusterCells(i, i - width, max_distance2);
+        }
+      }
+    }
 
-    // Why Depth to Color?
-    if (stream_index == DEPTH && _enable[DEPTH] && _enable[COLOR]) {
-      rs2::stream_profile depth_profile;
-      if (!getEnabledProfile(DEPTH, depth_profile)) {
-        RCLCPP_ERROR(logger_, "Depth profile not found!");
-        rclcpp::shutdown();
-        exit(1);
+    Clusters msg;
+    msg.header.stamp = t;
+    msg.header.frame_id = _optical_frame_id[DEPTH];
+    msg.frame_number = depth_frame.get_frame_number();
+    _cluster_label.assign(cells, -1);
+    _cluster_stats.clear();
+    for (int i = 0; i < cells; ++i) {
+      if (_cluster_parent[i] < 0) {
+        continue;
       }
-      _depth2color_extrinsics = depth_profile.get_extrinsics_to(_enabled_profiles[COLOR].front());
-      // set depth to color translation values in Projection matrix (P)
-      _camera_info[stream_index].p.at(3) = _depth2color_extrinsics.translation[0];             // Tx
-      _camera_info[stream_index].p.at(7) = _depth2color_extrinsics.translation[1];             // Ty
-      _camera_info[stream_index].p.at(11) = _depth2color_extrinsics.translation[2];            // Tz
+      auto root = findClusterRoot(i);
+      if (_cluster_label[root] < 0) {
+        _cluster_label[root] = static_cast<int32_t>(_cluster_stats.size());
+        _cluster_stats.push_back(ClusterStats{0, Eigen::Vector3f::Zero(),
+            _cluster_points[i], _cluster_points[i]});
+      }
+      auto & stats = _cluster_stats[_cluster_label[root]];
+      auto & point = _cluster_points[i];
+      ++stats.count;
+      stats.sum += point;
+      stats.min = stats.min.cwiseMin(point);
+      stats.max = stats.max.cwiseMax(point);
+    }
+    for (auto & stats : _cluster_stats) {
+      if (static_cast<int>(stats.count) < _cluster_min_points) {
+        continue;
+      }
+      realsense_camera_msgs::msg::Cluster cluster;
+      Eigen::Vector3f centroid = stats.sum / stats.count;
+      cluster.centroid.x = centroid.x();
+      cluster.centroid.y = centroid.y();
+      cluster.centroid.z = centroid.z();
+      cluster.min.x = stats.min.x();
+      cluster.min.y = stats.min.y();
+      cluster.min.z = stats.min.z();
+      cluster.max.x = stats.max.x();
+      cluster.max.y = stats.max.y();
+      cluster.max.z = stats.max.z();
+      cluster.point_count = stats.count;
+      msg.clusters.push_back(cluster);
     }
+    _clusters_publisher->publish(msg);
+    recordProduct(PRODUCT_CLUSTERS, msg.clusters.size() * sizeof(msg.clusters[0]), start);
+
+    _clustering_stats.add(elapsedMs(start));
+    if (_clustering_stats.count() >= STATS_REPORT_FRAMES) {
+      RCLCPP_INFO(logger_, "Clustering over %d frames: mean %.2f ms, max %.2f ms, "
+        "%zu clusters in the last frame", _clustering_stats.count(), _clustering_stats.mean(),
+        _clustering_stats.max(), msg.clusters.size());
+      _clustering_stats.reset();
+    }
+  }
 
-    _camera_info[stream_index].distortion_model = "plumb_bob";
+  struct DepthSnapshot
+  {
+    rclcpp::Time stamp;
+    uint64_t frame_number;
+    rs2::frame depth;
+    rs2::frameset aligned_frameset;
+    std::vector<uint16_t> aligned_copy;
+    const uint16_t * aligned = nullptr;
+  };
 
-    // set R (rotation matrix) values to identity matrix
-    _camera_info[stream_index].r.at(0) = 1.0;
-    _camera_info[stream_index].r.at(1) = 0.0;
-    _camera_info[stream_index].r.at(2) = 0.0;
-    _camera_info[stream_index].r.at(3) = 0.0;
-    _camera_info[stream_index].r.at(4) = 1.0;
-    _camera_info[stream_index].r.at(5) = 0.0;
-    _camera_info[stream_index].r.at(6) = 0.0;
-    _camera_info[stream_index].r.at(7) = 0.0;
-    _camera_info[stream_index].r.at(8) = 1.0;
+  // Publish the latest depth (and aligned depth) for the pixel query service. Frames are
+  // reference counted, so the snapshot only holds on to them; the z-buffer registration
+  // reuses its buffer and is copied. The snapshot pointer is swapped atomically, so service
+  // calls never wait for frame processing. Aligned depth is also buffered for detection
+  // fusion.
+  void updateDepthSnapshot(const rs2::frame & depth_frame, const rclcpp::Time & t, bool aligned)
+  {
+    if (_detection_fusion && aligned && nullptr != _aligned_depth_data &&
+      0 != _detections_subscription->get_publisher_count())
+    {
+      // Buffered frames are copied, holding several would starve the librealsense frame pools.
+      auto buffered = freeAlignedBuffer();
+      buffered->stamp = t;
+      buffered->frame_number = depth_frame.get_frame_number();
+      auto & intrinsics = _stream_intrinsics[COLOR];
+      buffered->aligned_copy.assign(_aligned_depth_data,
+        _aligned_depth_data + intrinsics.width * intrinsics.height);
+      buffered->aligned = buffered->aligned_copy.data();
+      auto slot = _aligned_snapshot_count++ % _aligned_snapshots.size();
+      std::atomic_store(&_aligned_snapshots[slot], std::shared_ptr<const DepthSnapshot>(buffered));
+    }
+    if (!_pixels_to_3d) {
+      return;
+    }
 
-    for (int i = 0; i < 5; i++) {
-      _camera_info[stream_index].d.push_back(intrinsic.coeffs[i]);
+    auto snapshot = std::make_shared<DepthSnapshot>();
+    snapshot->stamp = t;
+    snapshot->frame_number = depth_frame.get_frame_number();
+    snapshot->depth = depth_frame;
+    if (aligned && nullptr != _aligned_depth_data) {
+      if ("zbuffer" == _registration_engine) {
+        snapshot->aligned_copy = _registered_depth;
+        snapshot->aligned = snapshot->aligned_copy.data();
+      } else {
+        snapshot->aligned_frameset = _aligned_frameset;
+        snapshot->aligned = _aligned_depth_data;
+      }
     }
+    std::atomic_store(&_depth_snapshot, std::shared_ptr<const DepthSnapshot>(snapshot));
   }
 
-  Eigen::Quaternionf rotationMatrixToQuaternion(float rotation[9]) const
+  // A pooled aligned depth buffer that is neither in the snapshot ring nor held by a reader.
+  // Once the pool holds the only reference nobody else can obtain it, so it can be refilled.
+  std::shared_ptr<DepthSnapshot> freeAlignedBuffer()
   {
-    Eigen::Matrix3f m;
-    m << rotation[0], rotation[1], rotation[2],
-      rotation[3], rotation[4], rotation[5],
-      rotation[6], rotation[7], rotation[8];
-    Eigen::Quaternionf q(m);
-    return q;
+    for (auto & buffer : _aligned_pool) {
+      if (1 == buffer.use_count()) {
+        return buffer;
+      }
+    }
+    // More readers than expected: replace the oldest pooled buffer, its holders keep it alive.
+    auto & buffer = _aligned_pool[_aligned_snapshot_count % _aligned_pool.size()];
+    buffer = std::make_shared<DepthSnapshot>();
+    return buffer;
   }
 
-  void publishStaticTransforms()
+  // Localize 2D color detections in 3D with the buffered aligned depth frame closest in time.
+  // The depth of a box is the median of the valid depths of its central region, found with
+  // a 1 cm histogram, which is robust to background pixels at the box border.
+  void fuseDetections(const Detection2DArray::SharedPtr msg)
   {
-    RCLCPP_DEBUG(logger_, "publishStaticTransforms...");
-    // Publish transforms for the cameras
-    tf2::Quaternion q_c2co;
-    geometry_msgs::msg::TransformStamped b2c_msg;         // Base to Color
-    geometry_msgs::msg::TransformStamped c2co_msg;         // Color to Color_Optical
-
-    tf2::Quaternion q_d2do;
-    geometry_msgs::msg::TransformStamped b2d_msg;         // Base to Depth
-    geometry_msgs::msg::TransformStamped d2do_msg;         // Depth to Depth_Optical
-
-    tf2::Quaternion ir1_2_ir1o;
-    geometry_msgs::msg::TransformStamped b2ir1_msg;         // Base to IR1
-    geometry_msgs::msg::TransformStamped ir1_2_ir1o_msg;         // IR1 to IR1_Optical
+    std::lock_guard<std::mutex> lock(_transition_mutex);
+    auto start = std::chrono::steady_clock::now();
+    auto stamp_ns = rclcpp::Time(msg->header.stamp).nanoseconds();
+    std::shared_ptr<const DepthSnapshot> snapshot;
+    auto best_ns = static_cast<int64_t>(_detection_match_tolerance_ms * 1e6);
+    for (auto & slot : _aligned_snapshots) {
+      auto candidate = std::atomic_load(&slot);
+      if (candidate) {
+        auto diff_ns = std::abs(candidate->stamp.nanoseconds() - stamp_ns);
+        if (diff_ns <= best_ns) {
+          best_ns = diff_ns;
+          snapshot = candidate;
+        }
+      }
+    }
+    if (!snapshot) {
+      ++_detection_unmatched;
+      return;
+    }
 
-    tf2::Quaternion ir2_2_ir2o;
-    geometry_msgs::msg::TransformStamped b2ir2_msg;         // Base to IR2
-    geometry_msgs::msg::TransformStamped ir2_2_ir2o_msg;         // IR2 to IR2_Optical
+    auto & intrinsics = _stream_intrinsics.at(COLOR);
+    Detection3DArray out;
+    out.header.stamp = snapshot->stamp;
+    out.header.frame_id = _optical_frame_id.at(COLOR);
+    out.frame_number = snapshot->frame_number;
+    std::array<uint32_t, DETECTION_HISTOGRAM_BINS> histogram;
+    auto bin_scale = _depth_scale_meters / DETECTION_HISTOGRAM_BIN_SIZE;
+    for (auto & detection : msg->detections) {
+      realsense_camera_msgs::msg::Detection3D detection_3d;
+      detection_3d.detection = detection;
+      detection_3d.depth = 0.f;
+      detection_3d.depth_samples = 0;
+      detection_3d.valid = false;
+      if (!std::isfinite(detection.x) || !std::isfinite(detection.y) ||
+        !std::isfinite(detection.width) || !std::isfinite(detection.height))
+      {
+        out.detections.push_back(detection_3d);
+        continue;
+      }
 
-    // Get the current timestamp for all static transforms
-    rclcpp::Time transform_ts_ = _ros_clock.now();
+      // Clamped in floating point, so the casts are defined for any finite box.
+      auto clamp = [](double value, int limit)
+        {
+          return static_cast<int>(std::min(std::max(value, 0.0), static_cast<double>(limit)));
+        };
+      auto margin_x = detection.width * _detection_roi_shrink / 2;
+      auto margin_y = detection.height * _detection_roi_shrink / 2;
+      auto x0 = clamp(detection.x + margin_x, intrinsics.width);
+      auto y0 = clamp(detection.y + margin_y, intrinsics.height);
+      auto x1 = clamp(detection.x + detection.width - margin_x + 1, intrinsics.width);
+      auto y1 = clamp(detection.y + detection.height - margin_y + 1, intrinsics.height);
+
+      histogram.fill(0);
+      uint32_t samples = 0;
+      for (int y = y0; y < y1; ++y) {
+        auto row = snapshot->aligned + y * intrinsics.width;
+        for (int x = x0; x < x1; ++x) {
+          if (row[x]) {
+            auto bin = std::min(static_cast<int>(row[x] * bin_scale),
+                DETECTION_HISTOGRAM_BINS - 1);
+            ++histogram[bin];
+            ++samples;
+          }
+        }
+      }
 
-    // The depth frame is used as the base frame.
-    // Hence no additional transformation is done from base frame to depth frame.
-    // Transform base frame to depth frame
-    b2d_msg.header.stamp = transform_ts_;
-    b2d_msg.header.frame_id = _base_frame_id;
-    b2d_msg.child_frame_id = _frame_id[DEPTH];
-    b2d_msg.transform.translation.x = 0;
-    b2d_msg.transform.translation.y = 0;
-    b2d_msg.transform.translation.z = 0;
-    b2d_msg.transform.rotation.x = 0;
-    b2d_msg.transform.rotation.y = 0;
-    b2d_msg.transform.rotation.z = 0;
-    b2d_msg.transform.rotation.w = 1;
-    _static_tf_broadcaster_->sendTransform(b2d_msg);
+      if (samples > 0) {
+        uint32_t cumulative = 0;
+        int bin = 0;
+        while ((cumulative += histogram[bin]) * 2 < samples) {
+          ++bin;
+        }
+        auto z = (bin + 0.5f) * DETECTION_HISTOGRAM_BIN_SIZE;
+        auto u = clamp(detection.x + detection.width / 2.0, intrinsics.width - 1);
+        auto v = clamp(detection.y + detection.height / 2.0, intrinsics.height - 1);
+        auto ray = _color_rays.data() + 2 * (v * intrinsics.width + u);
+        detection_3d.center.x = ray[0] * z;
+        detection_3d.center.y = ray[1] * z;
+        detection_3d.center.z = z;
+        detection_3d.depth = z;
+        detection_3d.depth_samples = samples;
+        detection_3d.valid = true;
+      }
+      out.detections.push_back(detection_3d);
+    }
+    _detections_3d_publisher->publish(out);
+    recordProduct(PRODUCT_DETECTIONS_3D, out.detections.size() * sizeof(out.detections[0]),
+      start);
+
+    _detection_stats.add(elapsedMs(start));
+    if (_detection_stats.count() >= STATS_REPORT_FRAMES) {
+      RCLCPP_INFO(logger_, "Detection fusion over %d messages: mean %.2f ms, max %.2f ms, "
+        "%d unmatched", _detection_stats.count(), _detection_stats.mean(),
+        _detection_stats.max(), _detection_unmatched);
+      _detection_stats.reset();
+      _detection_unmatched = 0;
+    }
+  }
 
-    // Transform depth frame to depth optical frame
-    q_d2do.setRPY(-M_PI / 2, 0.0, -M_PI / 2);
-    d2do_msg.header.stamp = transform_ts_;
-    d2do_msg.header.frame_id = _frame_id[DEPTH];
-    d2do_msg.child_frame_id = _optical_frame_id[DEPTH];
-    d2do_msg.transform.translation.x = 0;
-    d2do_msg.transform.translation.y = 0;
-    d2do_msg.transform.translation.z = 0;
-    d2do_msg.transform.rotation.x = q_d2do.getX();
-    d2do_msg.transform.rotation.y = q_d2do.getY();
-    d2do_msg.transform.rotation.z = q_d2do.getZ();
-    d2do_msg.transform.rotation.w = q_d2do.getW();
-    _static_tf_broadcaster_->sendTransform(d2do_msg);
+  void pixelsTo3D(
+    const std::shared_ptr<PixelsTo3D::Request> request,
+    std::shared_ptr<PixelsTo3D::Response> response)
+  {
+    std::lock_guard<std::mutex> lock(_transition_mutex);
+    // One entry per requested pixel, invalid until a depth is found.
+    auto count = std::min(request->u.size(), request->v.size());
+    response->points.assign(count, geometry_msgs::msg::Point());
+    response->valid.assign(count, false);
+
+    auto snapshot = std::atomic_load(&_depth_snapshot);
+    if (!snapshot) {
+      RCLCPP_WARN(logger_, "pixels_to_3d: no depth frame yet");
+      return;
+    }
 
+    auto stream = request->aligned ? COLOR : DEPTH;
+    auto depth = request->aligned ? snapshot->aligned :
+      reinterpret_cast<const uint16_t *>(snapshot->depth.get_data());
+    if (nullptr == depth) {
+      RCLCPP_WARN(logger_, "pixels_to_3d: no aligned depth, enable_aligned_depth is required");
+      return;
+    }
+    auto & intrinsics = _stream_intrinsics.at(stream);
+    auto & rays = request->aligned ? _color_rays : _depth_rays;
+
+    response->header.stamp = snapshot->stamp;
+    response->header.frame_id = _optical_frame_id.at(stream);
+    response->frame_number = snapshot->frame_number;
+
+    auto median_window = std::min(std::max(1u, request->median_window),
+        static_cast<uint32_t>(PIXELS_TO_3D_MAX_MEDIAN_WINDOW));
+    int half = static_cast<int>(median_window / 2);
+    std::vector<uint16_t> window;
+    window.reserve((2 * half + 1) * (2 * half + 1));
+    for (size_t i = 0; i < count; ++i) {
+      // Checked unsigned, so out of range coordinates cannot wrap to negative ints.
+      if (request->u[i] >= static_cast<uint32_t>(intrinsics.width) ||
+        request->v[i] >= static_cast<uint32_t>(intrinsics.height))
+      {
+        continue;
+      }
+      auto u = static_cast<int>(request->u[i]);
+      auto v = static_cast<int>(request->v[i]);
+      window.clear();
+      for (int y = std::max(0, v - half); y <= std::min(intrinsics.height - 1, v + half); ++y) {
+        for (int x = std::max(0, u - half); x <= std::min(intrinsics.width - 1, u + half); ++x) {
+          auto value = depth[y * intrinsics.width + x];
+          if (value) {
+            window.push_back(value);
+          }
+        }
+      }
+      if (!window.empty()) {
+        std::nth_element(window.begin(), window.begin() + window.size() / 2, window.end());
+        auto z = window[window.size() / 2] * _depth_scale_meters;
+        auto ray = rays.data() + 2 * (v * intrinsics.width + u);
+        auto & point = response->points[i];
+        point.x = ray[0] * z;
+        point.y = ray[1] * z;
+        point.z = z;
+        response->valid[i] = true;
+      }
+    }
+  }
 
-    if (true == _enable[COLOR]) {
-      // Transform base frame to color frame
-      auto q = rotationMatrixToQuaternion(_depth2color_extrinsics.rotation);
+  // Triggered capture counts the frames of _trigger_stream, alone or in a frameset: the
+  // framesets of the other sync groups do not count.
+  bool isTriggerFrame(const rs2::frame & frame)
+  {
+    auto is_trigger_stream = [this](const rs2::frame & f)
+      {
+        auto profile = f.get_profile();
+        return stream_index_pair{profile.stream_type(), profile.stream_index()} ==
+               _trigger_stream;
+      };
+    if (frame.is<rs2::frameset>()) {
+      auto frameset = frame.as<rs2::frameset>();
+      for (auto it = frameset.begin(); it != frameset.end(); ++it) {
+        if (is_trigger_stream(*it)) {
+          return true;
+        }
+      }
+      return false;
+    }
+    return is_trigger_stream(frame);
+  }
 
-      b2c_msg.header.stamp = transform_ts_;
-      b2c_msg.header.frame_id = _base_frame_id;
-      b2c_msg.child_frame_id = _frame_id[COLOR];
-      b2c_msg.transform.translation.x = _depth2color_extrinsics.translation[2];
-      b2c_msg.transform.translation.y = -_depth2color_extrinsics.translation[0];
-      b2c_msg.transform.translation.z = -_depth2color_extrinsics.translation[1];
-      b2c_msg.transform.rotation.x = q.x();
-      b2c_msg.transform.rotation.y = q.y();
-      b2c_msg.transform.rotation.z = q.z();
-      b2c_msg.transform.rotation.w = q.w();
-      _static_tf_broadcaster_->sendTransform(b2c_msg);
+  void completeTriggeredFrame()
+  {
+    std::lock_guard<std::mutex> lock(_trigger_mutex);
+    auto remaining = _trigger_remaining.load();
+    if (0 == remaining) {
+      // The trigger timed out meanwhile
+      return;
+    }
+    _trigger_last_ms = elapsedMs(_trigger_start);
+    if (0 == _trigger_published++) {
+      _trigger_first_ms = _trigger_last_ms;
+    }
+    _trigger_remaining.store(remaining - 1, std::memory_order_release);
+    if (1 == remaining) {
+      _trigger_cv.notify_one();
+    }
+  }
 
-      // Transform color frame to color optical frame
-      q_c2co.setRPY(-M_PI / 2, 0.0, -M_PI / 2);
-      c2co_msg.header.stamp = transform_ts_;
-      c2co_msg.header.frame_id = _frame_id[COLOR];
-      c2co_msg.child_frame_id = _optical_frame_id[COLOR];
-      c2co_msg.transform.translation.x = 0;
-      c2co_msg.transform.translation.y = 0;
-      c2co_msg.transform.translation.z = 0;
-      c2co_msg.transform.rotation.x = q_c2co.getX();
-      c2co_msg.transform.rotation.y = q_c2co.getY();
-      c2co_msg.transform.rotation.z = q_c2co.getZ();
-      c2co_msg.transform.rotation.w = q_c2co.getW();
-      _static_tf_broadcaster_->sendTransform(c2co_msg);
+  void triggerCapture(
+    const std::shared_ptr<TriggerCapture::Request> request,
+    std::shared_ptr<TriggerCapture::Response> response)
+  {
+    response->success = false;
+    if (0 == request->frame_count) {
+      response->message = "frame_count must be positive";
+      return;
+    }
+    std::lock_guard<std::mutex> capture_lock(_capture_mutex);
+    if (!_streaming) {
+      response->message = "Node is not active";
+      return;
     }
 
-    if (_enable[DEPTH]) {
-      rs2::stream_profile depth_profile;
-      if (!getEnabledProfile(DEPTH, depth_profile)) {
-        RCLCPP_ERROR(logger_, "Depth profile not found!");
-        rclcpp::shutdown();
-        exit(1);
+    {
+      std::lock_guard<std::mutex> lock(_trigger_mutex);
+      _trigger_start = std::chrono::steady_clock::now();
+      _trigger_warmup = _trigger_warmup_frames;
+      _trigger_published = 0;
+      _trigger_first_ms = 0.0;
+      _trigger_last_ms = 0.0;
+      _trigger_cancelled = false;
+      _trigger_remaining.store(request->frame_count, std::memory_order_release);
+    }
+    auto stop_sensors = [this]()
+      {
+        for (auto & stream : _opened_sensors) {
+          if (GYRO != stream) {
+            try {
+              _sensors[stream]->stop();
+            } catch (const rs2::error &) {
+            }
+          }
+        }
+      };
+    if (_trigger_stop_sensors) {
+      try {
+        for (auto & stream : _opened_sensors) {
+          if (GYRO != stream) {
+            _sensors[stream]->start(_route_callback);
+          }
+        }
+      } catch (const rs2::error & e) {
+        RCLCPP_ERROR(logger_, "Failed to start sensors for a trigger: %s", e.what());
+        response->message = e.what();
+        _trigger_remaining = 0;
+        stop_sensors();
+        return;
       }
-      if (true == _enable[INFRA1]) {
-        auto d2ir1_extrinsics = depth_profile.get_extrinsics_to(_enabled_profiles[INFRA1].front());
-        auto q = rotationMatrixToQuaternion(d2ir1_extrinsics.rotation);
+    }
 
-        // Transform base frame to infra1
-        b2ir1_msg.header.stamp = transform_ts_;
-        b2ir1_msg.header.frame_id = _base_frame_id;
-        b2ir1_msg.child_frame_id = _frame_id[INFRA1];
-        b2ir1_msg.transform.translation.x = d2ir1_extrinsics.translation[2];
-        b2ir1_msg.transform.translation.y = -d2ir1_extrinsics.translation[0];
-        b2ir1_msg.transform.translation.z = -d2ir1_extrinsics.translation[1];
+    auto frame_ms = 1000 / std::max(1, _fps[_trigger_stream]);
+    auto timeout = std::chrono::milliseconds(_trigger_timeout_ms +
+        (request->frame_count + _trigger_warmup_frames) * frame_ms);
+    auto cancelled = false;
+    {
+      std::unique_lock<std::mutex> lock(_trigger_mutex);
+      response->success = _trigger_cv.wait_for(lock, timeout,
+          [this]() {return 0 == _trigger_remaining.load() || _trigger_cancelled;});
+      cancelled = _trigger_cancelled;
+      response->success = response->success && !cancelled;
+      _trigger_remaining = 0;
+      response->published = _trigger_published;
+      response->first_latency_ms = _trigger_first_ms;
+      response->last_latency_ms = _trigger_last_ms;
+    }
+    if (_trigger_stop_sensors) {
+      stop_sensors();
+    }
 
-        b2ir1_msg.transform.rotation.x = q.x();
-        b2ir1_msg.transform.rotation.y = q.y();
-        b2ir1_msg.transform.rotation.z = q.z();
-        b2ir1_msg.transform.rotation.w = q.w();
-        _static_tf_broadcaster_->sendTransform(b2ir1_msg);
+    if (!response->success) {
+      response->message = cancelled ? "Cancelled by a lifecycle transition" : "Timed out";
+      RCLCPP_WARN(logger_, "Trigger published %u of %u framesets: %s", response->published,
+        request->frame_count, response->message.c_str());
+      return;
+    }
+    RCLCPP_INFO(logger_, "Trigger published %u framesets - first after %.1f ms, last after "
+      "%.1f ms", response->published, response->first_latency_ms, response->last_latency_ms);
+  }
 
-        // Transform infra1 frame to infra1 optical frame
-        ir1_2_ir1o.setRPY(-M_PI / 2, 0.0, -M_PI / 2);
-        ir1_2_ir1o_msg.header.stamp = transform_ts_;
-        ir1_2_ir1o_msg.header.frame_id = _frame_id[INFRA1];
-        ir1_2_ir1o_msg.child_frame_id = _optical_frame_id[INFRA1];
-        ir1_2_ir1o_msg.transform.translation.x = 0;
-        ir1_2_ir1o_msg.transform.translation.y = 0;
-        ir1_2_ir1o_msg.transform.translation.z = 0;
-        ir1_2_ir1o_msg.transform.rotation.x = ir1_2_ir1o.getX();
-        ir1_2_ir1o_msg.transform.rotation.y = ir1_2_ir1o.getY();
-        ir1_2_ir1o_msg.transform.rotation.z = ir1_2_ir1o.getZ();
-        ir1_2_ir1o_msg.transform.rotation.w = ir1_2_ir1o.getW();
-        _static_tf_broadcaster_->sendTransform(ir1_2_ir1o_msg);
+  // Profile of stream with the given resolution and the fastest frame rate, so the snapshot
+  // waits as little as possible. A width and height of 0 select the largest resolution.
+  rs2::stream_profile findSnapshotProfile(
+    const stream_index_pair & stream, uint32_t width,
+    uint32_t height)
+  {
+    rs2::video_stream_profile best;
+    for (auto & profile : _sensors[stream]->get_stream_profiles()) {
+      auto video_profile = profile.as<rs2::video_stream_profile>();
+      if (!video_profile || video_profile.format() != _format[stream] ||
+        video_profile.stream_index() != stream.second)
+      {
+        continue;
       }
+      if (0 != width || 0 != height) {
+        if (static_cast<uint32_t>(video_profile.width()) != width ||
+          static_cast<uint32_t>(video_profile.height()) != height)
+        {
+          continue;
+        }
+        if (!best || video_profile.fps() > best.fps()) {
+          best = video_profile;
+        }
+      } else if (!best || video_profile.width() * video_profile.height() >
+        best.width() * best.height() ||
+        (video_profile.width() * video_profile.height() == best.width() * best.height() &&
+        video_profile.fps() > best.fps()))
+      {
+        best = video_profile;
+      }
+    }
+    return best;
+  }
 
-      if (true == _enable[INFRA2]) {
-        auto d2ir2_extrinsics = depth_profile.get_extrinsics_to(_enabled_profiles[INFRA2].front());
-        auto q = rotationMatrixToQuaternion(d2ir2_extrinsics.rotation);
-
-        // Transform base frame to infra2
-        b2ir2_msg.header.stamp = transform_ts_;
-        b2ir2_msg.header.frame_id = _base_frame_id;
-        b2ir2_msg.child_frame_id = _frame_id[INFRA2];
-        b2ir2_msg.transform.translation.x = d2ir2_extrinsics.translation[2];
-        b2ir2_msg.transform.translation.y = -d2ir2_extrinsics.translation[0];
-        b2ir2_msg.transform.translation.z = -d2ir2_extrinsics.translation[1];
-        b2ir2_msg.transform.rotation.x = q.x();
-        b2ir2_msg.transform.rotation.y = q.y();
-        b2ir2_msg.transform.rotation.z = q.z();
-        b2ir2_msg.transform.rotation.w = q.w();
-        _static_tf_broadcaster_->sendTransform(b2ir2_msg);
-
-        // Transform infra2 frame to infra1 optical frame
-        ir2_2_ir2o.setRPY(-M_PI / 2, 0.0, -M_PI / 2);
-        ir2_2_ir2o_msg.header.stamp = transform_ts_;
-        ir2_2_ir2o_msg.header.frame_id = _frame_id[INFRA2];
-        ir2_2_ir2o_msg.child_frame_id = _optical_frame_id[INFRA2];
-        ir2_2_ir2o_msg.transform.translation.x = 0;
-        ir2_2_ir2o_msg.transform.translation.y = 0;
-        ir2_2_ir2o_msg.transform.translation.z = 0;
-        ir2_2_ir2o_msg.transform.rotation.x = ir2_2_ir2o.getX();
-        ir2_2_ir2o_msg.transform.rotation.y = ir2_2_ir2o.getY();
-        ir2_2_ir2o_msg.transform.rotation.z = ir2_2_ir2o.getZ();
-        ir2_2_ir2o_msg.transform.rotation.w = ir2_2_ir2o.getW();
-        _static_tf_broadcaster_->sendTransform(ir2_2_ir2o_msg);
+  // Profiles the sensor of stream is opened with while streaming.
+  std::vector<rs2::stream_profile> streamingProfiles(const stream_index_pair & stream)
+  {
+    std::vector<rs2::stream_profile> profiles;
+    for (auto & streams : IMAGE_STREAMS) {
+      if (streams.front() != stream) {
+        continue;
+      }
+      for (auto & elem : streams) {
+        if (!_enabled_profiles[elem].empty()) {
+          profiles.insert(profiles.begin(),
+            _enabled_profiles[elem].begin(),
+            _enabled_profiles[elem].end());
+        }
       }
     }
-    // Publish Fisheye TF
+    return profiles;
   }
 
-  void alignFrame(
-    const rs2_intrinsics & from_intrin,
-    const rs2_intrinsics & other_intrin,
-    rs2::frame from_image,
-    uint32_t output_image_bytes_per_pixel,
-    const rs2_extrinsics & from_to_other,
-    std::vector<uint8_t> & out_vec)
-  {
-    static const auto meter_to_mm = 0.001f;
-    uint8_t * p_out_frame = out_vec.data();
-
-    static const auto blank_color = 0x00;
-    memset(p_out_frame, blank_color,
-      other_intrin.height * other_intrin.width * output_image_bytes_per_pixel);
-
-    auto p_from_frame = reinterpret_cast<const uint8_t *>(from_image.get_data());
-    auto from_stream_type = from_image.get_profile().stream_type();
-    float depth_units = ((from_stream_type == RS2_STREAM_DEPTH) ? _depth_scale_meters : 1.f);
-    for (int from_y = 0; from_y < from_intrin.height; ++from_y) {
-      int from_pixel_index = from_y * from_intrin.width;
-      for (int from_x = 0; from_x < from_intrin.width; ++from_x, ++from_pixel_index) {
-        // Skip over depth pixels with the value of zero
-        float depth =
-          (from_stream_type ==
-          RS2_STREAM_DEPTH) ? (depth_units *
-          ((const uint16_t *)p_from_frame)[from_pixel_index]) : 1.f;
-        if (depth) {
-          // Map the top-left corner of the depth pixel onto the other image
-          float from_pixel[2] = {from_x - 0.5f, from_y - 0.5f}, from_point[3], other_point[3],
-            other_pixel[2];
-          rs2_deproject_pixel_to_point(from_point, &from_intrin, from_pixel, depth);
-          rs2_transform_point_to_point(other_point, &from_to_other, from_point);
-          rs2_project_point_to_pixel(other_pixel, &other_intrin, other_point);
-          const int other_x0 = static_cast<int>(other_pixel[0] + 0.5f);
-          const int other_y0 = static_cast<int>(other_pixel[1] + 0.5f);
-
-          // Map the bottom-right corner of the depth pixel onto the other image
-          from_pixel[0] = from_x + 0.5f; from_pixel[1] = from_y + 0.5f;
-          rs2_deproject_pixel_to_point(from_point, &from_intrin, from_pixel, depth);
-          rs2_transform_point_to_point(other_point, &from_to_other, from_point);
-          rs2_project_point_to_pixel(other_pixel, &other_intrin, other_point);
-          const int other_x1 = static_cast<int>(other_pixel[0] + 0.5f);
-          const int other_y1 = static_cast<int>(other_pixel[1] + 0.5f);
-
-          if (other_x0 < 0 || other_y0 < 0 || other_x1 >= other_intrin.width ||
-            other_y1 >= other_intrin.height)
-          {
-            continue;
-          }
+  void captureSnapshot(
+    const std::shared_ptr<CaptureSnapshot::Request> request,
+    std::shared_ptr<CaptureSnapshot::Response> response)
+  {
+    response->success = false;
+    std::lock_guard<std::mutex> capture_lock(_capture_mutex);
+    std::map<stream_index_pair, rs2::video_stream_profile> profiles;
+    for (auto & stream : {DEPTH, COLOR}) {
+      if (_enabled_profiles[stream].empty()) {
+        continue;
+      }
+      auto width = (DEPTH == stream) ? request->depth_width : request->color_width;
+      auto height = (DEPTH == stream) ? request->depth_height : request->color_height;
+      auto profile = findSnapshotProfile(stream, width, height);
+      if (!profile) {
+        std::stringstream message;
+        message << "No " << _stream_name[stream] << " profile of " << width << "x" << height;
+        response->message = message.str();
+        return;
+      }
+      profiles[stream] = profile.as<rs2::video_stream_profile>();
+    }
+    if (profiles.empty()) {
+      response->message = "Depth and color streams are disabled";
+      return;
+    }
 
-          for (int y = other_y0; y <= other_y1; ++y) {
-            for (int x = other_x0; x <= other_x1; ++x) {
-              int out_pixel_index = y * other_intrin.width + x;
-              auto p_from_depth_frame = reinterpret_cast<const uint16_t *>(p_from_frame);
-              auto p_out_depth_frame = reinterpret_cast<uint16_t *>(p_out_frame);
-              p_out_depth_frame[out_pixel_index] = p_from_depth_frame[from_pixel_index] *
-                (  depth_units / meter_to_mm);
-            }
+    // Snapshot frames: the first frames after a restart are skipped to let auto exposure settle,
+    // then the newest frame of each stream is kept until they all match in time.
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::map<stream_index_pair, rs2::frame> frames;
+    std::map<stream_index_pair, int> skipped;
+    auto snapshot_callback = [&](rs2::frame frame)
+      {
+        auto profile = frame.get_profile();
+        stream_index_pair stream{profile.stream_type(), profile.stream_index()};
+        std::lock_guard<std::mutex> lock(mutex);
+        if (skipped[stream] < _snapshot_warmup_frames) {
+          ++skipped[stream];
+          return;
+        }
+        frames[stream] = frame;
+        cv.notify_one();
+      };
+    auto min_fps = std::numeric_limits<int>::max();
+    for (auto & profile : profiles) {
+      min_fps = std::min(min_fps, profile.second.fps());
+    }
+    // Half of the longest frame period
+    auto tolerance_ms = 500.0 / min_fps;
+    auto matched = [&]() {
+        if (frames.size() != profiles.size()) {
+          return false;
+        }
+        auto oldest = std::numeric_limits<double>::max();
+        auto newest = std::numeric_limits<double>::lowest();
+        for (auto & frame : frames) {
+          oldest = std::min(oldest, frame.second.get_timestamp());
+          newest = std::max(newest, frame.second.get_timestamp());
+        }
+        return newest - oldest <= tolerance_ms;
+      };
+
+    // Between triggers the image sensors of triggered capture are not streaming.
+    auto streaming = _streaming && !_trigger_stop_sensors;
+    // Restarting a sensor interrupts all of its streams, infra1 and infra2 with depth.
+    std::map<stream_index_pair, std::chrono::steady_clock::time_point> stopped;
+    auto captured = false;
+    try {
+      for (auto & profile : profiles) {
+        auto & sens = _sensors[profile.first];
+        if (streaming) {
+          sens->stop();
+          stopped[profile.first] = std::chrono::steady_clock::now();
+        }
+        sens->close();
+        sens->open(profile.second);
+        sens->start(snapshot_callback);
+      }
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        captured = cv.wait_for(lock, std::chrono::milliseconds(_snapshot_timeout_ms), matched);
+      }
+      for (auto & profile : profiles) {
+        auto & sens = _sensors[profile.first];
+        sens->stop();
+        sens->close();
+        sens->open(streamingProfiles(profile.first));
+        if (streaming) {
+          sens->start(_route_callback);
+          auto gap_ms = elapsedMs(stopped[profile.first]);
+          for (auto & stream_profile : streamingProfiles(profile.first)) {
+            stream_index_pair stream{stream_profile.stream_type(), stream_profile.stream_index()};
+            response->interrupted_streams.push_back(_stream_name[stream]);
+            response->stream_gaps_ms.push_back(gap_ms);
+            response->streaming_gap_ms = std::max(response->streaming_gap_ms, gap_ms);
           }
         }
       }
+    } catch (const rs2::error & e) {
+      RCLCPP_ERROR(logger_, "Snapshot failed: %s", e.what());
+      response->message = e.what();
+      // The snapshot callback must not outlive this call. Restore streaming as far as possible.
+      for (auto & profile : profiles) {
+        auto & sens = _sensors[profile.first];
+        try {
+          sens->stop();
+        } catch (const rs2::error &) {
+        }
+        try {
+          sens->close();
+          sens->open(streamingProfiles(profile.first));
+          if (streaming) {
+            sens->start(_route_callback);
+          }
+        } catch (const rs2::error &) {
+        }
+      }
+      return;
+    }
+
+    if (!captured) {
+      response->message = "Timed out waiting for a synchronized frameset";
+      RCLCPP_WARN(logger_, "Snapshot timed out, streaming gap %.1f ms",
+        response->streaming_gap_ms);
+      return;
+    }
+
+    for (auto & frame : frames) {
+      auto & stream = frame.first;
+      auto video_frame = frame.second.as<rs2::video_frame>();
+      auto intrinsics = profiles[stream].get_intrinsics();
+      rclcpp::Time t = _ros_clock.now();
+      if (_intialize_time_base) {
+        t = rclcpp::Time(_ros_time_base.nanoseconds() +
+            static_cast<int64_t>((video_frame.get_timestamp() - _camera_time_base) * 1000000),
+            RCL_ROS_TIME);
+      }
+
+      auto & img = (DEPTH == stream) ? response->depth : response->color;
+      img.header.frame_id = _optical_frame_id[stream];
+      img.header.stamp = t;
+      img.width = video_frame.get_width();
+      img.height = video_frame.get_height();
+      img.encoding = (DEPTH == stream) ? _encoding[DEPTH] : sensor_msgs::image_encodings::RGB8;
+      img.is_bigendian = false;
+      img.step = video_frame.get_stride_in_bytes();
+      auto data = reinterpret_cast<const uint8_t *>(video_frame.get_data());
+      img.data.assign(data, data + img.step * img.height);
+
+      auto & info = (DEPTH == stream) ? response->depth_info : response->color_info;
+      info = _camera_info[stream];
+      info.header = img.header;
+      info.width = intrinsics.width;
+      info.height = intrinsics.height;
+      info.k.at(0) = info.p.at(0) = intrinsics.fx;
+      info.k.at(2) = info.p.at(2) = intrinsics.ppx;
+      info.k.at(4) = info.p.at(5) = intrinsics.fy;
+      info.k.at(5) = info.p.at(6) = intrinsics.ppy;
+      info.d.assign(intrinsics.coeffs, intrinsics.coeffs + 5);
     }
+    response->success = true;
+    RCLCPP_INFO(logger_, "Snapshot captured - depth %ux%u, color %ux%u, streaming gap %.1f ms",
+      response->depth.width, response->depth.height, response->color.width,
+      response->color.height, response->streaming_gap_ms);
   }
 
-  rs2_extrinsics getRsExtrinsics(
-    const stream_index_pair & from_stream,
-    const stream_index_pair & to_stream)
+  int32_t findClusterRoot(int32_t i)
   {
-    auto & from = _enabled_profiles[from_stream].front();
-    auto & to = _enabled_profiles[to_stream].front();
-    return from.get_extrinsics_to(to);
+    while (_cluster_parent[i] != i) {
+      // Path halving
+      _cluster_parent[i] = _cluster_parent[_cluster_parent[i]];
+      i = _cluster_parent[i];
+    }
+    return i;
   }
 
-  void publishAlignedDepthImg(rs2::frame depth_frame, const rclcpp::Time & t)
+  void joinClusterCells(int32_t a, int32_t b, float max_distance2)
   {
-    rs2::align align(RS2_STREAM_COLOR);
-    _aligned_frameset = depth_frame.apply_filter(align);
-    rs2::depth_frame aligned_depth = _aligned_frameset.get_depth_frame();
-    RCLCPP_DEBUG(logger_, "aligned done!");
-
-    auto vf = aligned_depth.as<rs2::video_frame>();
-    auto depth_image = cv::Mat(cv::Size(vf.get_width(), vf.get_height()), _image_format[DEPTH],
-        const_cast<void *>(vf.get_data()), cv::Mat::AUTO_STEP);
-
-    sensor_msgs::msg::Image::SharedPtr img;
-    auto info_msg = _camera_info[DEPTH];
-    img = cv_bridge::CvImage(
-      std_msgs::msg::Header(), sensor_msgs::image_encodings::TYPE_16UC1, depth_image).toImageMsg();
-    auto image = aligned_depth.as<rs2::video_frame>();
-    auto bpp = image.get_bytes_per_pixel();
-    auto height = image.get_height();
-    auto width = image.get_width();
-    img->width = width;
-    img->height = height;
-    img->is_bigendian = false;
-    img->step = width * bpp;
-    img->header.frame_id = _optical_frame_id[COLOR];
-    img->header.stamp = t;
-    _align_depth_publisher.publish(img);
-    _align_depth_camera_publisher->publish(info_msg);
+    if (_cluster_parent[b] < 0 ||
+      (_cluster_points[a] - _cluster_points[b]).squaredNorm() > max_distance2)
+    {
+      return;
+    }
+    auto root_a = findClusterRoot(a);
+    auto root_b = findClusterRoot(b);
+    // The smaller index becomes the root.
+    if (root_a < root_b) {
+      _cluster_parent[root_b] = root_a;
+    } else {
+      _cluster_parent[root_a] = root_b;
+    }
   }
 
   void publishPCTopic(const rclcpp::Time & t)
   {
-    auto color_intrinsics = _stream_intrinsics[COLOR];
-    auto image_depth16 = reinterpret_cast<const uint16_t *>(_image[DEPTH].data);
+    RT_AUDIT_SCOPE("publish_pointcloud");
+    auto start = std::chrono::steady_clock::now();
     auto depth_intrinsics = _stream_intrinsics[DEPTH];
+    if (_serialized_publish) {
+      CdrWriter cdr(_pointcloud_serialized,
+        serializedXYZRGBCloudSize(_optical_frame_id[DEPTH], depth_intrinsics.width,
+        depth_intrinsics.height));
+      auto data = beginSerializedXYZRGBCloud(cdr, t, _optical_frame_id[DEPTH],
+          depth_intrinsics.width, depth_intrinsics.height);
+      fillPointCloudRows(data, 0, depth_intrinsics.height);
+      endSerializedXYZRGBCloud(cdr);
+      _pointcloud_publisher->publish(_pointcloud_serialized);
+      recordProduct(PRODUCT_POINTCLOUD,
+        _pointcloud_serialized.get_rcl_serialized_message().buffer_length, start);
+      benchmarkSerialization<sensor_msgs::msg::PointCloud2>("depth/color/points",
+        _pointcloud_serialized, elapsedMs(start));
+      return;
+    }
+
     sensor_msgs::msg::PointCloud2 msg_pointcloud;
     msg_pointcloud.header.stamp = t;
     msg_pointcloud.header.frame_id = _optical_frame_id[DEPTH];
-    msg_pointcloud.width = depth_intrinsics.width;
-    msg_pointcloud.height = depth_intrinsics.height;
+    initXYZRGBCloud(msg_pointcloud, depth_intrinsics.width, depth_intrinsics.height);
+    fillPointCloudRows(msg_pointcloud.data.data(), 0, depth_intrinsics.height);
+    _pointcloud_publisher->publish(msg_pointcloud);
+    recordProduct(PRODUCT_POINTCLOUD, msg_pointcloud.data.size(), start);
+  }
+
+  // Publish the depth point cloud as horizontal bands of _pointcloud_band_rows rows, each band
+  // sent as soon as it is filled so consumers can start before the whole frame is processed.
+  void publishPCBands(
+    const rclcpp::Time & t, uint64_t frame_number,
+    const std::chrono::steady_clock::time_point & frame_arrival)
+  {
+    auto height = _stream_intrinsics[DEPTH].height;
+    auto band_rows = _pointcloud_band_rows;
+    auto band_count = (height + band_rows - 1) / band_rows;
+
+    for (int i = 0; i < band_count; ++i) {
+      auto band_index = _pointcloud_bands_bottom_up ? (band_count - 1 - i) : i;
+      auto row_begin = band_index * band_rows;
+      auto row_end = std::min(row_begin + band_rows, height);
+
+      auto band_start = std::chrono::steady_clock::now();
+      PointCloudBand band;
+      band.header.stamp = t;
+      band.header.frame_id = _optical_frame_id[DEPTH];
+      band.frame_number = frame_number;
+      band.band_index = band_index;
+      band.band_count = band_count;
+      band.row_offset = row_begin;
+      band.cloud.header = band.header;
+      initXYZRGBCloud(band.cloud, _stream_intrinsics[DEPTH].width, row_end - row_begin);
+      fillPointCloudRows(band.cloud.data.data(), row_begin, row_end);
+      _pointcloud_band_publisher->publish(band);
+      recordProduct(PRODUCT_POINTCLOUD_BANDS, band.cloud.data.size(), band_start);
+
+      if (0 == i) {
+        _first_band_latency.add(elapsedMs(frame_arrival));
+      }
+    }
+    _full_bands_latency.add(elapsedMs(frame_arrival));
+
+    if (_full_bands_latency.count() >= STATS_REPORT_FRAMES) {
+      RCLCPP_INFO(logger_,
+        "Point cloud bands latency over %d frames - first band: %.2f ms (max %.2f), "
+        "full frame: %.2f ms (max %.2f)",
+        _full_bands_latency.count(), _first_band_latency.mean(), _first_band_latency.max(),
+        _full_bands_latency.mean(), _full_bands_latency.max());
+      _first_band_latency.reset();
+      _full_bands_latency.reset();
+    }
+  }
+
+  // Set up an organized XYZRGB cloud; the layout matches XYZRGB_POINT_STEP and its offsets.
+  void initXYZRGBCloud(sensor_msgs::msg::PointCloud2 & msg_pointcloud, int width, int height)
+  {
+    msg_pointcloud.width = width;
+    msg_pointcloud.height = height;
     msg_pointcloud.is_dense = true;
 
     sensor_msgs::PointCloud2Modifier modifier(msg_pointcloud);
@@ -1062,21 +5073,24 @@ private:
       "z", 1, sensor_msgs::msg::PointField::FLOAT32,
       "rgb", 1, sensor_msgs::msg::PointField::FLOAT32);
     modifier.setPointCloud2FieldsByString(2, "xyz", "rgb");
+  }
 
-    sensor_msgs::PointCloud2Iterator<float> iter_x(msg_pointcloud, "x");
-    sensor_msgs::PointCloud2Iterator<float> iter_y(msg_pointcloud, "y");
-    sensor_msgs::PointCloud2Iterator<float> iter_z(msg_pointcloud, "z");
-
-    sensor_msgs::PointCloud2Iterator<uint8_t> iter_r(msg_pointcloud, "r");
-    sensor_msgs::PointCloud2Iterator<uint8_t> iter_g(msg_pointcloud, "g");
-    sensor_msgs::PointCloud2Iterator<uint8_t> iter_b(msg_pointcloud, "b");
+  // Write the XYZRGB points of depth rows [row_begin, row_end) to data.
+  void fillPointCloudRows(uint8_t * data, int row_begin, int row_end)
+  {
+    auto color_intrinsics = _stream_intrinsics[COLOR];
+    auto depth_intrinsics = _stream_intrinsics[DEPTH];
+    auto image_depth16 = reinterpret_cast<const uint16_t *>(_image[DEPTH].data) +
+      row_begin * depth_intrinsics.width;
 
     float depth_point[3], color_point[3], color_pixel[2], scaled_depth;
     unsigned char * color_data = _image[COLOR].data;
 
     // Fill the PointCloud2 fields
-    for (int y = 0; y < depth_intrinsics.height; ++y) {
+    for (int y = row_begin; y < row_end; ++y) {
       for (int x = 0; x < depth_intrinsics.width; ++x) {
+        // The padding goes out on the wire and serialized buffers are reused: clear it.
+        memset(data, 0, XYZRGB_POINT_STEP);
         scaled_depth = static_cast<float>(*image_depth16) * _depth_scale_meters;
         float depth_pixel[2] = {static_cast<float>(x), static_cast<float>(y)};
         rs2_deproject_pixel_to_point(depth_point, &depth_intrinsics, depth_pixel, scaled_depth);
@@ -1087,70 +5101,73 @@ private:
           depth_point[2] = 0.f;
         }
 
-        *iter_x = depth_point[0];
-        *iter_y = depth_point[1];
-        *iter_z = depth_point[2];
+        memcpy(data, depth_point, sizeof(depth_point));
 
         rs2_transform_point_to_point(color_point, &_depth2color_extrinsics, depth_point);
         rs2_project_point_to_pixel(color_pixel, &color_intrinsics, color_point);
 
+        auto rgb = data + XYZRGB_RGB_OFFSET;
         if (color_pixel[1] < 0.f || color_pixel[1] > color_intrinsics.height ||
           color_pixel[0] < 0.f || color_pixel[0] > color_intrinsics.width)
         {
           // For out of bounds color data, default to a shade of blue in order to visually
           // distinguish holes. This color value is same as the librealsense out of bounds color
           // value.
-          *iter_r = static_cast<uint8_t>(96);
-          *iter_g = static_cast<uint8_t>(157);
-          *iter_b = static_cast<uint8_t>(198);
+          rgb[2] = static_cast<uint8_t>(96);
+          rgb[1] = static_cast<uint8_t>(157);
+          rgb[0] = static_cast<uint8_t>(198);
         } else {
           auto i = static_cast<int>(color_pixel[0]);
           auto j = static_cast<int>(color_pixel[1]);
 
           auto offset = i * 3 + j * color_intrinsics.width * 3;
-          *iter_r = static_cast<uint8_t>(color_data[offset]);
-          *iter_g = static_cast<uint8_t>(color_data[offset + 1]);
-          *iter_b = static_cast<uint8_t>(color_data[offset + 2]);
+          rgb[2] = static_cast<uint8_t>(color_data[offset]);
+          rgb[1] = static_cast<uint8_t>(color_data[offset + 1]);
+          rgb[0] = static_cast<uint8_t>(color_data[offset + 2]);
         }
 
         ++image_depth16;
-        ++iter_x; ++iter_y; ++iter_z;
-        ++iter_r; ++iter_g; ++iter_b;
+        data += XYZRGB_POINT_STEP;
       }
     }
-    _pointcloud_publisher->publish(msg_pointcloud);
   }
 
   void publishAlignedPCTopic(const rclcpp::Time & t)
   {
-    rs2::depth_frame aligned_depth = _aligned_frameset.get_depth_frame();
-
-    auto image_depth16 = reinterpret_cast<const uint16_t *>(aligned_depth.get_data());
+    RT_AUDIT_SCOPE("publish_aligned_pointcloud");
+    auto start = std::chrono::steady_clock::now();
     auto depth_intrinsics = _stream_intrinsics[COLOR];
-    unsigned char * color_data = _image[COLOR].data;
+    if (_serialized_publish) {
+      CdrWriter cdr(_align_pointcloud_serialized,
+        serializedXYZRGBCloudSize(_optical_frame_id[COLOR], depth_intrinsics.width,
+        depth_intrinsics.height));
+      auto data = beginSerializedXYZRGBCloud(cdr, t, _optical_frame_id[COLOR],
+          depth_intrinsics.width, depth_intrinsics.height);
+      fillAlignedPointCloud(data);
+      endSerializedXYZRGBCloud(cdr);
+      _align_pointcloud_publisher->publish(_align_pointcloud_serialized);
+      recordProduct(PRODUCT_ALIGNED_POINTCLOUD,
+        _align_pointcloud_serialized.get_rcl_serialized_message().buffer_length, start);
+      benchmarkSerialization<sensor_msgs::msg::PointCloud2>(
+        "aligned_depth_to_color/color/points", _align_pointcloud_serialized, elapsedMs(start));
+      return;
+    }
+
     sensor_msgs::msg::PointCloud2 msg_pointcloud;
     msg_pointcloud.header.stamp = t;
     msg_pointcloud.header.frame_id = _optical_frame_id[COLOR];
-    msg_pointcloud.width = depth_intrinsics.width;
-    msg_pointcloud.height = depth_intrinsics.height;
-    msg_pointcloud.is_dense = true;
-
-    sensor_msgs::PointCloud2Modifier modifier(msg_pointcloud);
-
-    modifier.setPointCloud2Fields(3,
-      "x", 1, sensor_msgs::msg::PointField::FLOAT32,
-      "y", 1, sensor_msgs::msg::PointField::FLOAT32,
-      "z", 1, sensor_msgs::msg::PointField::FLOAT32,
-      "rgb", 1, sensor_msgs::msg::PointField::FLOAT32);
-    modifier.setPointCloud2FieldsByString(2, "xyz", "rgb");
-
-    sensor_msgs::PointCloud2Iterator<float> iter_x(msg_pointcloud, "x");
-    sensor_msgs::PointCloud2Iterator<float> iter_y(msg_pointcloud, "y");
-    sensor_msgs::PointCloud2Iterator<float> iter_z(msg_pointcloud, "z");
+    initXYZRGBCloud(msg_pointcloud, depth_intrinsics.width, depth_intrinsics.height);
+    fillAlignedPointCloud(msg_pointcloud.data.data());
+    _align_pointcloud_publisher->publish(msg_pointcloud);
+    recordProduct(PRODUCT_ALIGNED_POINTCLOUD, msg_pointcloud.data.size(), start);
+  }
 
-    sensor_msgs::PointCloud2Iterator<uint8_t> iter_r(msg_pointcloud, "r");
-    sensor_msgs::PointCloud2Iterator<uint8_t> iter_g(msg_pointcloud, "g");
-    sensor_msgs::PointCloud2Iterator<uint8_t> iter_b(msg_pointcloud, "b");
+  // Write the XYZRGB points of the depth image aligned to color to data.
+  void fillAlignedPointCloud(uint8_t * data)
+  {
+    auto image_depth16 = _aligned_depth_data;
+    auto depth_intrinsics = _stream_intrinsics[COLOR];
+    unsigned char * color_data = _image[COLOR].data;
 
     float std_nan = std::numeric_limits<float>::quiet_NaN();
     float depth_point[3], scaled_depth;
@@ -1158,32 +5175,119 @@ private:
     // Fill the PointCloud2 fields
     for (int y = 0; y < depth_intrinsics.height; ++y) {
       for (int x = 0; x < depth_intrinsics.width; ++x) {
+        memset(data, 0, XYZRGB_POINT_STEP);
         scaled_depth = static_cast<float>(*image_depth16) * _depth_scale_meters;
         float depth_pixel[2] = {static_cast<float>(x), static_cast<float>(y)};
         rs2_deproject_pixel_to_point(depth_point, &depth_intrinsics, depth_pixel, scaled_depth);
-        auto iter_offset = x + y * depth_intrinsics.width;
+        auto offset = x + y * depth_intrinsics.width;
+        auto rgb = data + XYZRGB_RGB_OFFSET;
 
         if (depth_point[2] <= 0.f || depth_point[2] > 5.f) {
-          *(iter_x + iter_offset) = std_nan;
-          *(iter_y + iter_offset) = std_nan;
-          *(iter_z + iter_offset) = std_nan;
-          *(iter_r + iter_offset) = static_cast<uint8_t>(96);
-          *(iter_g + iter_offset) = static_cast<uint8_t>(157);
-          *(iter_b + iter_offset) = static_cast<uint8_t>(198);
+          float nan_point[3] = {std_nan, std_nan, std_nan};
+          memcpy(data, nan_point, sizeof(nan_point));
+          rgb[2] = static_cast<uint8_t>(96);
+          rgb[1] = static_cast<uint8_t>(157);
+          rgb[0] = static_cast<uint8_t>(198);
         } else {
-          *(iter_x + iter_offset) = depth_point[0];
-          *(iter_y + iter_offset) = depth_point[1];
-          *(iter_z + iter_offset) = depth_point[2];
-          *(iter_r + iter_offset) = color_data[iter_offset * 3];
-          *(iter_g + iter_offset) = color_data[iter_offset * 3 + 1];
-          *(iter_b + iter_offset) = color_data[iter_offset * 3 + 2];
+          memcpy(data, depth_point, sizeof(depth_point));
+          rgb[2] = color_data[offset * 3];
+          rgb[1] = color_data[offset * 3 + 1];
+          rgb[0] = color_data[offset * 3 + 2];
         }
 
         ++image_depth16;
+        data += XYZRGB_POINT_STEP;
       }
     }
+  }
 
-    _align_pointcloud_publisher->publish(msg_pointcloud);
+  size_t serializedXYZRGBCloudSize(const std::string & frame_id, int width, int height) const
+  {
+    // Header, dimensions and the four point fields fit comfortably in 256 bytes.
+    return 256 + frame_id.size() + static_cast<size_t>(width) * height * XYZRGB_POINT_STEP;
+  }
+
+  // Write a sensor_msgs/PointCloud2 with the XYZRGB layout up to its data field, and return
+  // the data field so points can be filled directly into the serialized buffer.
+  uint8_t * beginSerializedXYZRGBCloud(
+    CdrWriter & cdr, const rclcpp::Time & t, const std::string & frame_id,
+    uint32_t width, uint32_t height)
+  {
+    static const char * field_names[] = {"x", "y", "z", "rgb"};
+    static const uint32_t field_offsets[] = {0, 4, 8, XYZRGB_RGB_OFFSET};
+
+    builtin_interfaces::msg::Time stamp = t;
+    cdr.write(stamp.sec);
+    cdr.write(stamp.nanosec);
+    cdr.write(frame_id);
+    cdr.write(height);
+    cdr.write(width);
+    cdr.write(static_cast<uint32_t>(4));
+    for (int i = 0; i < 4; ++i) {
+      cdr.write(std::string(field_names[i]));
+      cdr.write(field_offsets[i]);
+      cdr.write(static_cast<uint8_t>(sensor_msgs::msg::PointField::FLOAT32));
+      cdr.write(static_cast<uint32_t>(1));
+    }
+    cdr.write(static_cast<uint8_t>(false));  // is_bigendian
+    cdr.write(XYZRGB_POINT_STEP);
+    cdr.write(width * XYZRGB_POINT_STEP);
+    auto data_size = width * height * XYZRGB_POINT_STEP;
+    cdr.write(data_size);
+    return cdr.reserve(data_size);
+  }
+
+  void endSerializedXYZRGBCloud(CdrWriter & cdr)
+  {
+    cdr.write(static_cast<uint8_t>(true));  // is_dense
+    cdr.finish();
+  }
+
+  // Publish camera info from the serialization cached by updateStreamCalibData, patching only
+  // header.stamp.
+  void publishSerializedCameraInfo(
+    const stream_index_pair & stream, const rclcpp::Time & t,
+    const rclcpp::Publisher<sensor_msgs::msg::CameraInfo>::SharedPtr & publisher)
+  {
+    auto start = std::chrono::steady_clock::now();
+    auto & serialized = _camera_info_serialized.at(stream);
+    auto & buffer = serialized.get_rcl_serialized_message();
+    // header.stamp is the first member, right after the 4 byte encapsulation header.
+    builtin_interfaces::msg::Time stamp = t;
+    memcpy(buffer.buffer + 4, &stamp.sec, sizeof(stamp.sec));
+    memcpy(buffer.buffer + 8, &stamp.nanosec, sizeof(stamp.nanosec));
+    publisher->publish(serialized);
+    benchmarkSerialization<sensor_msgs::msg::CameraInfo>(_stream_name[stream] + "/camera_info",
+      serialized, elapsedMs(start));
+  }
+
+  // With serialized_publish_benchmark, measure what rclcpp would have spent serializing the
+  // typed message against the time spent building the serialized message directly.
+  template<typename MsgT>
+  void benchmarkSerialization(
+    const std::string & topic, const rclcpp::SerializedMessage & serialized, double build_ms)
+  {
+    auto it = _serialization_stats.find(topic);
+    if (!_serialized_publish_benchmark || it == _serialization_stats.end()) {
+      return;
+    }
+    MsgT msg;
+    rclcpp::Serialization<MsgT> serializer;
+    serializer.deserialize_message(&serialized, &msg);
+    rclcpp::SerializedMessage reference;
+    auto start = std::chrono::steady_clock::now();
+    serializer.serialize_message(&msg, &reference);
+    auto & stats = it->second;
+    stats.first.add(elapsedMs(start));
+    stats.second.add(build_ms);
+    if (stats.first.count() >= STATS_REPORT_FRAMES) {
+      RCLCPP_INFO(logger_,
+        "Serialized publish of %s: %.3f ms/msg rclcpp serialization avoided, "
+        "%.3f ms/msg spent building the serialized message",
+        topic.c_str(), stats.first.mean(), stats.second.mean());
+      stats.first.reset();
+      stats.second.reset();
+    }
   }
 
 
@@ -1223,6 +5327,70 @@ private:
     float x, y, z;
   };
 
+#ifdef REALSENSE_RT_AUDIT
+  void publishRtAudit()
+  {
+    std::lock_guard<std::mutex> lock(_transition_mutex);
+    RtAudit msg;
+    msg.header.stamp = _ros_clock.now();
+    for (auto & report : rt_audit::collect()) {
+      if (0 == report.frames) {
+        continue;
+      }
+      realsense_camera_msgs::msg::RtAuditStage stage;
+      stage.name = report.name;
+      stage.frames = report.frames;
+      stage.allocations_per_frame = static_cast<float>(report.allocations) / report.frames;
+      stage.frees_per_frame = static_cast<float>(report.frees) / report.frames;
+      stage.bytes_per_frame = static_cast<float>(report.bytes) / report.frames;
+      stage.locks_per_frame = static_cast<float>(report.locks) / report.frames;
+      stage.contended_per_frame = static_cast<float>(report.contended) / report.frames;
+      stage.max_allocations = report.max_allocations;
+      stage.max_locks = report.max_locks;
+      _metrics.counter("realsense_hot_path_allocations_total",
+        "Heap allocations in the audited hot path stages.",
+        std::string("stage=\"") + report.name + "\"").add(report.allocations);
+      stage.over_budget =
+        rt_audit::overBudget(report, _rt_audit_allocation_budget, _rt_audit_lock_budget);
+      if (stage.over_budget) {
+        RCLCPP_ERROR(logger_, "Real-time budget exceeded by %s: up to %lu allocations and %lu "
+          "locks in a frame", report.name, report.max_allocations, report.max_locks);
+      }
+      msg.stages.push_back(stage);
+    }
+    _rt_audit_publisher->publish(msg);
+  }
+#endif
+
+  void publishImuSample(
+    const rclcpp::Publisher<sensor_msgs::msg::Imu>::SharedPtr & publisher,
+    const stream_index_pair & stream_index, double timestamp, const float3 & axes)
+  {
+    uint64_t elapsed_camera_ns = (timestamp - _camera_time_base) * 1000000;
+    rclcpp::Time t(_ros_time_base.nanoseconds() + elapsed_camera_ns, RCL_ROS_TIME);
+
+    auto imu_msg = sensor_msgs::msg::Imu();
+    imu_msg.header.frame_id = _optical_frame_id[stream_index];
+    imu_msg.orientation.x = 0.0;
+    imu_msg.orientation.y = 0.0;
+    imu_msg.orientation.z = 0.0;
+    imu_msg.orientation.w = 0.0;
+    imu_msg.orientation_covariance = {-1.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+
+    if (GYRO == stream_index) {
+      imu_msg.angular_velocity.x = axes.x;
+      imu_msg.angular_velocity.y = axes.y;
+      imu_msg.angular_velocity.z = axes.z;
+    } else if (ACCEL == stream_index) {
+      imu_msg.linear_acceleration.x = axes.x;
+      imu_msg.linear_acceleration.y = axes.y;
+      imu_msg.linear_acceleration.z = axes.z;
+    }
+    imu_msg.header.stamp = t;
+    publisher->publish(imu_msg);
+    RCLCPP_DEBUG(logger_, "Publish %s stream", _stream_name[stream_index].c_str());
+  }
+
   IMUInfo getImuInfo(const stream_index_pair & stream_index)
   {
     IMUInfo info;
@@ -1270,12 +5438,24 @@ private:
     }
   }
 
+  // Point _image of the frame's stream at the frame data. Only a header: cv_bridge copies the
+  // data into the message once. The entry was created by setupStreams.
+  cv::Mat & bindImage(const rs2::frame & f)
+  {
+    stream_index_pair stream{f.get_profile().stream_type(), f.get_profile().stream_index()};
+    auto video_frame = f.as<rs2::video_frame>();
+    auto & image = _image.at(stream);
+    image = cv::Mat(video_frame.get_height(), video_frame.get_width(), _image_format[stream],
+        const_cast<void *>(f.get_data()), video_frame.get_stride_in_bytes());
+    return image;
+  }
+
   void publishFrame(rs2::frame f, const rclcpp::Time & t)
   {
+    RT_AUDIT_SCOPE("publish_frame");
     RCLCPP_DEBUG(logger_, "publishFrame(...)");
     stream_index_pair stream{f.get_profile().stream_type(), f.get_profile().stream_index()};
-    auto & image = _image[stream];
-    image.data = const_cast<uchar *>(reinterpret_cast<const uchar *>(f.get_data()));
+    auto & image = bindImage(f);
     ++(_seq[stream]);
     auto & info_publisher = _info_publisher[stream];
     auto & image_publisher = _image_publishers[stream];
@@ -1301,14 +5481,348 @@ private:
       img->header.frame_id = _optical_frame_id[stream];
       img->header.stamp = t;
 
-      auto & cam_info = _camera_info[stream];
-      cam_info.header.stamp = t;
-      info_publisher->publish(cam_info);
+      if (_serialized_publish) {
+        publishSerializedCameraInfo(stream, t, info_publisher);
+      } else {
+        auto & cam_info = _camera_info[stream];
+        cam_info.header.stamp = t;
+        info_publisher->publish(cam_info);
+      }
 
       image_publisher.publish(img);
+      auto & metrics = _stream_metrics[stream];
+      metrics.frames_out->add();
+      metrics.bytes->add(img->data.size());
       RCLCPP_DEBUG(logger_, "%s stream published",
         rs2_stream_to_string(f.get_profile().stream_type()));
     }
+    recordStreamLatency(stream, f.get_frame_number());
+  }
+
+  // Latency from the sensor callback to the image being published, per stream.
+  void recordStreamLatency(const stream_index_pair & stream, uint64_t frame_number)
+  {
+    auto & arrivals = _arrival_ns[stream];
+    auto arrival_ns = arrivals[frame_number % arrivals.size()].load();
+    if (0 == arrival_ns) {
+      return;
+    }
+    auto now_ns = std::chrono::steady_clock::now().time_since_epoch().count();
+    auto & stats = _stream_latency[stream];
+    stats.add((now_ns - arrival_ns) / 1e6);
+    _stream_metrics[stream].latency->observe((now_ns - arrival_ns) / 1e9);
+    if (stats.count() >= STATS_REPORT_FRAMES) {
+      auto synced = _sync_group.find(stream);
+      RCLCPP_INFO(logger_, "%s (%s) publish latency over %d frames: mean %.2f ms, "
+        "min %.2f ms, max %.2f ms", _stream_name[stream].c_str(),
+        synced != _sync_group.end() ? "synced" : "direct", stats.count(),
+        stats.mean(), stats.min(), stats.max());
+      stats.reset();
+    }
+  }
+
+  // Series of one image stream, registered in setupMetrics() so that the hot paths only touch
+  // atomics.
+  struct StreamMetrics
+  {
+    metrics::Counter * frames_in;
+    metrics::Counter * frames_out;
+    metrics::Counter * dropped;
+    metrics::Counter * bytes;
+    metrics::Histogram * latency;
+    unsigned long long last_frame_number;
+  };
+
+  enum Product
+  {
+    PRODUCT_COLOR_TO_DEPTH,
+    PRODUCT_ALIGNED_DEPTH,
+    PRODUCT_POINTCLOUD,
+    PRODUCT_ALIGNED_POINTCLOUD,
+    PRODUCT_TSDF,
+    PRODUCT_PSEUDO_LIDAR,
+    PRODUCT_VIDEO,
+    PRODUCT_POINTCLOUD_BANDS,
+    PRODUCT_ACCUMULATED_POINTCLOUD,
+    PRODUCT_UPSAMPLED_DEPTH,
+    PRODUCT_QUANTIZED_DEPTH,
+    PRODUCT_VALIDITY_MASK,
+    PRODUCT_FILLED_DEPTH,
+    PRODUCT_CLUSTERS,
+    PRODUCT_DETECTIONS_3D,
+    PRODUCT_COUNT
+  };
+
+  struct ProductMetrics
+  {
+    metrics::Counter * messages;
+    metrics::Counter * bytes;
+    metrics::Histogram * latency;
+  };
+
+  // Register the metric series and serve them on _metrics_address:_metrics_port. The series
+  // are kept across cleanup() so the counters stay monotonic for the scraper.
+  void setupMetrics()
+  {
+    static const std::vector<double> latency_bounds = {
+      0.0005, 0.001, 0.002, 0.005, 0.01, 0.02, 0.05, 0.1, 0.2, 0.5};
+    for (auto & streams : IMAGE_STREAMS) {
+      for (auto & elem : streams) {
+        auto labels = "stream=\"" + _stream_name[elem] + "\"";
+        auto & metrics = _stream_metrics[elem];
+        metrics.frames_in = &_metrics.counter("realsense_stream_frames_received_total",
+            "Frames received from the sensor.", labels);
+        metrics.frames_out = &_metrics.counter("realsense_stream_frames_published_total",
+            "Images published.", labels);
+        metrics.dropped = &_metrics.counter("realsense_stream_frames_dropped_total",
+            "Frames missing from the sensor frame numbers.", labels);
+        metrics.bytes = &_metrics.counter("realsense_stream_bytes_published_total",
+            "Image bytes published.", labels);
+        metrics.latency = &_metrics.histogram("realsense_stream_publish_latency_seconds",
+            "Time from the sensor callback to the image being published.", latency_bounds,
+            labels);
+        metrics.last_frame_number = 0;
+      }
+    }
+
+    static const char * product_names[PRODUCT_COUNT] = {"color_to_depth", "aligned_depth",
+      "pointcloud", "aligned_pointcloud", "tsdf", "pseudo_lidar", "video", "pointcloud_bands",
+      "accumulated_pointcloud", "upsampled_depth", "quantized_depth", "validity_mask",
+      "hole_filling", "clusters", "detection_fusion"};
+    for (int product = 0; product < PRODUCT_COUNT; ++product) {
+      auto labels = std::string("product=\"") + product_names[product] + "\"";
+      auto & metrics = _product_metrics[product];
+      metrics.messages = &_metrics.counter("realsense_product_messages_total",
+          "Messages published.", labels);
+      metrics.bytes = &_metrics.counter("realsense_product_bytes_published_total",
+          "Payload bytes published.", labels);
+      metrics.latency = &_metrics.histogram("realsense_product_latency_seconds",
+          "Time spent computing and publishing one message.", latency_bounds, labels);
+    }
+
+    _frame_callback_metric = &_metrics.histogram("realsense_frame_callback_seconds",
+        "Time spent in the frame callback.", latency_bounds);
+    _matcher_queue_metric = &_metrics.gauge("realsense_frame_matcher_queue_depth",
+        "Frames waiting in the frame matcher.");
+
+    if (!_metrics_enabled || _metrics_server.port() > 0) {
+      return;
+    }
+    if (!_metrics_server.start(_metrics, _metrics_address, _metrics_port)) {
+      RCLCPP_ERROR(logger_, "Metrics endpoint cannot listen on %s:%d: %s",
+        _metrics_address.c_str(), _metrics_port, _metrics_server.error().c_str());
+      return;
+    }
+    RCLCPP_INFO(logger_, "Metrics are served on http://%s:%d/metrics",
+      _metrics_address.c_str(), _metrics_server.port());
+  }
+
+  // Count a frame received from the sensor. A gap in the frame numbers of a stream counts as
+  // dropped frames; the numbers restart when the sensor is restarted.
+  void countArrival(const stream_index_pair & stream, unsigned long long frame_number)
+  {
+    auto & metrics = _stream_metrics[stream];
+    metrics.frames_in->add();
+    if (0 != metrics.last_frame_number && frame_number > metrics.last_frame_number + 1) {
+      metrics.dropped->add(frame_number - metrics.last_frame_number - 1);
+    }
+    metrics.last_frame_number = frame_number;
+  }
+
+  void recordProduct(
+    Product product, size_t bytes,
+    const std::chrono::steady_clock::time_point & start)
+  {
+    auto & metrics = _product_metrics[product];
+    metrics.messages->add();
+    metrics.bytes->add(bytes);
+    metrics.latency->observe(elapsedMs(start) / 1000.0);
+  }
+
+  // Estimated bytes held by one stream buffer or optional product. These are computed from the
+  // configuration, not measured: buffers that grow at run time are not tracked.
+  struct MemoryEntry
+  {
+    std::string name;
+    size_t bytes;
+    bool * product;  // shedding flag, nullptr for stream buffers
+  };
+
+  // Estimated bytes held by every stream and enabled product, from the configuration.
+  std::vector<MemoryEntry> estimateMemory()
+  {
+    std::vector<MemoryEntry> entries;
+    auto pixels = [this](const stream_index_pair & stream) -> size_t
+      {
+        return (true == _enable[stream]) ? static_cast<size_t>(_width[stream]) * _height[stream] :
+               0;
+      };
+    for (auto & streams : IMAGE_STREAMS) {
+      for (auto & elem : streams) {
+        if (true != _enable[elem]) {
+          continue;
+        }
+        // The librealsense frame pool, and the message cv_bridge copies each frame into
+        auto frame_bytes = pixels(elem) * _unit_step_size[elem];
+        entries.push_back({_stream_name[elem] + "/frame_queue", _frame_queue_size * frame_bytes,
+            nullptr});
+        entries.push_back({_stream_name[elem] + "/message", frame_bytes, nullptr});
+      }
+    }
+
+    auto depth = pixels(DEPTH);
+    auto color = pixels(COLOR);
+    auto product = [&entries](const char * name, bool & enabled, size_t bytes)
+      {
+        if (enabled) {
+          entries.push_back({name, bytes, &enabled});
+        }
+      };
+    product("pointcloud", _pointcloud, depth * XYZRGB_POINT_STEP);
+    product("pointcloud_bands", _pointcloud_bands, depth * XYZRGB_POINT_STEP);
+    // Aligned image and the registration buffer
+    product("aligned_depth", _align_depth, 2 * color * sizeof(uint16_t));
+    product("aligned_pointcloud", _align_pointcloud, color * XYZRGB_POINT_STEP);
+    product("upsampled_depth", _upsample_depth,
+      color * (sizeof(uint8_t) + 2 * sizeof(float) + sizeof(uint16_t)));
+    product("color_aligned_to_depth", _color_aligned_to_depth, depth * _unit_step_size[COLOR]);
+    product("accumulated_pointcloud", _accumulate,
+      VoxelAccumulator::footprint(_accumulate_max_voxels) +
+      _accumulate_max_voxels * XYZRGB_POINT_STEP);
+    product("tsdf", _tsdf, TsdfVolume::footprint(_tsdf_max_blocks));
+    auto cluster_step = std::max(1, _cluster_pixel_step);
+    product("clusters", _clustering, depth / (cluster_step * cluster_step) *
+      (sizeof(Eigen::Vector3f) + 2 * sizeof(int32_t)));
+    product("pseudo_lidar", _pseudo_lidar, static_cast<size_t>(_pseudo_lidar_rings) *
+      _pseudo_lidar_columns * (sizeof(int32_t) + 2 * sizeof(float) + XYZRGB_POINT_STEP));
+    // Pyramid (4/3 of the image) and the filled image
+    product("hole_filling", _hole_filling, 3 * depth * sizeof(uint16_t));
+    product("validity_mask", _validity_mask, depth / 8);
+    product("quantized_depth", _quantized_depth, 65536 + depth);
+    product("detection_fusion", _detection_fusion,
+      (DETECTION_FRAME_BUFFER + 2) * color * sizeof(uint16_t) + 2 * color * sizeof(float));
+    product("pixels_to_3d", _pixels_to_3d, color * sizeof(uint16_t));
+    product("video_encoding", _video_encoding, color * 3 / 2);
+    if (_tsdf || _clustering || _pixels_to_3d || _pseudo_lidar) {
+      entries.push_back({"depth_rays", 2 * depth * sizeof(float), nullptr});
+    }
+    return entries;
+  }
+
+  size_t memoryTotal() const
+  {
+    size_t total = 0;
+    for (auto & entry : _memory_entries) {
+      total += entry.bytes;
+    }
+    return total;
+  }
+
+  // Fit the estimated memory of the configuration into memory_budget_mb: first shrink the
+  // librealsense frame pools, then shed optional products, least essential first. Runs before
+  // anything is allocated, once per configure.
+  void enforceMemoryBudget()
+  {
+    _default_frame_queue_size = MEMORY_DEFAULT_FRAME_QUEUE;
+    for (auto & stream : {DEPTH, COLOR}) {
+      auto sens = _sensors.find(stream);
+      if (sens != _sensors.end() && sens->second->supports(RS2_OPTION_FRAMES_QUEUE_SIZE)) {
+        _default_frame_queue_size =
+          static_cast<int>(sens->second->get_option(RS2_OPTION_FRAMES_QUEUE_SIZE));
+        break;
+      }
+    }
+    _frame_queue_size = _default_frame_queue_size;
+    _memory_entries = estimateMemory();
+    _memory_shed.clear();
+    if (_memory_budget_mb <= 0) {
+      return;
+    }
+
+    auto budget = static_cast<size_t>(_memory_budget_mb) << 20;
+    while (memoryTotal() > budget && _frame_queue_size > MEMORY_MIN_FRAME_QUEUE) {
+      --_frame_queue_size;
+      _memory_entries = estimateMemory();
+    }
+    if (_frame_queue_size != _default_frame_queue_size) {
+      RCLCPP_WARN(logger_, "Estimated memory budget: frame queues shrunk from %d to %d frames",
+        _default_frame_queue_size, _frame_queue_size);
+    }
+
+    // Products that others depend on come after their dependents.
+    for (auto enabled : {&_tsdf, &_accumulate, &_upsample_depth, &_pseudo_lidar, &_hole_filling,
+        &_clustering, &_color_aligned_to_depth, &_detection_fusion, &_video_encoding,
+        &_pixels_to_3d, &_quantized_depth, &_validity_mask, &_pointcloud_bands,
+        &_align_pointcloud, &_pointcloud, &_align_depth})
+    {
+      if (memoryTotal() <= budget) {
+        break;
+      }
+      for (auto & entry : _memory_entries) {
+        if (entry.product == enabled) {
+          RCLCPP_WARN(logger_, "Estimated memory budget: %s disabled, saving %.1f MB",
+            entry.name.c_str(), entry.bytes / 1048576.0);
+          _memory_shed.push_back(entry.name);
+          *enabled = false;
+        }
+      }
+      _memory_entries = estimateMemory();
+    }
+    if (!_memory_shed.empty()) {
+      // The default depth and color group is only formed for the products that need it.
+      parseSyncGroups();
+    }
+    if (memoryTotal() > budget) {
+      RCLCPP_ERROR(logger_, "Estimated memory budget: the enabled streams need an estimated "
+        "%.1f MB, over the %d MB budget", memoryTotal() / 1048576.0, _memory_budget_mb);
+    }
+  }
+
+  void publishMemoryDiagnostics()
+  {
+    std::lock_guard<std::mutex> lock(_transition_mutex);
+    diagnostic_msgs::msg::DiagnosticStatus status;
+    status.name = "realsense_ros2_camera: estimated memory";
+    status.hardware_id = _serial_no;
+    auto add = [&status](const std::string & key, const std::string & value)
+      {
+        diagnostic_msgs::msg::KeyValue key_value;
+        key_value.key = key;
+        key_value.value = value;
+        status.values.push_back(key_value);
+      };
+    for (auto & entry : _memory_entries) {
+      add(entry.name, std::to_string(entry.bytes));
+    }
+    auto total = memoryTotal();
+    auto budget = static_cast<size_t>(std::max(0, _memory_budget_mb)) << 20;
+    add("estimated_total", std::to_string(total));
+    add("budget", std::to_string(budget));
+    add("frame_queue_size", std::to_string(_frame_queue_size));
+    std::string shed;
+    for (auto & name : _memory_shed) {
+      shed += (shed.empty() ? "" : ",") + name;
+    }
+    add("shed", shed);
+
+    std::stringstream message;
+    message << (total >> 20) << " MB estimated";
+    status.level = diagnostic_msgs::msg::DiagnosticStatus::OK;
+    if (0 != budget) {
+      message << " of " << _memory_budget_mb << " MB budget";
+      if (total > budget) {
+        status.level = diagnostic_msgs::msg::DiagnosticStatus::ERROR;
+      } else if (!_memory_shed.empty() || _frame_queue_size != _default_frame_queue_size) {
+        status.level = diagnostic_msgs::msg::DiagnosticStatus::WARN;
+        message << ", reduced";
+      }
+    }
+    status.message = message.str();
+
+    diagnostic_msgs::msg::DiagnosticArray msg;
+    msg.header.stamp = _ros_clock.now();
+    msg.status.push_back(status);
+    _diagnostics_publisher->publish(msg);
   }
 
   bool getEnabledProfile(const stream_index_pair & stream_index, rs2::stream_profile & profile)
@@ -1329,7 +5843,7 @@ private:
   rclcpp::Clock _ros_clock;
   std::unique_ptr<rs2::context> _ctx;
 
-  std::map<stream_index_pair, std::unique_ptr<rs2::sensor>> _sensors;
+  std::map<stream_index_pair, std::shared_ptr<rs2::sensor>> _sensors;
 
   std::string _serial_no;
   float _depth_scale_meters;
@@ -1345,6 +5859,18 @@ private:
 
   std::map<stream_index_pair, image_transport::Publisher> _image_publishers;
   std::map<stream_index_pair, rclcpp::Publisher<sensor_msgs::msg::Imu>::SharedPtr> _imu_publishers;
+  // Running boxcar sums of the decimated IMU topics
+  struct ImuDecimator
+  {
+    int factor = 1;
+    int count = 0;
+    double sum[3] = {0.0, 0.0, 0.0};
+    double timestamp_sum = 0.0;
+  };
+  int _imu_decimated_fps;
+  std::map<stream_index_pair, ImuDecimator> _imu_decimators;
+  std::map<stream_index_pair,
+    rclcpp::Publisher<sensor_msgs::msg::Imu>::SharedPtr> _imu_decimated_publishers;
   std::map<stream_index_pair, int> _image_format;
   std::map<stream_index_pair, rs2_format> _format;
   std::map<stream_index_pair,
@@ -1352,6 +5878,24 @@ private:
   std::map<stream_index_pair,
     rclcpp::Publisher<realsense_camera_msgs::msg::IMUInfo>::SharedPtr> _imu_info_publisher;
   std::map<stream_index_pair, cv::Mat> _image;
+
+  int _memory_budget_mb;
+  int _default_frame_queue_size;
+  int _frame_queue_size;
+  std::vector<MemoryEntry> _memory_entries;
+  std::vector<std::string> _memory_shed;
+  rclcpp::Publisher<diagnostic_msgs::msg::DiagnosticArray>::SharedPtr _diagnostics_publisher;
+  rclcpp::TimerBase::SharedPtr _memory_timer;
+  bool _metrics_enabled;
+  std::string _metrics_address;
+  int _metrics_port;
+  // The server reads the registry, so it is declared after it and stopped first.
+  metrics::Registry _metrics;
+  metrics::Server _metrics_server;
+  std::map<stream_index_pair, StreamMetrics> _stream_metrics;
+  std::array<ProductMetrics, PRODUCT_COUNT> _product_metrics;
+  metrics::Histogram * _frame_callback_metric;
+  metrics::Gauge * _matcher_queue_metric;
   std::map<stream_index_pair, std::string> _encoding;
 
   std::string _base_frame_id;
@@ -1364,7 +5908,8 @@ private:
     _fe_to_imu_publisher;
 
   rclcpp::QoS qos;
-  bool _intialize_time_base;
+  std::atomic<bool> _intialize_time_base;
+  std::mutex _time_base_mutex;
   double _camera_time_base;
   std::map<stream_index_pair, std::vector<rs2::stream_profile>> _enabled_profiles;
 
@@ -1373,27 +5918,336 @@ private:
 
   rclcpp::Publisher<sensor_msgs::msg::PointCloud2>::SharedPtr _pointcloud_publisher;
   rclcpp::Publisher<sensor_msgs::msg::PointCloud2>::SharedPtr _align_pointcloud_publisher;
+  rclcpp::Publisher<PointCloudBand>::SharedPtr _pointcloud_band_publisher;
 
   rclcpp::Time _ros_time_base;
   rclcpp::Logger logger_ = rclcpp::get_logger("RealSenseCameraNode");
   rclcpp::TimerBase::SharedPtr timer_;
   bool _sync_frames;
+  std::string _sync_groups;
+  std::map<stream_index_pair, int> _sync_group;
+  int _sync_group_count;
+  std::function<void(rs2::frame)> _route_callback;
+  std::map<stream_index_pair, std::array<std::atomic<int64_t>, 64>> _arrival_ns;
+  std::map<stream_index_pair, LatencyStats> _stream_latency;
   bool _pointcloud;
   bool _align_pointcloud;
   bool _align_depth;
-  PipelineSyncer _syncer;
+  bool _pointcloud_bands;
+  int _pointcloud_band_rows;
+  bool _pointcloud_bands_bottom_up;
+  LatencyStats _first_band_latency;
+  LatencyStats _full_bands_latency;
+
+  bool _change_gate;
+  int _change_gate_grid_step;
+  double _change_gate_depth_delta;
+  double _change_gate_changed_ratio;
+  double _change_gate_keyframe_period;
+  double _change_gate_gyro_threshold;
+  std::vector<uint16_t> _gate_reference;
+  std::chrono::steady_clock::time_point _gate_last_keyframe;
+  std::chrono::steady_clock::time_point _gate_report_start;
+  int _gate_frames = 0;
+  int _gate_suppressed = 0;
+  double _gate_bytes_saved = 0.0;
+  std::atomic<float> _gyro_norm{0.f};
+
+  bool _accumulate;
+  double _accumulate_voxel_size;
+  double _accumulate_decay;
+  double _accumulate_min_weight;
+  int _accumulate_max_voxels;
+  int _accumulate_pixel_step;
+  double _accumulate_publish_rate;
+  double _accumulate_max_depth;
+  VoxelAccumulator _accumulator;
+  SpscRing<GyroSample, 4096> _gyro_samples;
+  double _last_gyro_ts = 0.0;
+  Eigen::Matrix3f _gyro_to_depth;
+  std::chrono::steady_clock::time_point _accumulate_last_publish;
+  rclcpp::Publisher<sensor_msgs::msg::PointCloud2>::SharedPtr _accumulate_publisher;
+
+  bool _tsdf;
+  double _tsdf_voxel_size;
+  double _tsdf_truncation;
+  int _tsdf_max_blocks;
+  double _tsdf_max_depth;
+  int _tsdf_pixel_step;
+  std::string _tsdf_world_frame;
+  double _tsdf_publish_rate;
+  std::vector<float> _depth_rays;
+  TsdfVolume _tsdf_volume;
+  std::vector<std::vector<uint64_t>> _tsdf_task_keys;
+  std::vector<uint32_t> _tsdf_block_frame;
+  std::vector<int32_t> _tsdf_visible;
+  uint32_t _tsdf_frame = 0;
+  bool _tsdf_full = false;
+  bool _tsdf_pose_valid = false;
+  TsdfVolume::Pose _tsdf_camera_to_world;
+  TsdfVolume::Pose _tsdf_world_to_camera;
+  std::vector<Eigen::Vector3f> _tsdf_surface;
+  std::shared_ptr<tf2_ros::Buffer> _tf_buffer;
+  std::shared_ptr<tf2_ros::TransformListener> _tf_listener;
+  std::chrono::steady_clock::time_point _tsdf_last_publish;
+  LatencyStats _tsdf_stats;
+  rclcpp::Publisher<sensor_msgs::msg::PointCloud2>::SharedPtr _tsdf_publisher;
+
+  struct ClusterStats
+  {
+    uint32_t count;
+    Eigen::Vector3f sum;
+    Eigen::Vector3f min;
+    Eigen::Vector3f max;
+  };
+  bool _clustering;
+  double _cluster_distance;
+  int _cluster_min_points;
+  int _cluster_pixel_step;
+  double _cluster_max_depth;
+  std::vector<Eigen::Vector3f> _cluster_points;
+  std::vector<int32_t> _cluster_parent;
+  std::vector<int32_t> _cluster_label;
+  std::vector<ClusterStats> _cluster_stats;
+  LatencyStats _clustering_stats;
+  rclcpp::Publisher<Clusters>::SharedPtr _clusters_publisher;
+
+  bool _pixels_to_3d;
+  std::vector<float> _color_rays;
+  // Only accessed through std::atomic_load and std::atomic_store
+  std::shared_ptr<const DepthSnapshot> _depth_snapshot;
+  rclcpp::Service<PixelsTo3D>::SharedPtr _pixels_to_3d_service;
+
+  int _rt_audit_allocation_budget;
+  int _rt_audit_lock_budget;
+#ifdef REALSENSE_RT_AUDIT
+  rclcpp::Publisher<RtAudit>::SharedPtr _rt_audit_publisher;
+  rclcpp::TimerBase::SharedPtr _rt_audit_timer;
+#endif
+
+  bool _triggered_capture;
+  bool _trigger_stop_sensors;
+  int _trigger_warmup_frames;
+  int _trigger_timeout_ms;
+  stream_index_pair _trigger_stream;
+  std::atomic<uint32_t> _trigger_remaining{0};
+  std::mutex _trigger_mutex;
+  std::condition_variable _trigger_cv;
+  bool _trigger_cancelled = false;  // under _trigger_mutex
+  std::chrono::steady_clock::time_point _trigger_start;
+  int _trigger_warmup = 0;
+  uint32_t _trigger_published = 0;
+  double _trigger_first_ms = 0.0;
+  double _trigger_last_ms = 0.0;
+  rclcpp::Service<TriggerCapture>::SharedPtr _trigger_service;
+  // Held by the trigger and snapshot services, which run on their own executor thread, and by
+  // the lifecycle transitions that touch the sensors.
+  rclcpp::CallbackGroup::SharedPtr _capture_callback_group;
+  std::mutex _capture_mutex;
+  // Held by the lifecycle transitions and by the default group callbacks of this node, which
+  // the multi-threaded executor runs next to the transitions of the managed node.
+  std::mutex _transition_mutex;
+
+  bool _snapshot;
+  int _snapshot_warmup_frames;
+  int _snapshot_timeout_ms;
+  rclcpp::Service<CaptureSnapshot>::SharedPtr _snapshot_service;
+
+  bool _quantized_depth;
+  std::string _quantized_depth_mode;
+  double _quantized_depth_min;
+  double _quantized_depth_max;
+  std::vector<uint8_t> _quantization_lut;
+  DepthQuantization _quantization;
+  image_transport::Publisher _quantized_depth_publisher;
+  rclcpp::Publisher<DepthQuantization>::SharedPtr _quantization_publisher;
+
+  bool _video_encoding;
+  int _video_bitrate;
+  int _video_gop;
+  std::string _video_preset;
+  std::string _video_profile;
+  bool _video_zero_latency;
+  int _video_threads;
+  size_t _video_subscribers = 0;
+  ColorEncoder _color_encoder;
+  rclcpp::Publisher<EncodedVideo>::SharedPtr _video_publisher;
+
+  bool _validity_mask;
+  double _validity_min_depth;
+  double _validity_max_depth;
+  rclcpp::Publisher<DepthValidityMask>::SharedPtr _validity_mask_publisher;
+
+  bool _hole_filling;
+  int _hole_filling_max_levels;
+  double _hole_filling_budget_ms;
+  std::vector<std::vector<uint16_t>> _fill_levels;
+  std::vector<int> _fill_widths;
+  std::vector<int> _fill_heights;
+  image_transport::Publisher _filled_depth_publisher;
+  image_transport::Publisher _filled_mask_publisher;
+  LatencyStats _hole_filling_stats;
+  int _hole_filling_over_budget = 0;
+
+  bool _pseudo_lidar;
+  int _pseudo_lidar_rings;
+  int _pseudo_lidar_columns;
+  double _pseudo_lidar_min_elevation;
+  double _pseudo_lidar_max_elevation;
+  double _pseudo_lidar_max_range;
+  std::vector<int32_t> _pseudo_lidar_index;
+  std::vector<float> _pseudo_lidar_ray_x;
+  std::vector<float> _pseudo_lidar_ray_y;
+  rs2::frame _last_infra1;
+  std::mutex _last_infra1_mutex;
+  LatencyStats _pseudo_lidar_stats;
+  rclcpp::Publisher<sensor_msgs::msg::PointCloud2>::SharedPtr _pseudo_lidar_publisher;
+
+  bool _detection_fusion;
+  double _detection_match_tolerance_ms;
+  double _detection_roi_shrink;
+  // Ring of the latest aligned depth snapshots, slots accessed with atomic_load/atomic_store
+  std::array<std::shared_ptr<const DepthSnapshot>, DETECTION_FRAME_BUFFER> _aligned_snapshots;
+  size_t _aligned_snapshot_count = 0;
+  // Preallocated buffers of the ring: every slot, plus one being read and one being filled.
+  std::array<std::shared_ptr<DepthSnapshot>, DETECTION_FRAME_BUFFER + 2> _aligned_pool;
+  LatencyStats _detection_stats;
+  int _detection_unmatched = 0;
+  rclcpp::Publisher<Detection3DArray>::SharedPtr _detections_3d_publisher;
+  rclcpp::Subscription<Detection2DArray>::SharedPtr _detections_subscription;
+
+  bool _serialized_publish;
+  bool _serialized_publish_benchmark;
+  rclcpp::SerializedMessage _pointcloud_serialized;
+  rclcpp::SerializedMessage _align_pointcloud_serialized;
+  std::map<stream_index_pair, rclcpp::SerializedMessage> _camera_info_serialized;
+  std::map<std::string, std::pair<LatencyStats, LatencyStats>> _serialization_stats;
+  std::vector<std::unique_ptr<PipelineSyncer>> _syncers;
+  bool _frame_matcher;
+  double _frame_matcher_tolerance_ms;
+  double _frame_matcher_max_wait_ms;
+  std::vector<std::unique_ptr<FrameMatcher>> _matchers;
+  std::function<void(rs2::frame)> _frame_callback;
+  std::function<void(rs2::frame)> _imu_callback;
+  // Key stream of every opened sensor (DEPTH, COLOR, FISHEYE, GYRO).
+  std::vector<stream_index_pair> _opened_sensors;
+  bool _streaming = false;
   rs2_extrinsics _depth2color_extrinsics;
 
   rs2::frameset _aligned_frameset;
+  rs2::align _align{RS2_STREAM_COLOR};
+  const uint16_t * _aligned_depth_data = nullptr;
+  std::string _registration_engine;
+  bool _registration_hole_fill;
+  bool _registration_benchmark;
+  rs2_extrinsics _depth_to_color;
+  std::vector<float> _registration_rays;
+  std::unique_ptr<std::atomic<uint16_t>[]> _registration_zbuffer;
+  std::vector<uint16_t> _registered_depth;
+  int _processing_threads;
+  WorkerPool _processing_pool;
+  bool _upsample_depth;
+  int _upsample_radius;
+  double _upsample_sigma_spatial;
+  double _upsample_sigma_color;
+  double _upsample_budget_ms;
+  std::vector<float> _upsample_spatial_lut;
+  std::array<float, 256> _upsample_range_lut;
+  std::vector<uint8_t> _upsample_luma;
+  std::vector<float> _upsample_value;
+  std::vector<float> _upsample_weight;
+  image_transport::Publisher _upsample_depth_publisher;
+  LatencyStats _upsample_stats;
+  int _upsample_fallbacks = 0;
+  bool _color_aligned_to_depth;
+  bool _color_to_depth_exact;
+  std::vector<float> _color_to_depth_ax;
+  std::vector<float> _color_to_depth_ay;
+  std::vector<float> _color_to_depth_az;
+  float _color_to_depth_b[3];
+  image_transport::Publisher _color_to_depth_publisher;
+  rclcpp::Publisher<sensor_msgs::msg::CameraInfo>::SharedPtr _color_to_depth_info_publisher;
+  LatencyStats _color_to_depth_stats;
+  LatencyStats _registration_stats;
+  LatencyStats _align_stats;
 };  // end class
+
+// Managed lifecycle front end for RealSenseCameraNode. Configuring opens the sensors and creates
+// the publishers, so activating only has to start streaming; deactivating keeps the camera
+// configured but idle.
+class RealSenseLifecycleNode : public rclcpp_lifecycle::LifecycleNode
+{
+public:
+  using CallbackReturn =
+    rclcpp_lifecycle::node_interfaces::LifecycleNodeInterface::CallbackReturn;
+
+  explicit RealSenseLifecycleNode(std::shared_ptr<RealSenseCameraNode> camera)
+  : LifecycleNode("RealSenseCameraLifecycle"),
+    _camera(camera)
+  {}
+
+  CallbackReturn on_configure(const rclcpp_lifecycle::State &) override
+  {
+    return transition("configure", [this]() {_camera->configure();});
+  }
+
+  CallbackReturn on_activate(const rclcpp_lifecycle::State &) override
+  {
+    return transition("activate", [this]() {_camera->activate();});
+  }
+
+  CallbackReturn on_deactivate(const rclcpp_lifecycle::State &) override
+  {
+    return transition("deactivate", [this]() {_camera->deactivate();});
+  }
+
+  CallbackReturn on_cleanup(const rclcpp_lifecycle::State &) override
+  {
+    return transition("cleanup", [this]() {_camera->cleanup();});
+  }
+
+  CallbackReturn on_shutdown(const rclcpp_lifecycle::State &) override
+  {
+    return transition("shutdown", [this]() {_camera->cleanup();});
+  }
+
+private:
+  CallbackReturn transition(const char * name, const std::function<void()> & action)
+  {
+    auto start = std::chrono::steady_clock::now();
+    try {
+      action();
+    } catch (const std::exception & ex) {
+      RCLCPP_ERROR(get_logger(), "Lifecycle %s failed: %s", name, ex.what());
+      return CallbackReturn::FAILURE;
+    }
+    RCLCPP_INFO(get_logger(), "Lifecycle %s took %.1f ms", name, elapsedMs(start));
+    return CallbackReturn::SUCCESS;
+  }
+
+  std::shared_ptr<RealSenseCameraNode> _camera;
+};
 }  // namespace realsense_ros2_camera
 
 int main(int argc, char * argv[])
 {
   rclcpp::init(argc, argv);
   auto node = std::make_shared<realsense_ros2_camera::RealSenseCameraNode>();
-  node->onInit();
-  rclcpp::spin(node);
+  bool lifecycle;
+  node->get_parameter_or("enable_lifecycle", lifecycle, realsense_ros2_camera::LIFECYCLE);
+  if (lifecycle) {
+    auto managed = std::make_shared<realsense_ros2_camera::RealSenseLifecycleNode>(node);
+    // Multi-threaded, so the blocking capture services do not hold up the other callbacks.
+    rclcpp::executors::MultiThreadedExecutor executor;
+    executor.add_node(node);
+    executor.add_node(managed->get_node_base_interface());
+    executor.spin();
+  } else {
+    node->onInit();
+    rclcpp::executors::MultiThreadedExecutor executor;
+    executor.add_node(node);
+    executor.spin();
+  }
   rclcpp::shutdown();
   return 0;
 }
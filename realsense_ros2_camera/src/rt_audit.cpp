@@ -0,0 +1,240 @@
+// Copyright (c) 2018 Intel Corporation. All Rights Reserved
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// cpplint: c system headers
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+// cpplint: c++ system headers
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <vector>
+// cpplint: other headers
+#include "realsense_ros2_camera/constants.hpp"
+#include "realsense_ros2_camera/rt_audit.hpp"
+
+// Interposed functions may run before any constructor and inside the allocator of any thread,
+// so everything they touch is constant initialized and nothing here allocates or locks.
+namespace
+{
+struct ThreadCounters
+{
+  uint64_t allocations;
+  uint64_t frees;
+  uint64_t bytes;
+  uint64_t locks;
+  uint64_t contended;
+};
+
+thread_local ThreadCounters t_counters;
+
+struct Stage
+{
+  std::atomic<const char *> name;
+  std::atomic<int> warmup;
+  std::atomic<uint64_t> frames;
+  std::atomic<uint64_t> allocations;
+  std::atomic<uint64_t> frees;
+  std::atomic<uint64_t> bytes;
+  std::atomic<uint64_t> locks;
+  std::atomic<uint64_t> contended;
+  std::atomic<uint64_t> max_allocations;
+  std::atomic<uint64_t> max_locks;
+};
+
+const int MAX_STAGES = 32;
+Stage g_stages[MAX_STAGES];
+std::atomic<int> g_stage_count{0};
+std::atomic_flag g_register_lock = ATOMIC_FLAG_INIT;
+
+void updateMax(std::atomic<uint64_t> & max, uint64_t value)
+{
+  auto current = max.load(std::memory_order_relaxed);
+  while (value > current && !max.compare_exchange_weak(current, value)) {
+  }
+}
+
+using MutexLockFn = int (*)(pthread_mutex_t *);
+std::atomic<MutexLockFn> g_mutex_lock{nullptr};
+}  // namespace
+
+extern "C" {
+void * __libc_malloc(size_t size);
+void * __libc_calloc(size_t count, size_t size);
+void * __libc_realloc(void * ptr, size_t size);
+void * __libc_memalign(size_t alignment, size_t size);
+void * __libc_valloc(size_t size);
+void __libc_free(void * ptr);
+
+void * malloc(size_t size)
+{
+  ++t_counters.allocations;
+  t_counters.bytes += size;
+  return __libc_malloc(size);
+}
+
+void * calloc(size_t count, size_t size)
+{
+  ++t_counters.allocations;
+  t_counters.bytes += count * size;
+  return __libc_calloc(count, size);
+}
+
+void * realloc(void * ptr, size_t size)
+{
+  ++t_counters.allocations;
+  t_counters.bytes += size;
+  return __libc_realloc(ptr, size);
+}
+
+// The aligned allocators are used by aligned operator new and cv::fastMalloc. Their memory is
+// released with free, so they must be counted as well.
+void * memalign(size_t alignment, size_t size)
+{
+  ++t_counters.allocations;
+  t_counters.bytes += size;
+  return __libc_memalign(alignment, size);
+}
+
+void * aligned_alloc(size_t alignment, size_t size)
+{
+  return memalign(alignment, size);
+}
+
+int posix_memalign(void ** ptr, size_t alignment, size_t size)
+{
+  if (0 != alignment % sizeof(void *) || 0 != (alignment & (alignment - 1))) {
+    return EINVAL;
+  }
+  auto memory = memalign(alignment, size);
+  if (nullptr == memory) {
+    return ENOMEM;
+  }
+  *ptr = memory;
+  return 0;
+}
+
+void * valloc(size_t size)
+{
+  ++t_counters.allocations;
+  t_counters.bytes += size;
+  return __libc_valloc(size);
+}
+
+void free(void * ptr)
+{
+  if (nullptr != ptr) {
+    ++t_counters.frees;
+  }
+  __libc_free(ptr);
+}
+
+// A lock that cannot be taken right away would block: it is counted as contended.
+int pthread_mutex_lock(pthread_mutex_t * mutex)
+{
+  ++t_counters.locks;
+  if (0 == pthread_mutex_trylock(mutex)) {
+    return 0;
+  }
+  ++t_counters.contended;
+  auto lock = g_mutex_lock.load(std::memory_order_acquire);
+  if (nullptr == lock) {
+    lock = reinterpret_cast<MutexLockFn>(dlsym(RTLD_NEXT, "pthread_mutex_lock"));
+    g_mutex_lock.store(lock, std::memory_order_release);
+  }
+  return lock(mutex);
+}
+}  // extern "C"
+
+namespace realsense_ros2_camera
+{
+namespace rt_audit
+{
+int registerStage(const char * name)
+{
+  while (g_register_lock.test_and_set(std::memory_order_acquire)) {
+  }
+  auto count = g_stage_count.load();
+  int stage = 0;
+  while (stage < count && 0 != strcmp(g_stages[stage].name, name)) {
+    ++stage;
+  }
+  if (stage == count && count < MAX_STAGES) {
+    g_stages[stage].name = name;
+    g_stage_count = count + 1;
+  }
+  g_register_lock.clear(std::memory_order_release);
+  // Stages past the table size are charged to the last one.
+  return std::min(stage, MAX_STAGES - 1);
+}
+
+std::vector<StageReport> collect()
+{
+  std::vector<StageReport> reports;
+  auto count = g_stage_count.load();
+  for (int i = 0; i < count; ++i) {
+    auto & stage = g_stages[i];
+    StageReport report;
+    report.name = stage.name;
+    report.frames = stage.frames.exchange(0);
+    report.allocations = stage.allocations.exchange(0);
+    report.frees = stage.frees.exchange(0);
+    report.bytes = stage.bytes.exchange(0);
+    report.locks = stage.locks.exchange(0);
+    report.contended = stage.contended.exchange(0);
+    report.max_allocations = stage.max_allocations.exchange(0);
+    report.max_locks = stage.max_locks.exchange(0);
+    reports.push_back(report);
+  }
+  return reports;
+}
+
+bool overBudget(const StageReport & report, int allocation_budget, int lock_budget)
+{
+  return (allocation_budget >= 0 &&
+         report.max_allocations > static_cast<uint64_t>(allocation_budget)) ||
+         (lock_budget >= 0 && report.max_locks > static_cast<uint64_t>(lock_budget));
+}
+
+Scope::Scope(int stage)
+: _stage(stage),
+  _allocations(t_counters.allocations),
+  _frees(t_counters.frees),
+  _bytes(t_counters.bytes),
+  _locks(t_counters.locks),
+  _contended(t_counters.contended)
+{}
+
+Scope::~Scope()
+{
+  auto & stage = g_stages[_stage];
+  // The first frames fill caches, pools and lazily created state: they are not steady state.
+  if (stage.warmup.load(std::memory_order_relaxed) < RT_AUDIT_WARMUP_FRAMES) {
+    ++stage.warmup;
+    return;
+  }
+  auto allocations = t_counters.allocations - _allocations;
+  auto locks = t_counters.locks - _locks;
+  ++stage.frames;
+  stage.allocations += allocations;
+  stage.frees += t_counters.frees - _frees;
+  stage.bytes += t_counters.bytes - _bytes;
+  stage.locks += locks;
+  stage.contended += t_counters.contended - _contended;
+  updateMax(stage.max_allocations, allocations);
+  updateMax(stage.max_locks, locks);
+}
+}  // namespace rt_audit
+}  // namespace realsense_ros2_camera
@@ -23,6 +23,7 @@
 #include <sensor_msgs/msg/point_cloud2.hpp>
 #include <sensor_msgs/point_cloud2_iterator.hpp>
 #include <realsense_ros2_camera/constants.hpp>
+#include <realsense_camera_msgs/msg/rt_audit.hpp>
 // cpplint: c++ system headers
 #include <chrono>
 #include <map>
@@ -53,6 +54,13 @@ bool g_tf_color = false;
 int g_fps = 0;
 float g_latency = 0.0f;
 
+// Only published by nodes built with REALSENSE_RT_AUDIT, which are launched with these
+// budgets so that a report can be over budget.
+const int g_rt_audit_allocation_budget = 64;
+const int g_rt_audit_lock_budget = 64;
+int g_rt_audit_reports = 0;
+bool g_rt_audit_over_budget = false;
+
 int encoding2Mat(const std::string & encoding)
 {
   std::map<std::string, int> map_encoding =
@@ -184,6 +192,20 @@ void tfCallback(const tf2_msgs::msg::TFMessage::SharedPtr msg)
   g_tf_recv = true;
 }
 
+void rtAuditCallback(const realsense_camera_msgs::msg::RtAudit::SharedPtr msg)
+{
+  auto audited = false;
+  for (auto & stage : msg->stages) {
+    audited = audited || stage.frames > 0;
+    if (stage.over_budget) {
+      g_rt_audit_over_budget = true;
+    }
+  }
+  if (audited) {
+    ++g_rt_audit_reports;
+  }
+}
+
 TEST(TestAPI, testDepthStream) {
   if (g_enable_depth) {
     EXPECT_TRUE(g_depth_recv);
@@ -241,6 +263,13 @@ TEST(TestAPI, testFPS) {
   EXPECT_GT(g_fps, 0);
 }
 
+#ifdef REALSENSE_RT_AUDIT
+TEST(TestAPI, testRtAuditBudget) {
+  EXPECT_GT(g_rt_audit_reports, 0);
+  EXPECT_FALSE(g_rt_audit_over_budget);
+}
+#endif
+
 int main(int argc, char * argv[]) try
 {
   testing::InitGoogleTest(&argc, argv);
@@ -264,7 +293,16 @@ int main(int argc, char * argv[]) try
   auto sub6 = node->create_subscription<tf2_msgs::msg::TFMessage>("tf_static",
       tfCallback, rmw_qos_profile_default);
 
-  system("realsense_ros2_camera &");
+  auto sub7 = node->create_subscription<realsense_camera_msgs::msg::RtAudit>("camera/rt_audit",
+      rtAuditCallback, rmw_qos_profile_default);
+
+  std::string command = "realsense_ros2_camera";
+#ifdef REALSENSE_RT_AUDIT
+  command += " --ros-args -p rt_audit_allocation_budget:=" +
+    std::to_string(g_rt_audit_allocation_budget) + " -p rt_audit_lock_budget:=" +
+    std::to_string(g_rt_audit_lock_budget);
+#endif
+  system((command + " &").c_str());
 
   rclcpp::WallRate loop_rate(50);
   for (int i = 0; i < 300; ++i) {
@@ -0,0 +1,144 @@
+// Copyright (c) 2018 Intel Corporation. All Rights Reserved
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// cpplint: c system headers
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <realsense_ros2_camera/metrics.hpp>
+// cpplint: c++ system headers
+#include <string>
+#include <thread>
+#include <vector>
+
+using realsense_ros2_camera::metrics::Registry;
+using realsense_ros2_camera::metrics::Server;
+
+// Send request to 127.0.0.1:port and return the whole response.
+std::string httpRequest(int port, const std::string & request)
+{
+  auto fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(static_cast<uint16_t>(port));
+  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+  std::string response;
+  if (0 == connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr))) {
+    send(fd, request.data(), request.size(), 0);
+    char buffer[1024];
+    ssize_t received;
+    while ((received = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+      response.append(buffer, received);
+    }
+  }
+  close(fd);
+  return response;
+}
+
+bool contains(const std::string & text, const std::string & line)
+{
+  return text.find(line + "\n") != std::string::npos;
+}
+
+TEST(TestMetrics, testCounter) {
+  Registry registry;
+  auto & depth = registry.counter("frames_total", "Frames.", "stream=\"depth\"");
+  auto & color = registry.counter("frames_total", "Frames.", "stream=\"color\"");
+  depth.add();
+  depth.add(2);
+  color.add();
+  EXPECT_EQ(&depth, &registry.counter("frames_total", "Frames.", "stream=\"depth\""));
+
+  auto text = registry.render();
+  EXPECT_TRUE(contains(text, "# HELP frames_total Frames."));
+  EXPECT_TRUE(contains(text, "# TYPE frames_total counter"));
+  EXPECT_TRUE(contains(text, "frames_total{stream=\"depth\"} 3"));
+  EXPECT_TRUE(contains(text, "frames_total{stream=\"color\"} 1"));
+}
+
+TEST(TestMetrics, testHistogram) {
+  Registry registry;
+  auto & histogram = registry.histogram("latency_seconds", "Latency.", {0.001, 0.01});
+  histogram.observe(0.0005);
+  histogram.observe(0.001);
+  histogram.observe(0.005);
+  histogram.observe(1.0);
+
+  auto text = registry.render();
+  EXPECT_TRUE(contains(text, "# TYPE latency_seconds histogram"));
+  EXPECT_TRUE(contains(text, "latency_seconds_bucket{le=\"0.001\"} 2"));
+  EXPECT_TRUE(contains(text, "latency_seconds_bucket{le=\"0.01\"} 3"));
+  EXPECT_TRUE(contains(text, "latency_seconds_bucket{le=\"+Inf\"} 4"));
+  EXPECT_TRUE(contains(text, "latency_seconds_sum 1.0065"));
+  EXPECT_TRUE(contains(text, "latency_seconds_count 4"));
+}
+
+TEST(TestMetrics, testConcurrentUpdates) {
+  Registry registry;
+  auto & counter = registry.counter("updates_total", "Updates.");
+  auto & histogram = registry.histogram("values", "Values.", {0.5});
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&]() {
+        for (int n = 0; n < 10000; ++n) {
+          counter.add();
+          histogram.observe(1.0);
+        }
+      });
+  }
+  for (auto & thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(40000u, counter.value());
+  EXPECT_EQ(40000u, histogram.buckets().back());
+  EXPECT_DOUBLE_EQ(40000.0, histogram.sum());
+}
+
+TEST(TestMetrics, testServer) {
+  Registry registry;
+  registry.counter("frames_total", "Frames.", "stream=\"depth\"").add(7);
+  registry.gauge("queue_depth", "Queue depth.").set(2);
+  Server server;
+  ASSERT_TRUE(server.start(registry, "127.0.0.1", 0));
+  ASSERT_GT(server.port(), 0);
+
+  auto response = httpRequest(server.port(), "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  EXPECT_EQ(0u, response.find("HTTP/1.0 200 OK\r\n"));
+  EXPECT_NE(std::string::npos, response.find("Content-Type: text/plain; version=0.0.4"));
+  EXPECT_TRUE(contains(response, "frames_total{stream=\"depth\"} 7"));
+  EXPECT_TRUE(contains(response, "queue_depth 2"));
+
+  // Updates are visible on the next scrape.
+  registry.counter("frames_total", "Frames.", "stream=\"depth\"").add();
+  response = httpRequest(server.port(), "GET /metrics HTTP/1.0\r\n\r\n");
+  EXPECT_TRUE(contains(response, "frames_total{stream=\"depth\"} 8"));
+
+  response = httpRequest(server.port(), "GET / HTTP/1.0\r\n\r\n");
+  EXPECT_EQ(0u, response.find("HTTP/1.0 404 Not Found\r\n"));
+
+  auto port = server.port();
+  server.stop();
+  EXPECT_EQ(0, server.port());
+  EXPECT_TRUE(httpRequest(port, "GET /metrics HTTP/1.0\r\n\r\n").empty());
+}
+
+TEST(TestMetrics, testServerInvalidAddress) {
+  Registry registry;
+  Server server;
+  EXPECT_FALSE(server.start(registry, "not an address", 0));
+  EXPECT_EQ("not an IPv4 address", server.error());
+  EXPECT_EQ(0, server.port());
+}
@@ -0,0 +1,93 @@
+// Copyright (c) 2018 Intel Corporation. All Rights Reserved
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// cpplint: c system headers
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <realsense_ros2_camera/constants.hpp>
+#include <realsense_ros2_camera/rt_audit.hpp>
+// cpplint: c++ system headers
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+using realsense_ros2_camera::rt_audit::Scope;
+using realsense_ros2_camera::rt_audit::StageReport;
+using realsense_ros2_camera::rt_audit::collect;
+using realsense_ros2_camera::rt_audit::overBudget;
+using realsense_ros2_camera::rt_audit::registerStage;
+
+const int FRAMES = 10;
+
+// Stores through a volatile pointer keep the allocations from being optimized away.
+void * volatile g_sink;
+std::mutex g_mutex;
+
+// Run the warm-up and FRAMES audited frames of the named stage, each with the given number of
+// heap allocations and mutex locks, and return the report of the stage.
+StageReport auditFrames(const char * name, int allocations, int locks)
+{
+  auto stage = registerStage(name);
+  for (int frame = 0; frame < realsense_ros2_camera::RT_AUDIT_WARMUP_FRAMES + FRAMES; ++frame) {
+    Scope scope(stage);
+    for (int i = 0; i < allocations; ++i) {
+      g_sink = malloc(64);
+      free(g_sink);
+    }
+    for (int i = 0; i < locks; ++i) {
+      std::lock_guard<std::mutex> lock(g_mutex);
+    }
+  }
+  for (auto & report : collect()) {
+    if (0 == strcmp(report.name, name)) {
+      return report;
+    }
+  }
+  return StageReport{name, 0, 0, 0, 0, 0, 0, 0, 0};
+}
+
+TEST(TestRtAudit, testAllocationBudget) {
+  auto report = auditFrames("allocations", 8, 0);
+  EXPECT_EQ(static_cast<uint64_t>(FRAMES), report.frames);
+  EXPECT_GE(report.max_allocations, 8u);
+  EXPECT_GE(report.frees, 8u * FRAMES);
+  EXPECT_TRUE(overBudget(report, 4, -1));
+  EXPECT_FALSE(overBudget(report, static_cast<int>(report.max_allocations), -1));
+  EXPECT_FALSE(overBudget(report, -1, -1));
+}
+
+TEST(TestRtAudit, testLockBudget) {
+  auto report = auditFrames("locks", 0, 8);
+  EXPECT_EQ(static_cast<uint64_t>(FRAMES), report.frames);
+  EXPECT_GE(report.max_locks, 8u);
+  EXPECT_EQ(0u, report.contended);
+  EXPECT_TRUE(overBudget(report, -1, 4));
+  EXPECT_FALSE(overBudget(report, -1, static_cast<int>(report.max_locks)));
+}
+
+TEST(TestRtAudit, testQuietStage) {
+  auto report = auditFrames("quiet", 0, 0);
+  EXPECT_EQ(static_cast<uint64_t>(FRAMES), report.frames);
+  EXPECT_EQ(0u, report.max_allocations);
+  EXPECT_EQ(0u, report.max_locks);
+  EXPECT_FALSE(overBudget(report, 0, 0));
+}
+
+TEST(TestRtAudit, testCollectResets) {
+  auditFrames("reset", 1, 1);
+  for (auto & report : collect()) {
+    EXPECT_EQ(0u, report.frames);
+    EXPECT_EQ(0u, report.max_allocations);
+  }
+}